@@ -8,6 +8,7 @@
 #include <stdarg.h>
 #include <stdint.h>
 struct list;
+struct vector;
 
 /*
  * The type of comparison functions.
@@ -45,7 +46,7 @@ void fatal_error(char *msg, ...);
 
 /*
  * Reads the given file, and parses it into words (tokens).
- * Adds the words to the given list, in the same order that they
+ * Adds the words to the given vector, in the same order that they
  * occur.
  *
  * This tokenizer ignores punctuation and whitespace and converts text, so if the text is
@@ -53,7 +54,7 @@ void fatal_error(char *msg, ...);
  * words will be "hello", "this", "is", "an", and "example".
  */
 
-void tokenize_file(const char *filepath, struct list *list);
+void tokenize_file(const char *filepath, struct vector *tokens);
 
 /*
  * Recursively finds the names of all files under the given root directory.
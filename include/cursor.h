@@ -0,0 +1,71 @@
+#ifndef CURSOR_H
+#define CURSOR_H
+
+#include "common.h"
+#include "set.h"
+#include "roaring.h"
+
+/*
+ * Type of cursors.
+ * A cursor lazily produces the elements of a set in ascending order.
+ * Cursors over sets are combined by operator cursors (AND/OR/ANDNOT),
+ * which pull elements from their operands on demand; no intermediate
+ * sets are built while streaming through a tree of cursors.
+ * Operator cursors are n-ary: combining e.g. an OR cursor with another
+ * operand extends the existing cursor rather than nesting it.
+ */
+typedef struct cursor cursor_t;
+
+/*
+ * Creates a cursor over the elements of the given set.
+ * The set must outlive the cursor.
+ */
+cursor_t *cursor_create_set(set_t *set);
+
+/*
+ * Creates a cursor over the values of the given bitmap, as elements cast
+ * to pointers and ordered by compare_pointers. The value 0 is reserved,
+ * as it would read as NULL. The bitmap must outlive the cursor.
+ */
+cursor_t *cursor_create_bitmap(roaring_t *bits);
+
+/*
+ * Creates operator cursors producing the intersection, union and
+ * difference of the elements of cursors a and b respectively.
+ * The operator cursor takes ownership of both operands.
+ * Returns NULL on failure, in which case the operands are destroyed.
+ */
+cursor_t *cursor_create_and(cursor_t *a, cursor_t *b);
+cursor_t *cursor_create_or(cursor_t *a, cursor_t *b);
+cursor_t *cursor_create_andnot(cursor_t *a, cursor_t *b);
+
+/*
+ * Destroys the given cursor, along with any operands.
+ */
+void cursor_destroy(cursor_t *cur);
+
+/*
+ * Returns the next element of the given cursor, or NULL when exhausted.
+ */
+void *cursor_next(cursor_t *cur);
+
+/*
+ * Returns the first element of the given cursor which is not less than
+ * target, skipping any elements inbetween, or NULL when exhausted.
+ * target must not be less than the last element returned.
+ */
+void *cursor_advance(cursor_t *cur, void *target);
+
+/*
+ * Returns the height of the given cursor tree; 1 for a set cursor.
+ * Chains of the same associative operator count as a single level.
+ */
+int cursor_depth(cursor_t *cur);
+
+/*
+ * Returns a new set containing all remaining elements of the given cursor,
+ * or NULL on failure.
+ */
+set_t *cursor_collect(cursor_t *cur);
+
+#endif
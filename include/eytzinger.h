@@ -0,0 +1,41 @@
+#ifndef EYTZINGER_H
+#define EYTZINGER_H
+
+/*
+ * Type of Eytzinger dictionary.
+ * An immutable dictionary mapping each of a sorted set of string keys to
+ * its ordinal, like fst_t, laid out for exact lookups: the keys form an
+ * implicit binary search tree stored breadth-first in a single array, so a
+ * lookup descends without following pointers, and fetches the nodes a few
+ * levels below it ahead of reaching them. Each node holds the first bytes
+ * of its key, and the key itself is only compared when those are equal.
+ */
+typedef struct eytzinger eytzinger_t;
+
+/*
+ * Builds a dictionary of the given keys, which must be unique and sorted
+ * in ascending (strcmp) order. The key at keys[i] is given ordinal i.
+ * Only the array of keys is copied, so the keys themselves must outlive
+ * the dictionary.
+ * Returns NULL on failure.
+ */
+eytzinger_t *eytzinger_build(char **keys, int n_keys);
+
+/*
+ * Destroys the given dictionary.
+ */
+void eytzinger_destroy(eytzinger_t *dict);
+
+/*
+ * Returns the ordinal of the given key, or -1 if there is no such key.
+ */
+int eytzinger_get(eytzinger_t *dict, const char *key);
+
+/*
+ * Stores the ordinal of each of the given keys in 'ordinals', or -1 for
+ * keys that are not found. The lookups descend the tree together, a level
+ * at a time, so the cache misses of each overlap those of the others.
+ */
+void eytzinger_getmany(eytzinger_t *dict, char **keys, int n_keys, int *ordinals);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef FILECACHE_H
+#define FILECACHE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/*
+ * Cache of static files served over HTTP.
+ *
+ * Each entry keeps an open file descriptor along with a precomputed response
+ * header (Content-Type, Content-Length, ETag, Last-Modified). Small files are
+ * additionally kept in memory, larger ones are sent with sendfile(2) from the
+ * cached descriptor. Entries are evicted in least recently used order once
+ * the cache exceeds its byte or entry limits, and are revalidated against the
+ * file system at most once every FILECACHE_REVALIDATE_US.
+ *
+ * All functions are thread safe.
+ */
+typedef struct filecache filecache_t;
+
+/*
+ * Creates a new, empty file cache. 'max_bytes' bounds the memory used by
+ * file contents and headers, 'max_entries' the number of cached (open) files.
+ * Returns NULL on failure.
+ */
+filecache_t *filecache_create(size_t max_bytes, int max_entries);
+
+/*
+ * Destroys the given cache, closing all cached file descriptors.
+ * Must not be called while any thread is in filecache_send.
+ */
+void filecache_destroy(filecache_t *cache);
+
+/*
+ * Sends a full HTTP response for the file at 'path' on the given connection.
+ * If the file matches the given (nullable) If-None-Match / If-Modified-Since
+ * header values, a 304 Not Modified response is sent instead.
+ *
+ * Returns 0 if a response was sent, or -1 if 'path' is not a readable
+ * regular file, in which case nothing has been written to 'f'.
+ */
+int filecache_send(filecache_t *cache, FILE *f, const char *path, const char *content_type,
+                   const char *if_none_match, const char *if_modified_since);
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef FST_H
+#define FST_H
+
+#include <stdio.h>
+
+/*
+ * Type of finite state transducer.
+ * An immutable dictionary mapping each of a sorted set of string keys to
+ * its ordinal, i.e. its position in key order. Keys are stored as a
+ * minimal acyclic automaton, sharing the states of common prefixes and
+ * suffixes, so the dictionary is typically far smaller than the keys.
+ * Each transition carries the number of keys ordered before those reached
+ * through it, so the ordinal of a key is found while looking it up.
+ */
+typedef struct fst fst_t;
+
+/*
+ * Type of fst iterator.
+ * Visits keys in ascending (strcmp) order.
+ */
+typedef struct fst_iter fst_iter_t;
+
+/*
+ * Builds a transducer of the given keys, which must be unique and sorted
+ * in ascending (strcmp) order. The key at keys[i] is given ordinal i.
+ * Returns NULL on failure, or if the keys are not sorted.
+ */
+fst_t *fst_build(char **keys, int n_keys);
+
+/*
+ * Destroys the given transducer.
+ */
+void fst_destroy(fst_t *fst);
+
+/*
+ * Returns the number of keys in the given transducer.
+ */
+int fst_size(fst_t *fst);
+
+/*
+ * Returns the ordinal of the given key, or -1 if there is no such key.
+ */
+int fst_get(fst_t *fst, const char *key);
+
+/*
+ * Creates an iterator positioned at the first key that is not less than
+ * 'from', or at the first key if 'from' is NULL. Prefix lookups start
+ * from the prefix, and range lookups from the lower bound of the range,
+ * continuing for as long as the keys returned are within it.
+ * Returns NULL on failure.
+ */
+fst_iter_t *fst_createiter(fst_t *fst, const char *from);
+
+/*
+ * Destroys the given iterator.
+ */
+void fst_destroyiter(fst_iter_t *iter);
+
+/*
+ * Returns the next key of the given iterator, storing its ordinal in
+ * 'ordinal', or NULL when exhausted. The key is kept in a buffer of
+ * the iterator, which is overwritten by the next call.
+ */
+char *fst_next(fst_iter_t *iter, int *ordinal);
+
+/*
+ * Finds the keys within Levenshtein distance 'max_dist' of the given key,
+ * storing at most 'max_ordinals' of their ordinals in ascending order.
+ * Returns the number of matching keys, or -1 on failure. The search stops
+ * once the number exceeds 'max_ordinals'.
+ */
+int fst_fuzzy(fst_t *fst, const char *key, int max_dist, int *ordinals, int max_ordinals);
+
+/*
+ * Writes the given transducer to the given file.
+ * The format is in native byte order.
+ * Returns 0 on success, or -1 on failure.
+ */
+int fst_save(fst_t *fst, FILE *file);
+
+/*
+ * Reads a transducer written by fst_save from the given file.
+ * Returns NULL on failure.
+ */
+fst_t *fst_load(FILE *file);
+
+#endif
@@ -2,23 +2,53 @@
 #ifndef HTTPD_H
 #define HTTPD_H
 
-#include "map.h"
+#include "common.h"
 
 #include <stdio.h>
 
+/*
+ * The type of parsed HTTP requests.
+ * A request lives in a single receive buffer owned by the server thread;
+ * all strings returned by the accessors below are slices into that buffer,
+ * and are only valid for the duration of the handler call.
+ */
+struct http_request;
+typedef struct http_request http_request_t;
+
 /*
  * The type of HTTP request handler functions.
  */
-typedef int (*http_handler_t)(char *path, map_t *header, map_t *args, FILE *f);
+typedef int (*http_handler_t)(http_request_t *req, FILE *f);
 
 /*
  * Starts a HTTP server on the given port, passing incoming
  * GET and POST requests to the given request handler.
- * 
+ *
  * Returns a status code similar to that of a main() function.
  */
 int http_server(unsigned short port, http_handler_t handler);
 
+/*
+ * Returns the (url decoded) path of the given request.
+ */
+char *http_get_path(http_request_t *req);
+
+/*
+ * Returns the value of the given header field, or NULL if the request did
+ * not contain it. Field names are matched case-insensitively.
+ *
+ * Note: only fields known to the server are kept while parsing, all other
+ * fields are skipped without being stored. See `header_names` @ httpd.c.
+ */
+char *http_get_header(http_request_t *req, const char *name);
+
+/*
+ * Returns the value of the given query argument (from the request body of a
+ * POST, or the query string of a GET), or NULL if there is no such argument.
+ * The value is url decoded in place on first access.
+ */
+char *http_get_arg(http_request_t *req, const char *key);
+
 /*
  * Sends a HTTP OK header on the given connection (file),
  * setting the Content-Type field to the given value.
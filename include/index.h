@@ -2,7 +2,7 @@
 #ifndef INDEX_H
 #define INDEX_H
 
-#include "list.h"
+#include "vector.h"
 
 struct index;
 typedef struct index index_t;
@@ -21,6 +21,13 @@ index_t *index_create();
 /* TESTFUNC */
 int index_uniquewords(index_t *index);
 
+/*
+ * Returns the version of the index contents. The version changes whenever
+ * the contents change, so results cached for one version of an index are
+ * only valid while it remains the same.
+ */
+unsigned long index_version(index_t *index);
+
 /*
  * Destroys the given index.  Subsequently accessing the index will
  * lead to undefined behavior.
@@ -29,20 +36,28 @@ void index_destroy(index_t *index);
 
 /*
  * Adds the given path to the given index, and index the given
- * list of words under that path.
+ * vector of words under that path.
  * NOTE: It is the responsibility of index_addpath() to deallocate (free)
- *       'path' and the contents of the 'words' list.
+ *       'path' and the contents of the 'words' vector.
  */
-void index_addpath(index_t *index, char *path, list_t *tokens);    /* TESTING */
+void index_addpath(index_t *index, char *path, vector_t *tokens);    /* TESTING */
 
 /*
  * Performs the given query on the given index.  If the query
- * succeeds, the return value will be a list of paths (query_result_t). 
+ * succeeds, the return value will be a vector of paths (query_result_t). 
  * If there is an error (e.g. a syntax error in the query), an error 
  * message is assigned to the given errmsg pointer and the return value
  * will be NULL.
  */
-list_t *index_query(index_t *index, list_t *tokens, char **errmsg);
+vector_t *index_query(index_t *index, vector_t *tokens, char **errmsg);
+
+/*
+ * Completes the given prefix to the indexed words starting with it, ranked
+ * by the number of documents containing them, most frequent first. At most
+ * 'max_terms' words are stored in 'terms'. The words belong to the index.
+ * Returns the number of words stored.
+ */
+int index_suggest(index_t *index, char *prefix, char **terms, int max_terms);
 
 #endif
 
@@ -108,4 +108,27 @@ int list_hasnext(list_iter_t *iter);
  */
 void *list_next(list_iter_t *iter);
 
+/*
+ * Storage for a list iterator, such as on the caller's stack.
+ */
+typedef struct list_iterbuf {
+    void *opaque[1];
+} list_iterbuf_t;
+
+/*
+ * Initializes an iterator over the given list in the given storage, and
+ * returns it. Unlike those of list_createiter, it cannot fail, and must
+ * not be destroyed.
+ */
+list_iter_t *list_inititer(list_iterbuf_t *buf, list_t *list);
+
+/*
+ * Loops over the elements of the given list, assigning each to elem, with
+ * an iterator on the stack. Stops at the first NULL element.
+ */
+#define LIST_FOREACH(elem, list) \
+    for (list_iterbuf_t list_iterbuf_, *list_once_ = &list_iterbuf_; list_once_; list_once_ = NULL) \
+        for (list_iter_t *list_iter_ = list_inititer(&list_iterbuf_, (list)); \
+             ((elem) = list_next(list_iter_)) != NULL; )
+
 #endif
@@ -32,6 +32,12 @@ void map_destroy(map_t *map, void (*destroy_key)(void *), void (*destroy_val)(vo
  */
 void map_put(map_t *map, void *key, void *value);
 
+/*
+ * Removes the given key from the map, returning the value it mapped to,
+ * or NULL if the map did not contain the key. The key itself is not destroyed.
+ */
+void *map_remove(map_t *map, void *key);
+
 /*
  * Returns 1 if the given map contains the given key, 0 otherwise.
  */
@@ -7,6 +7,12 @@
  */
 typedef struct pile pile_t;
 
+/*
+ * Number of plates held within the pile itself, before any memory is
+ * allocated for them.
+ */
+#define PILE_INLINE  16
+
 pile_t *pile_create();
 
 /*
@@ -14,7 +20,32 @@ pile_t *pile_create();
  */
 void pile_destroy(pile_t *pile);
 
-void pile_push(pile_t *pile, void *elem);
+/*
+ * Storage for a pile, such as on the caller's stack, holding the pile and
+ * its first PILE_INLINE plates.
+ */
+typedef struct pile_buf {
+    void *opaque[PILE_INLINE + 2];
+} pile_buf_t;
+
+/*
+ * Initializes an empty pile in the given storage, and returns it. Unlike
+ * pile_create, it cannot fail. The pile must be finished with pile_finish
+ * rather than destroyed.
+ */
+pile_t *pile_init(pile_buf_t *buf);
+
+/*
+ * Finishes a pile from pile_init, freeing any plates that did not fit
+ * within its storage. The elems are not destroyed.
+ */
+void pile_finish(pile_t *pile);
+
+/*
+ * Adds the elem on top of the pile.
+ * Returns 1 on success, and 0 if the operation failed.
+ */
+int pile_push(pile_t *pile, void *elem);
 
 /* 
  * Returns the most recently added elem, removing it from the pile.
@@ -0,0 +1,56 @@
+#ifndef QUERYCACHE_H
+#define QUERYCACHE_H
+
+#include "index.h"
+#include "vector.h"
+
+#include <stddef.h>
+
+/*
+ * Cache of query results, placed in front of index_query.
+ *
+ * Queries are cached under a canonical form of their tokens, so that
+ * queries which only differ in the order of commutative operands, or the
+ * case of their terms, share an entry. E.g. `b OR (A AND c)` and
+ * `(c AND a) OR b` both map to "(OR (AND a c) b)".
+ *
+ * Entries are evicted in least recently used order once the cache exceeds
+ * its byte limit. All entries are dropped whenever the version of the
+ * index changes (see index_version).
+ *
+ * All functions are thread safe, apart from the index_query call itself,
+ * which must be serialized by the caller as usual.
+ */
+typedef struct querycache querycache_t;
+
+/*
+ * Creates a new, empty cache which holds at most 'max_bytes' worth of entries.
+ * Returns NULL on failure.
+ */
+querycache_t *qcache_create(size_t max_bytes);
+
+/*
+ * Destroys the given cache.
+ */
+void qcache_destroy(querycache_t *cache);
+
+/*
+ * Returns the canonical form of the given query tokens as a newly
+ * allocated string, or NULL if the tokens do not form a valid query.
+ */
+char *qcache_canonicalize(vector_t *tokens);
+
+/*
+ * Performs the given query on the given index, or returns a cached
+ * result of an equivalent query. Follows the contract of index_query:
+ * the returned vector and its query_result_t's are owned by the caller.
+ */
+vector_t *qcache_query(querycache_t *cache, index_t *index, vector_t *tokens, char **errmsg);
+
+/*
+ * Retrieves the hit/miss counters and current size of the cache.
+ * Any of the pointers may be NULL.
+ */
+void qcache_stats(querycache_t *cache, unsigned long *hits, unsigned long *misses, size_t *bytes);
+
+#endif
@@ -1,8 +1,9 @@
 #ifndef QUERYPARSER_H
 #define QUERYPARSER_H
 
-#include "list.h"
+#include "vector.h"
 #include "set.h"
+#include "roaring.h"
 
 
 struct parser;
@@ -26,6 +27,45 @@ typedef enum parser_status {
  */
 typedef set_t *(*term_func_t)(void *, char *);
 
+/*
+ * Type of bitmap function
+ * Takes in the parent/handler and a term, like the term function.
+ * Returns a pointer to the results of the term as a bitmap, or NULL if
+ * the term has none, or its results are only available as a set.
+ */
+typedef roaring_t *(*bitmap_func_t)(void *, char *);
+
+/*
+ * Type of batch function
+ * Takes in the parent/handler, an array of terms and the number of terms,
+ * and looks the terms up together, storing the result of terms[i] in
+ * prods[i], as the term function would. If 'bits' is not NULL, terms the
+ * bitmap function has a bitmap for are stored in bits[i] instead, with
+ * prods[i] NULL, and the other bits[i] are NULL.
+ */
+typedef void (*batch_func_t)(void *, char **, int, set_t **, roaring_t **);
+
+/*
+ * Type of phrase function
+ * Takes in the parent/handler, an array of terms, the number of terms
+ * and a window. With a window of 0, the terms must occur consecutively
+ * and in the given order ("quoted phrase"). Otherwise, the terms must
+ * occur within 'window' positions of each other (a NEAR/k b).
+ * Returns a newly created set of the matching results, or NULL if there are none.
+ */
+typedef set_t *(*phrase_func_t)(void *, char **, int, int);
+
+/*
+ * Type of expansion function
+ * Takes in the parent/handler, a pattern (`prefix*`, `*suffix`, or `term~N`
+ * for terms within edit distance N of term), an array for the matching
+ * terms, and the capacity of the array.
+ * Returns the number of terms matching the pattern, or -1 if the pattern is
+ * not supported. At most 'max_terms' terms are stored, and counting may stop
+ * once the number exceeds 'max_terms'.
+ */
+typedef int (*expand_func_t)(void *, char *, char **, int);
+
 /*
  * Creates and returns a newly created parser.
  * The parser will use the given search_func to determine results.
@@ -40,22 +80,90 @@ parser_t *parser_create(void *parent, term_func_t term_func);
 void parser_destroy(parser_t *parser);
 
 /*
- * Initializes the parser using the given list of tokens.
+ * Initializes the parser using the given vector of tokens.
  * if PARSE_READY is returned, parser_get_result may be called.
  * Returns a status code ~ parser_status_t.
  */
-parser_status_t parser_scan(parser_t *parser, list_t *tokens);
+parser_status_t parser_scan(parser_t *parser, vector_t *tokens);
 
 /*
  * Returns the result scanned tokens given that PARSE_READY was returned
- * Returns a newly created set containing any results, or NULL on error.
+ * Returns a set containing any results, or NULL on error. The set may be
+ * shared, e.g. with the index it was given by (see set_retain), so it must
+ * not be modified, and is released with set_destroy.
  */
 set_t *parser_get_result(parser_t *parser);
 
+/*
+ * Limits the complexity of queries accepted by parser_scan to the given
+ * number of tokens. Longer queries are rejected with SYNTAX_ERROR.
+ * 0 (the default) means no limit.
+ */
+void parser_set_maxtokens(parser_t *parser, int max_tokens);
+
+/*
+ * Enables "quoted phrase" and `a NEAR/k b` terms, resolved through the
+ * given phrase function. Without one, such queries are rejected with
+ * SYNTAX_ERROR.
+ */
+void parser_set_phrase_func(parser_t *parser, phrase_func_t phrase_func);
+
+/*
+ * Enables `prefix*`, `*suffix` and `term~N` terms, matching the union of the terms
+ * found through the given expansion function. Patterns matching too many
+ * terms, or no expansion function, cause SYNTAX_ERROR.
+ */
+void parser_set_expand_func(parser_t *parser, expand_func_t expand_func);
+
+/*
+ * Resolves terms through the given bitmap function first, and through the
+ * term function only where it returns NULL. Bitmaps are combined with each
+ * other by word-level operations, and stream as elements cast to pointers
+ * otherwise (see cursor_create_bitmap), so the elements of the sets of the
+ * term function must then be ordered by compare_pointers as well.
+ */
+void parser_set_bitmap_func(parser_t *parser, bitmap_func_t bitmap_func);
+
+/*
+ * Resolves the <word>'s of a query through the given batch function, in a
+ * single call once the query is scanned, instead of one at a time through
+ * the term and bitmap functions.
+ */
+void parser_set_batch_func(parser_t *parser, batch_func_t batch_func);
+
+/*
+ * Type of universe function
+ * Takes in the parent/handler.
+ * Returns a bitmap of every element the term and bitmap functions may
+ * produce, i.e. all documents, or NULL if there are none.
+ */
+typedef roaring_t *(*universe_func_t)(void *);
+
+/*
+ * Enables the unary `NOT x`, matching every element of the universe given by
+ * the universe function which x does not match. Requires a bitmap function
+ * (see parser_set_bitmap_func). Without one, NOT is rejected with SYNTAX_ERROR.
+ */
+void parser_set_universe_func(parser_t *parser, universe_func_t universe_func);
+
 /*
  * Returns the last set error message from scanning.
  */
 char *parser_get_errmsg(parser_t *parser);
 
+/*
+ * Enables caching of intermediate results (subqueries) across queries,
+ * bounded to 'max_elems' set elements in total. Subqueries are cached under
+ * a canonical form, so e.g. `(a AND b)` is reused by a later `b AND a OR c`.
+ * Returns 0 on success, or -1 on failure.
+ */
+int parser_enable_cache(parser_t *parser, size_t max_elems);
+
+/*
+ * Drops all cached intermediate results. Must be called whenever the
+ * results of the parsers term function may have changed.
+ */
+void parser_invalidate(parser_t *parser);
+
 
 #endif
@@ -0,0 +1,90 @@
+#ifndef ROARING_H
+#define ROARING_H
+
+#include <stdint.h>
+
+/*
+ * Type of roaring bitmap.
+ * A compressed set of 32-bit values, split into chunks of 2^16 values by
+ * their high bits. Each chunk is stored in whichever container suits its
+ * density: a sorted array of its values when sparse, a bitmap when dense,
+ * or a list of runs of consecutive values (see roaring_optimize).
+ * Set operations are performed chunk by chunk, as word-level bitwise
+ * operations between bitmaps, and by merging or probing otherwise.
+ */
+typedef struct roaring roaring_t;
+
+/*
+ * Type of roaring bitmap iterator.
+ * Visits values in ascending order.
+ */
+typedef struct roaring_iter roaring_iter_t;
+
+/*
+ * Creates a new, empty bitmap.
+ * Returns NULL on failure.
+ */
+roaring_t *roaring_create();
+
+/*
+ * Destroys the given bitmap.
+ */
+void roaring_destroy(roaring_t *bits);
+
+/*
+ * Adds the given value to the given bitmap. Adding values in ascending
+ * order is the fastest.
+ * Returns 0 on success, or -1 on failure.
+ */
+int roaring_add(roaring_t *bits, uint32_t value);
+
+/*
+ * Returns 1 if the given bitmap contains the given value, otherwise 0.
+ */
+int roaring_contains(roaring_t *bits, uint32_t value);
+
+/*
+ * Returns the number of values in the given bitmap.
+ */
+int roaring_size(roaring_t *bits);
+
+/*
+ * Returns a new bitmap of the intersection, union and difference of
+ * bitmaps a and b respectively, or NULL on failure.
+ */
+roaring_t *roaring_and(roaring_t *a, roaring_t *b);
+roaring_t *roaring_or(roaring_t *a, roaring_t *b);
+roaring_t *roaring_andnot(roaring_t *a, roaring_t *b);
+
+/*
+ * Converts the containers of the given bitmap to runs wherever that takes
+ * less space, and back to arrays or bitmaps wherever it no longer does.
+ */
+void roaring_optimize(roaring_t *bits);
+
+/*
+ * Creates an iterator over the values of the given bitmap.
+ * The bitmap must not be changed while the iterator is in use.
+ * Returns NULL on failure.
+ */
+roaring_iter_t *roaring_createiter(roaring_t *bits);
+
+/*
+ * Destroys the given iterator.
+ */
+void roaring_destroyiter(roaring_iter_t *iter);
+
+/*
+ * Stores the next value of the given iterator in 'value'.
+ * Returns 1 on success, or 0 when exhausted.
+ */
+int roaring_next(roaring_iter_t *iter, uint32_t *value);
+
+/*
+ * Stores the first value of the given iterator not less than 'target' in
+ * 'value', skipping any values inbetween.
+ * Returns 1 on success, or 0 when exhausted.
+ */
+int roaring_advance(roaring_iter_t *iter, uint32_t target, uint32_t *value);
+
+#endif
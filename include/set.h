@@ -27,6 +27,14 @@ void *set_get(set_t *set, void *elem);
  */
 void *set_tryadd(set_t *set, void *elem);
 
+/*
+ * Like set_tryadd, given the hint that elem is greater than all elements
+ * of the set, as when adding elements in ascending order. Such an elem is
+ * appended after a single comparison, while any other is added as by
+ * set_tryadd.
+ */
+void *set_tryadd_last(set_t *set, void *elem);
+
 /*
  * Creates a new set. The given cmpfunc will be used
  * to compare elements added to the set.
@@ -36,14 +44,36 @@ set_t *set_create(cmpfunc_t cmpfunc);
 /*
  * Destroys the given set. Subsequently accessing the set
  * will lead to undefined behavior.
+ * If the set has other references, see set_retain, only the given
+ * reference is released, and the set remains for the others.
  */
 void set_destroy(set_t *set);
 
+/*
+ * Returns another reference to the given set, which is released by
+ * set_destroy. A set with more than one reference is shared, and must not
+ * be modified, so it may be handed out, e.g. as a query result, without
+ * copying it. References may be taken and released from different threads.
+ */
+set_t *set_retain(set_t *set);
+
+/*
+ * Returns the given set if it is not shared, or else a copy of it that
+ * may be modified, in which case the reference to the given set is
+ * released. Returns NULL on failure, leaving the given set as is.
+ */
+set_t *set_unshare(set_t *set);
+
 /*
  * Returns the cardinality of the given set.
  */
 int set_size(set_t *set);
 
+/*
+ * Returns the cmpfunc of the given set.
+ */
+cmpfunc_t set_cmpfunc(set_t *set);
+
 /*
  * Adds the given element to the given set.
  */
@@ -81,6 +111,14 @@ set_t *set_difference(set_t *a, set_t *b);
  */
 set_t *set_copy(set_t *set);
 
+/*
+ * Returns a new set of the n given elements, which must be sorted in
+ * ascending order by cmpfunc, without duplicates. The set is built in
+ * bulk, rather than adding the elements one by one.
+ * Returns NULL on failure.
+ */
+set_t *set_from_sorted_array(void **elems, int n, cmpfunc_t cmpfunc);
+
 /*
  * The type of set iterators.
  */
@@ -109,6 +147,37 @@ int set_hasnext(set_iter_t *iter);
  */
 void *set_next(set_iter_t *iter);
 
+/*
+ * Skips the given set iterator ahead to the first element that is not
+ * less than the given one, such that the next call to set_next returns it.
+ * Has no effect if the iterator is already positioned there or beyond.
+ */
+void set_skipto(set_iter_t *iter, void *elem);
+
+/*
+ * Storage for a set iterator, such as on the caller's stack, large enough
+ * for the iterator of any set implementation.
+ */
+typedef struct set_iterbuf {
+    void *opaque[3];
+} set_iterbuf_t;
+
+/*
+ * Initializes an iterator over the given set in the given storage, and
+ * returns it. Unlike those of set_createiter, it cannot fail, and must
+ * not be destroyed.
+ */
+set_iter_t *set_inititer(set_iterbuf_t *buf, set_t *set);
+
+/*
+ * Loops over the elements of the given set in order, assigning each to
+ * elem, with an iterator on the stack. Elements must not be NULL.
+ */
+#define SET_FOREACH(elem, set) \
+    for (set_iterbuf_t set_iterbuf_, *set_once_ = &set_iterbuf_; set_once_; set_once_ = NULL) \
+        for (set_iter_t *set_iter_ = set_inititer(&set_iterbuf_, (set)); \
+             ((elem) = set_next(set_iter_)) != NULL; )
+
 /* debugging */
 // typedef char *(*printfunc_t)(void *);
 // void print_rbtreeset(set_t *set, printfunc_t printfunc_t);
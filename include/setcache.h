@@ -0,0 +1,68 @@
+#ifndef SETCACHE_H
+#define SETCACHE_H
+
+#include "set.h"
+
+#include <stddef.h>
+
+/*
+ * Cache of sets keyed on strings, with reference counted entries.
+ * Used by the query parser to keep the results of subqueries across queries.
+ *
+ * The cache adopts the sets put into it, and destroys them once they have
+ * been evicted and are no longer referenced. Entries are evicted in least
+ * recently used order, once the total number of elements in cached sets
+ * exceeds the given bound. An entry may hold a NULL set, denoting an
+ * empty result.
+ */
+typedef struct setcache setcache_t;
+typedef struct sc_entry sc_entry_t;
+
+/*
+ * Creates a new, empty cache bounded to 'max_elems' elements in total.
+ * Returns NULL on failure.
+ */
+setcache_t *setcache_create(size_t max_elems);
+
+/*
+ * Destroys the given cache. All references must have been released.
+ */
+void setcache_destroy(setcache_t *cache);
+
+/*
+ * Returns a reference to the entry for the given key, or NULL if there is none.
+ * The reference must be released with setcache_release.
+ */
+sc_entry_t *setcache_get(setcache_t *cache, const char *key);
+
+/*
+ * Adds the given set to the cache under the given key, replacing any
+ * existing entry. On success, the cache takes ownership of the set and
+ * a reference to the new entry is returned.
+ * Returns NULL if the set does not fit in the cache, in which case the
+ * caller keeps ownership of the set.
+ */
+sc_entry_t *setcache_put(setcache_t *cache, const char *key, set_t *set);
+
+/*
+ * Returns the set of the given entry (NULL for an empty result).
+ */
+set_t *setcache_set(sc_entry_t *entry);
+
+/*
+ * Releases a reference to the given entry.
+ */
+void setcache_release(setcache_t *cache, sc_entry_t *entry);
+
+/*
+ * Evicts all entries, e.g. after the sets they were derived from have changed.
+ * Entries that are still referenced are destroyed once released.
+ */
+void setcache_clear(setcache_t *cache);
+
+/*
+ * Retrieves the hit/miss counters of the cache.
+ */
+void setcache_stats(setcache_t *cache, unsigned long *hits, unsigned long *misses);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef SUGGEST_H
+#define SUGGEST_H
+
+/*
+ * Type of suggester.
+ * An immutable table of the top ranked completions of every prefix of a
+ * set of terms, ranked by a frequency given for each term. Looking up a
+ * prefix costs one step per character, and no ranking at lookup time.
+ */
+typedef struct suggester suggester_t;
+
+/*
+ * Builds a suggester of the given terms, which must be unique and sorted in
+ * ascending (strcmp) order, keeping the 'k' most frequent completions of
+ * each prefix. Ties are ranked in term order. Only the array of terms is
+ * copied, so the terms themselves must outlive the suggester.
+ * Returns NULL on failure.
+ */
+suggester_t *suggester_build(char **terms, int *freqs, int n_terms, int k);
+
+/*
+ * Destroys the given suggester.
+ */
+void suggester_destroy(suggester_t *suggester);
+
+/*
+ * Stores at most 'max_terms' of the top ranked terms starting with the
+ * given prefix in 'terms', most frequent first. At most 'k' terms are
+ * known for each prefix.
+ * Returns the number of terms stored.
+ */
+int suggester_lookup(suggester_t *suggester, const char *prefix, char **terms, int max_terms);
+
+#endif
@@ -67,4 +67,24 @@ void *tree_next(tree_iter_t *iter);
 
 int tree_hasnext(tree_iter_t *iter);
 
+/*
+ * Storage for a tree iterator, such as on the caller's stack.
+ */
+typedef struct tree_iterbuf {
+    void *opaque[2];
+} tree_iterbuf_t;
+
+/*
+ * Initializes an iterator over the given tree in the given storage, and
+ * returns it. Unlike those of tree_createiter, it cannot fail, and must
+ * not be destroyed. If not iterated to the end, it must be finished with
+ * tree_finishiter, which restores the tree.
+ * There is no FOREACH loop over trees, as leaving it early would leave
+ * the tree altered.
+ */
+tree_iter_t *tree_inititer(tree_iterbuf_t *buf, tree_t *tree);
+
+/* Finishes the given iterator, restoring the tree altered by the traversal */
+void tree_finishiter(tree_iter_t *iter);
+
 #endif /* TREE_H */
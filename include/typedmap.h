@@ -0,0 +1,133 @@
+#ifndef TYPEDMAP_H
+#define TYPEDMAP_H
+
+#include <stdlib.h>
+
+/*
+ * Type-specialized hash maps, generated by
+ * MAP_DEFINE(name, ktype, vtype, hash, eq) for keys and values of the
+ * given types. hash(key) returns an unsigned long, and eq(a, b) is nonzero
+ * if two keys are equal; both may be functions or macros, and are inlined
+ * into lookups, rather than called through function pointers as by map.h,
+ * which remains for void * keys.
+ *
+ * Entries are kept inline in a single table, probed linearly from the
+ * hash of their key, and at most half full. Entries cannot be removed.
+ *
+ * Defines the type name_t, and the functions:
+ *   name_t *name_create(void)                       NULL on failure
+ *   void    name_destroy(name_t *map)               keys and values are not
+ *                                                   destroyed, see name_next
+ *   int     name_size(name_t *map)
+ *   int     name_put(name_t *map, ktype key, vtype val)
+ *                                                   0 on success, replacing
+ *                                                   any value of the key, or
+ *                                                   -1 on failure
+ *   vtype  *name_get(name_t *map, ktype key)        the value of the key, or
+ *                                                   NULL if it has none
+ *   int     name_next(name_t *map, int *pos, ktype *key, vtype *val)
+ *                                                   stores the next entry from
+ *                                                   *pos, initially 0, and
+ *                                                   returns 1, or 0 when done
+ */
+
+#define MAP_DEFINE(name, ktype, vtype, hash, eq) \
+typedef struct name##_entry { \
+    ktype         key; \
+    vtype         val; \
+    unsigned char used; \
+} name##_entry_t; \
+\
+typedef struct name { \
+    name##_entry_t *entries; \
+    int             size; \
+    int             mask;   /* number of entries - 1, a power of two - 1 */ \
+} name##_t; \
+\
+static inline name##_t *name##_create(void) { \
+    name##_t *map = malloc(sizeof(name##_t)); \
+\
+    if (!map) { \
+        return NULL; \
+    } \
+    map->size = 0; \
+    map->mask = 3; \
+    if (!(map->entries = calloc(map->mask + 1, sizeof(name##_entry_t)))) { \
+        free(map); \
+        return NULL; \
+    } \
+    return map; \
+} \
+\
+static inline void name##_destroy(name##_t *map) { \
+    free(map->entries); \
+    free(map); \
+} \
+\
+static inline int name##_size(name##_t *map) { \
+    return map->size; \
+} \
+\
+/* Returns the entry of the key, or the unused entry where it belongs */ \
+static inline name##_entry_t *name##_slot(name##_entry_t *entries, int mask, ktype key) { \
+    unsigned long i = hash(key) & mask; \
+\
+    while (entries[i].used && !eq(entries[i].key, key)) { \
+        i = (i + 1) & mask; \
+    } \
+    return &entries[i]; \
+} \
+\
+/* Doubles the table. Returns 0 on success, or -1 on failure */ \
+static inline int name##_grow(name##_t *map) { \
+    int mask = 2 * map->mask + 1, i; \
+    name##_entry_t *entries = calloc(mask + 1, sizeof(name##_entry_t)); \
+\
+    if (!entries) { \
+        return -1; \
+    } \
+    for (i = 0; i <= map->mask; i++) { \
+        if (map->entries[i].used) { \
+            *name##_slot(entries, mask, map->entries[i].key) = map->entries[i]; \
+        } \
+    } \
+    free(map->entries); \
+    map->entries = entries; \
+    map->mask = mask; \
+    return 0; \
+} \
+\
+static inline int name##_put(name##_t *map, ktype key, vtype val) { \
+    name##_entry_t *e; \
+\
+    if (2 * (map->size + 1) > map->mask + 1 && name##_grow(map) < 0) { \
+        return -1; \
+    } \
+    e = name##_slot(map->entries, map->mask, key); \
+    if (!e->used) { \
+        e->used = 1; \
+        e->key = key; \
+        map->size++; \
+    } \
+    e->val = val; \
+    return 0; \
+} \
+\
+static inline vtype *name##_get(name##_t *map, ktype key) { \
+    name##_entry_t *e = name##_slot(map->entries, map->mask, key); \
+    return e->used ? &e->val : NULL; \
+} \
+\
+static inline int name##_next(name##_t *map, int *pos, ktype *key, vtype *val) { \
+    for (; *pos <= map->mask; (*pos)++) { \
+        if (map->entries[*pos].used) { \
+            *key = map->entries[*pos].key; \
+            *val = map->entries[*pos].val; \
+            (*pos)++; \
+            return 1; \
+        } \
+    } \
+    return 0; \
+}
+
+#endif
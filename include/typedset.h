@@ -0,0 +1,226 @@
+#ifndef TYPEDSET_H
+#define TYPEDSET_H
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Type-specialized sets, generated by SET_DEFINE(name, type, cmp) for
+ * elements of the given type. cmp(a, b) is a function or macro comparing
+ * two elements by value, returning <0, 0 or >0 like a cmpfunc_t.
+ * As the set is defined by static inline functions, cmp is inlined into
+ * lookups and the merge loops of the set operations, rather than called
+ * through a function pointer as by set.h, which remains for void *
+ * elements.
+ *
+ * Elements are kept in a sorted array, set->elems[0 .. set->size - 1],
+ * which may be iterated directly. Elements added in ascending order are
+ * appended in amortized constant time; any other element shifts those
+ * after it.
+ *
+ * Defines the type name_t, and the functions:
+ *   name_t *name_create(void)                        NULL on failure
+ *   void    name_destroy(name_t *set)
+ *   int     name_size(name_t *set)
+ *   int     name_add(name_t *set, type elem)         1 if added, 0 if already
+ *                                                    contained, -1 on failure
+ *   int     name_contains(name_t *set, type elem)
+ *   name_t *name_union(name_t *a, name_t *b)         NULL on failure
+ *   name_t *name_intersection(name_t *a, name_t *b)  NULL on failure
+ *   name_t *name_difference(name_t *a, name_t *b)    NULL on failure
+ *   name_t *name_copy(name_t *set)                   NULL on failure
+ * Where elements compare equal, the set operations keep those of a.
+ */
+
+/* Intersections probe the larger set when it is this many times larger */
+#define TYPEDSET_PROBE_RATIO 32
+
+#define SET_DEFINE(name, type, cmp) \
+typedef struct name { \
+    type *elems; \
+    int   size; \
+    int   cap; \
+} name##_t; \
+\
+static inline void name##_destroy(name##_t *set) { \
+    free(set->elems); \
+    free(set); \
+} \
+\
+static inline int name##_size(name##_t *set) { \
+    return set->size; \
+} \
+\
+/* Makes room for n elements. Returns 0 on success, or -1 on failure */ \
+static inline int name##_reserve(name##_t *set, int n) { \
+    int cap = set->cap ? set->cap : 8; \
+    type *elems; \
+\
+    if (n <= set->cap) { \
+        return 0; \
+    } \
+    while (cap < n) { \
+        cap *= 2; \
+    } \
+    if (!(elems = realloc(set->elems, cap * sizeof(type)))) { \
+        return -1; \
+    } \
+    set->elems = elems; \
+    set->cap = cap; \
+    return 0; \
+} \
+\
+/* Returns the index of the first of elems[lo .. hi - 1] not less than elem */ \
+static inline int name##_lowerbound(type *elems, int lo, int hi, type elem) { \
+    int mid; \
+\
+    while (lo < hi) { \
+        mid = lo + (hi - lo) / 2; \
+        if (cmp(elems[mid], elem) < 0) { \
+            lo = mid + 1; \
+        } else { \
+            hi = mid; \
+        } \
+    } \
+    return lo; \
+} \
+\
+static inline name##_t *name##_create(void) { \
+    name##_t *set = calloc(1, sizeof(name##_t)); \
+\
+    /* elems is never NULL, as it is copied from and to */ \
+    if (set && name##_reserve(set, 1) < 0) { \
+        free(set); \
+        return NULL; \
+    } \
+    return set; \
+} \
+\
+static inline int name##_contains(name##_t *set, type elem) { \
+    int i = name##_lowerbound(set->elems, 0, set->size, elem); \
+    return i < set->size && cmp(set->elems[i], elem) == 0; \
+} \
+\
+static inline int name##_add(name##_t *set, type elem) { \
+    int i = set->size; \
+\
+    if (i > 0 && cmp(set->elems[i - 1], elem) >= 0) { \
+        i = name##_lowerbound(set->elems, 0, set->size, elem); \
+        if (cmp(set->elems[i], elem) == 0) { \
+            return 0; \
+        } \
+    } \
+    if (name##_reserve(set, set->size + 1) < 0) { \
+        return -1; \
+    } \
+    memmove(set->elems + i + 1, set->elems + i, (set->size - i) * sizeof(type)); \
+    set->elems[i] = elem; \
+    set->size++; \
+    return 1; \
+} \
+\
+/* Creates a set with room for n elements. Returns NULL on failure */ \
+static inline name##_t *name##_createsized(int n) { \
+    name##_t *set = name##_create(); \
+\
+    if (set && name##_reserve(set, n) < 0) { \
+        name##_destroy(set); \
+        return NULL; \
+    } \
+    return set; \
+} \
+\
+static inline name##_t *name##_union(name##_t *a, name##_t *b) { \
+    name##_t *set = name##_createsized(a->size + b->size); \
+    int i = 0, j = 0, n = 0, c; \
+\
+    if (!set) { \
+        return NULL; \
+    } \
+    while (i < a->size && j < b->size) { \
+        c = cmp(a->elems[i], b->elems[j]); \
+        if (c <= 0) { \
+            set->elems[n++] = a->elems[i++]; \
+            j += (c == 0); \
+        } else { \
+            set->elems[n++] = b->elems[j++]; \
+        } \
+    } \
+    memcpy(set->elems + n, a->elems + i, (a->size - i) * sizeof(type)); \
+    n += a->size - i; \
+    memcpy(set->elems + n, b->elems + j, (b->size - j) * sizeof(type)); \
+    n += b->size - j; \
+    set->size = n; \
+    return set; \
+} \
+\
+static inline name##_t *name##_intersection(name##_t *a, name##_t *b) { \
+    name##_t *set = name##_createsized(a->size < b->size ? a->size : b->size); \
+    int i = 0, j = 0, n = 0, c; \
+\
+    if (!set) { \
+        return NULL; \
+    } \
+    if ((long)a->size * TYPEDSET_PROBE_RATIO < b->size) { \
+        /* probe b for each element of a */ \
+        for (; i < a->size && j < b->size; i++) { \
+            j = name##_lowerbound(b->elems, j, b->size, a->elems[i]); \
+            if (j < b->size && cmp(b->elems[j], a->elems[i]) == 0) { \
+                set->elems[n++] = a->elems[i]; \
+            } \
+        } \
+    } else if ((long)b->size * TYPEDSET_PROBE_RATIO < a->size) { \
+        /* probe a for each element of b */ \
+        for (; j < b->size && i < a->size; j++) { \
+            i = name##_lowerbound(a->elems, i, a->size, b->elems[j]); \
+            if (i < a->size && cmp(a->elems[i], b->elems[j]) == 0) { \
+                set->elems[n++] = a->elems[i]; \
+            } \
+        } \
+    } else { \
+        while (i < a->size && j < b->size) { \
+            c = cmp(a->elems[i], b->elems[j]); \
+            if (c == 0) { \
+                set->elems[n++] = a->elems[i]; \
+            } \
+            i += (c <= 0); \
+            j += (c >= 0); \
+        } \
+    } \
+    set->size = n; \
+    return set; \
+} \
+\
+static inline name##_t *name##_difference(name##_t *a, name##_t *b) { \
+    name##_t *set = name##_createsized(a->size); \
+    int i = 0, j = 0, n = 0, c; \
+\
+    if (!set) { \
+        return NULL; \
+    } \
+    while (i < a->size && j < b->size) { \
+        c = cmp(a->elems[i], b->elems[j]); \
+        if (c < 0) { \
+            set->elems[n++] = a->elems[i++]; \
+        } else { \
+            i += (c == 0); \
+            j++; \
+        } \
+    } \
+    memcpy(set->elems + n, a->elems + i, (a->size - i) * sizeof(type)); \
+    set->size = n + a->size - i; \
+    return set; \
+} \
+\
+static inline name##_t *name##_copy(name##_t *set) { \
+    name##_t *copy = name##_createsized(set->size); \
+\
+    if (!copy) { \
+        return NULL; \
+    } \
+    memcpy(copy->elems, set->elems, set->size * sizeof(type)); \
+    copy->size = set->size; \
+    return copy; \
+}
+
+#endif
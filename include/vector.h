@@ -0,0 +1,99 @@
+#ifndef VECTOR_H
+#define VECTOR_H
+
+#include "common.h"
+
+/*
+ * The type of vectors.
+ * A vector keeps its elements in a single array, which grows by doubling,
+ * so elements are added at its end in amortized constant time, and
+ * accessed by index. Unlike list_t, no memory is allocated per element.
+ */
+typedef struct vector vector_t;
+
+/*
+ * Type of function returning the sort key of an element, for
+ * vector_radixsort. Elements are ordered by ascending key.
+ */
+typedef unsigned long long (*keyfunc_t)(void *);
+
+
+/*
+ * Creates a new, empty vector that uses the given comparison function
+ * to compare elements, as described for list_create.
+ * Returns the new vector, or NULL on failure.
+ */
+vector_t *vector_create(cmpfunc_t cmpfunc);
+
+/*
+ * Destroys the given vector. The elements are not destroyed.
+ * Subsequently accessing the vector will lead to undefined behavior.
+ */
+void vector_destroy(vector_t *vec);
+
+/*
+ * Returns the current size of the given vector.
+ */
+int vector_size(vector_t *vec);
+
+/*
+ * Makes room for n elements in the given vector, so that it does not grow
+ * until it holds more.
+ * Returns 1 on success, and 0 if the operation failed.
+ */
+int vector_reserve(vector_t *vec, int n);
+
+/*
+ * Adds the given element to the end of the given vector.
+ * Returns 1 on success, and 0 if the operation failed.
+ */
+int vector_push(vector_t *vec, void *elem);
+
+/*
+ * Removes and returns the last element of the given vector,
+ * or NULL on empty vector.
+ */
+void *vector_pop(vector_t *vec);
+
+/*
+ * Returns the element at index i of the given vector, 0 <= i < size.
+ */
+void *vector_get(vector_t *vec, int i);
+
+/*
+ * Replaces the element at index i of the given vector, 0 <= i < size.
+ */
+void vector_set(vector_t *vec, int i, void *elem);
+
+/*
+ * Returns the array of elements of the given vector, which may be iterated
+ * directly. The array remains valid until the vector next grows.
+ */
+void **vector_elems(vector_t *vec);
+
+/*
+ * Removes all elements of the given vector, keeping its memory.
+ */
+void vector_clear(vector_t *vec);
+
+/*
+ * Sorts the elements of the given vector in place, using the comparison
+ * function of the vector. The sort is an introsort, and is not stable.
+ */
+void vector_sort(vector_t *vec);
+
+/*
+ * Sorts the elements of the given vector by the keys returned by the given
+ * function, computed once per element. The sort is a radix sort, and is
+ * stable, so elements with equal keys keep their order.
+ * Falls back to vector_sort if memory for the keys cannot be allocated.
+ */
+void vector_radixsort(vector_t *vec, keyfunc_t keyfunc);
+
+/*
+ * Returns a key for vector_radixsort ordering doubles by ascending value.
+ * Negate the value, or invert the key, to sort by descending value.
+ */
+unsigned long long vector_doublekey(double d);
+
+#endif
@@ -1,7 +1,6 @@
 /* Author: Steffen Viken Valvaag <steffenv@cs.uit.no> */
 
 #include "set.h"
-#include "list.h"
 #include "printing.h"
 
 #include <assert.h>
@@ -26,14 +25,25 @@ struct treenode {
 static treenode_t theNullNode = { nullNode, nullNode, nullNode, 0, NULL };
 
 
+/*
+ * Bound on the depth of an AA tree, which is at most 2 log2(size + 1).
+ */
+#define MAX_DEPTH 64
+
+
 struct set {
     treenode_t *root;   /* Root of the AA tree */
     treenode_t *first;  /* Head of the linked list */
+    treenode_t *last;   /* Tail of the linked list */
+    treenode_t *block;  /* Nodes bulk loaded with the set, allocated along with it */
+    int n_block;
     int size;
+    int refs;           /* References to the set, see set_retain */
     cmpfunc_t cmpfunc;
 };
 
 struct set_iter {
+    set_t *set;
     treenode_t *node;
 };
 
@@ -91,25 +101,29 @@ static void checkset(set_t *set) {
     assert(size == set->size);
 }
 
-static treenode_t *newnode(void *elem) {
-    treenode_t *node = malloc(sizeof(treenode_t));
-    if (node == NULL) {
-        ERROR_PRINT("out of memory");
-        goto end;
-    }
-
+static treenode_t *initnode(treenode_t *node, void *elem) {
     node->left = nullNode;
     node->right = nullNode;
     node->next = nullNode;
     node->level = 1;
     node->elem = elem;
-
-end:
     return node;
 }
 
+static treenode_t *newnode(void *elem) {
+    treenode_t *node = malloc(sizeof(treenode_t));
+    if (node == NULL) {
+        ERROR_PRINT("out of memory");
+        return NULL;
+    }
+    return initnode(node, elem);
+}
+
 static treenode_t *addnode(set_t *set, treenode_t *prev, void *elem) {
     treenode_t *node = newnode(elem);
+    if (node == NULL) {
+        return NULL;
+    }
     if (prev == nullNode) {
         node->next = set->first;
         set->first = node;
@@ -117,42 +131,82 @@ static treenode_t *addnode(set_t *set, treenode_t *prev, void *elem) {
         node->next = prev->next;
         prev->next = node;
     }
+    if (node->next == nullNode) {
+        set->last = node;
+    }
     set->size++;
     return node;
 }
 
-set_t *set_create(cmpfunc_t cmpfunc) {
-    set_t *set = malloc(sizeof(set_t));
+/*
+ * Creates an empty set along with a block of n nodes, to be filled
+ * with elements in order and linked by buildset.
+ */
+static set_t *allocset(int n, cmpfunc_t cmpfunc) {
+    set_t *set = malloc(sizeof(set_t) + n * sizeof(treenode_t));
     if (set == NULL) {
         ERROR_PRINT("out of memory");
-        goto end;
+        return NULL;
     }
 
     set->root = nullNode;
     set->first = nullNode;
+    set->last = nullNode;
+    set->block = (treenode_t *)(set + 1);
+    set->n_block = n;
     set->size = 0;
+    set->refs = 1;
     set->cmpfunc = cmpfunc;
-
-end:
     return set;
 }
 
+set_t *set_create(cmpfunc_t cmpfunc) {
+    return allocset(0, cmpfunc);
+}
+
 void set_destroy(set_t *set) {
     treenode_t *n = set->first;
 
+    if (__atomic_sub_fetch(&set->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
     while (n != nullNode) {
         treenode_t *tmp = n;
         n = n->next;
-        free(tmp);
+        /* nodes of the block are freed along with the set */
+        if (tmp < set->block || tmp >= set->block + set->n_block) {
+            free(tmp);
+        }
     }
     free(set);
 }
 
 
+set_t *set_retain(set_t *set) {
+    __atomic_add_fetch(&set->refs, 1, __ATOMIC_RELAXED);
+    return set;
+}
+
+set_t *set_unshare(set_t *set) {
+    set_t *copy;
+
+    if (__atomic_load_n(&set->refs, __ATOMIC_ACQUIRE) == 1) {
+        return set;
+    }
+    if ((copy = set_copy(set)) != NULL) {
+        set_destroy(set);
+    }
+    return copy;
+}
+
 int set_size(set_t *set) {
     return set->size;
 }
 
+cmpfunc_t set_cmpfunc(set_t *set) {
+    return set->cmpfunc;
+}
+
 static treenode_t *skew(treenode_t *root) {
     if (root->left->level == root->level) {
         treenode_t *newroot = root->left;
@@ -174,32 +228,51 @@ static treenode_t *split(treenode_t *root) {
     return root;
 }
 
-static treenode_t *insert(set_t *set, treenode_t *root, treenode_t *prev, void *elem) {
-    if (root == nullNode) {
-        return addnode(set, prev, elem);
-    }
+/*
+ * Adds a node for elem below the deepest node of the given path, on the
+ * side given by its dirs entry (negative for left), and rebalances the
+ * path bottom-up. Stops once two subtrees in a row keep their root and
+ * level, as split looks two levels down, and nothing above changes then.
+ * Returns elem, or NULL on failure.
+ */
+static void *attach(set_t *set, treenode_t **path, int *dirs, int depth, treenode_t *prev, void *elem) {
+    treenode_t *child = addnode(set, prev, elem);
+    treenode_t *node;
+    unsigned int level;
+    int unchanged = 0;
 
-    int cmp = set->cmpfunc(elem, root->elem);
-    if (cmp < 0) {
-        root->left = insert(set, root->left, prev, elem);
-    } else if (cmp > 0) {
-        root->right = insert(set, root->right, root, elem);
-    } else {
-        /* Already contained */
-        return root;
+    if (child == NULL) {
+        return NULL;
     }
 
-    /* Rebalance the tree */
-    root = skew(root);
-    root = split(root);
-    return root;
-}
+    while (depth-- > 0) {
+        node = path[depth];
+        if (dirs[depth] < 0) {
+            node->left = child;
+        } else {
+            node->right = child;
+        }
 
-void set_add(set_t *set, void *elem) {
-    set->root = insert(set, set->root, nullNode, elem);
+        /* Rebalance the tree */
+        level = node->level;
+        child = split(skew(node));
+        if (child != node || child->level != level) {
+            unchanged = 0;
+        } else if (unchanged++) {
+            goto end;
+        }
+    }
+    set->root = child;
+
+end:
     if (DEBUG_CHECKSET) {
         checkset(set);
     }
+    return elem;
+}
+
+void set_add(set_t *set, void *elem) {
+    set_tryadd(set, elem);
 }
 
 int set_contains(set_t *set, void *elem) {
@@ -239,59 +312,108 @@ void *set_get(set_t *set, void *elem) {
     return NULL;
 }
 
+/*
+ * Finds elem, or the path to where it belongs, in a single traversal.
+ */
 void *set_tryadd(set_t *set, void *elem) {
-    void *duplicate = set_get(set, elem);
+    treenode_t *path[MAX_DEPTH];
+    int dirs[MAX_DEPTH];
+    treenode_t *n = set->root;
+    treenode_t *prev = nullNode;   /* predecessor of elem in the linked list */
+    int depth = 0, cmp;
+
+    while (n != nullNode) {
+        cmp = set->cmpfunc(elem, n->elem);
+        if (cmp == 0) {
+            /* Already contained */
+            return n->elem;
+        }
+        path[depth] = n;
+        dirs[depth++] = cmp;
+        if (cmp < 0) {
+            n = n->left;
+        } else {
+            prev = n;
+            n = n->right;
+        }
+    }
+    return attach(set, path, dirs, depth, prev, elem);
+}
+
+void *set_tryadd_last(set_t *set, void *elem) {
+    treenode_t *path[MAX_DEPTH];
+    int dirs[MAX_DEPTH];
+    treenode_t *n;
+    int depth = 0, cmp;
+
+    if (set->last == nullNode) {
+        return set_tryadd(set, elem);
+    }
+    cmp = set->cmpfunc(elem, set->last->elem);
+    if (cmp < 0) {
+        return set_tryadd(set, elem);
+    } else if (cmp == 0) {
+        return set->last->elem;
+    }
 
-    if (duplicate == NULL) {
-        set_add(set, elem);
-        return elem;
+    /* Follow the right spine down to the last node, without comparisons */
+    for (n = set->root; n != nullNode; n = n->right) {
+        path[depth] = n;
+        dirs[depth++] = 1;
     }
-    return duplicate;
+    return attach(set, path, dirs, depth, set->last, elem);
 }
 
 /*
- * Builds a balanced tree from the N first elements of the
- * given sorted list.  Assigns the first, root and last node
+ * Builds a balanced tree from the N given nodes, holding
+ * elements in sorted order.  Assigns the first, root and last node
  * pointers.
  */
-static void buildtree(list_t *list, int N, treenode_t **first, treenode_t **root, treenode_t **last) {
+static void buildtree(treenode_t *nodes, int N, treenode_t **first, treenode_t **root, treenode_t **last) {
     if (N == 1) {
-        *first = *root = *last = newnode(list_popfirst(list));
+        *first = *root = *last = initnode(&nodes[0], nodes[0].elem);
     } else if (N == 2) {
-        *first = *root = newnode(list_popfirst(list));
-        *last = (*root)->right = (*root)->next = newnode(list_popfirst(list));
+        *first = *root = initnode(&nodes[0], nodes[0].elem);
+        *last = (*root)->right = (*root)->next = initnode(&nodes[1], nodes[1].elem);
     } else if (N > 2) {
         treenode_t *left;       /* root of left subtree */
         treenode_t *leftlast;   /* last node in left subtree */
         treenode_t *right;      /* root of right subtree */
         treenode_t *rightfirst; /* first node in right subtree */
 
-        buildtree(list, N - N/2 - 1, first, &left, &leftlast);
-        *root = *last = newnode(list_popfirst(list));
+        buildtree(nodes, N - N/2 - 1, first, &left, &leftlast);
+        *root = *last = initnode(&nodes[N - N/2 - 1], nodes[N - N/2 - 1].elem);
         (*root)->left = left;
         (*root)->level = left->level + 1;
         leftlast->next = *root;
 
-        buildtree(list, N/2, &rightfirst, &right, last);
+        buildtree(nodes + N - N/2, N/2, &rightfirst, &right, last);
         (*root)->right = right;
         (*root)->next = rightfirst;
     }
 }
 
 /*
- * Builds a new set with a balanced tree, given a sorted list.
- * Destroys the list before returning the new set.
+ * Builds the balanced tree of a set from allocset, given the number
+ * of elements filled into its block, which is shrunk to fit them.
+ * Returns the set, which may have moved.
  */
-static set_t *buildset(list_t *list, cmpfunc_t cmpfunc) {
-    set_t *set = set_create(cmpfunc);
-    int size = list_size(list);
-
+static set_t *buildset(set_t *set, int size) {
+    set_t *shrunk;
+
+    if (size < set->n_block) {
+        /* nothing points into the block yet, so it may move */
+        shrunk = realloc(set, sizeof(set_t) + size * sizeof(treenode_t));
+        if (shrunk != NULL) {
+            set = shrunk;
+            set->block = (treenode_t *)(set + 1);
+            set->n_block = size;
+        }
+    }
     if (size > 0) {
-        treenode_t *last;       
-        buildtree(list, size, &(set->first), &(set->root), &last);
+        buildtree(set->block, size, &(set->first), &(set->root), &(set->last));
         set->size = size;
     }
-    list_destroy(list);
 
     if (DEBUG_CHECKSET) {
         checkset(set);
@@ -299,10 +421,23 @@ static set_t *buildset(list_t *list, cmpfunc_t cmpfunc) {
     return set;
 }
 
+set_t *set_from_sorted_array(void **elems, int n, cmpfunc_t cmpfunc) {
+    set_t *set = allocset(n, cmpfunc);
+    int i;
+
+    if (set == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < n; i++) {
+        set->block[i].elem = elems[i];
+    }
+    return buildset(set, n);
+}
+
 set_t *set_union(set_t *a, set_t *b) {
-    int cmp;
-    list_t *result;
-    treenode_t *na, *nb;
+    int cmp, n = 0;
+    set_t *result;
+    treenode_t *nodes, *na, *nb;
 
     if (a->cmpfunc != b->cmpfunc) {
         /* 
@@ -318,8 +453,12 @@ set_t *set_union(set_t *a, set_t *b) {
         DEBUG_PRINT("Warning: sets do not share cmpfunc, undefined behavior may occur.\n");
     }
 
-    /* Merge the two sets into a sorted list */
-    result = list_create(a->cmpfunc);
+    /* Merge the two sets into the nodes of the result, enough for both */
+    result = allocset(a->size + b->size, a->cmpfunc);
+    if (result == NULL) {
+        return NULL;
+    }
+    nodes = result->block;
     na = a->first;
     nb = b->first;
 
@@ -327,15 +466,15 @@ set_t *set_union(set_t *a, set_t *b) {
         cmp = a->cmpfunc(na->elem, nb->elem);
         if (cmp < 0) {
             /* Occurs in a only */
-            list_addlast(result, na->elem);
+            nodes[n++].elem = na->elem;
             na = na->next;
         } else if (cmp > 0) {
             /* Occurs in b only */
-            list_addlast(result, nb->elem);
+            nodes[n++].elem = nb->elem;
             nb = nb->next;
         } else {
             /* Occurs in both a and b */
-            list_addlast(result, na->elem);
+            nodes[n++].elem = na->elem;
             na = na->next;
             nb = nb->next;
         }
@@ -343,21 +482,21 @@ set_t *set_union(set_t *a, set_t *b) {
 
     /* Plus what's left of the remaining set (either a or b) */
     for (; na != nullNode; na = na->next) {
-        list_addlast(result, na->elem);
+        nodes[n++].elem = na->elem;
     }
 
     for (; nb != nullNode; nb = nb->next) {
-        list_addlast(result, nb->elem);
+        nodes[n++].elem = nb->elem;
     }
 
-    /* Convert the sorted list into a balanced tree */
-    return buildset(result, a->cmpfunc);
+    /* Link the nodes into a balanced tree */
+    return buildset(result, n);
 }
 
 set_t *set_intersection(set_t *a, set_t *b) {
-    int cmp;
-    list_t *result;
-    treenode_t *na, *nb;
+    int cmp, n = 0;
+    set_t *result;
+    treenode_t *nodes, *na, *nb;
 
     if (a->cmpfunc != b->cmpfunc) {
         /* 
@@ -366,9 +505,13 @@ set_t *set_intersection(set_t *a, set_t *b) {
         DEBUG_PRINT("Warning: sets do not share cmpfunc, undefined behavior may occur.\n");
     }
 
-    /* Merge the two sets into a sorted list,
+    /* Merge the two sets into the nodes of the result,
        keeping common elements only */
-    result = list_create(a->cmpfunc);
+    result = allocset(a->size < b->size ? a->size : b->size, a->cmpfunc);
+    if (result == NULL) {
+        return NULL;
+    }
+    nodes = result->block;
     na = a->first;
     nb = b->first;
 
@@ -382,14 +525,14 @@ set_t *set_intersection(set_t *a, set_t *b) {
             nb = nb->next;
         } else {
             /* Occurs in both a and b, keep this one */
-            list_addlast(result, na->elem);
+            nodes[n++].elem = na->elem;
             na = na->next;
             nb = nb->next;
         }
     }
 
-    /* Convert the sorted list into a balanced tree */
-    return buildset(result, a->cmpfunc);
+    /* Link the nodes into a balanced tree */
+    return buildset(result, n);
 }
 
 set_t *set_difference(set_t *a, set_t *b) {
@@ -400,18 +543,22 @@ set_t *set_difference(set_t *a, set_t *b) {
         DEBUG_PRINT("Warning: sets do not share cmpfunc, undefined behavior may occur.\n");
     }
 
-    /* Merge the two sets into a sorted list,
+    /* Merge the two sets into the nodes of the result,
        keeping only elements that occur in a and not b */
-    list_t *result = list_create(a->cmpfunc);
+    set_t *result = allocset(a->size, a->cmpfunc);
+    if (result == NULL) {
+        return NULL;
+    }
+    treenode_t *nodes = result->block;
     treenode_t *na = a->first;
     treenode_t *nb = b->first;
 
-    int cmp;
+    int cmp, n = 0;
     while (na != nullNode && nb != nullNode) {
         cmp = a->cmpfunc(na->elem, nb->elem);
         if (cmp < 0) {
             /* Occurs in a only, keep this one */
-            list_addlast(result, na->elem);
+            nodes[n++].elem = na->elem;
             na = na->next;
         } else if (cmp > 0) {
             /* Occurs in b only */
@@ -425,24 +572,28 @@ set_t *set_difference(set_t *a, set_t *b) {
 
     /* Plus what's left of a */
     for (; na != nullNode; na = na->next) {
-        list_addlast(result, na->elem);
+        nodes[n++].elem = na->elem;
     }
 
-    /* Convert the sorted list into a balanced tree */
-    return buildset(result, a->cmpfunc);
+    /* Link the nodes into a balanced tree */
+    return buildset(result, n);
 }
 
 set_t *set_copy(set_t *set) {
-    /* Insert all our elements into a list in sorted order */
-    list_t *list = list_create(set->cmpfunc);
+    /* Insert all our elements into the nodes of the copy in sorted order */
+    set_t *copy = allocset(set->size, set->cmpfunc);
     treenode_t *n;
+    int i = 0;
 
+    if (copy == NULL) {
+        return NULL;
+    }
     for (n = set->first; n != nullNode; n = n->next) {
-        list_addlast(list, n->elem);
+        copy->block[i++].elem = n->elem;
     }
 
-    /* Convert the sorted list into a balanced tree */
-    return buildset(list, set->cmpfunc);
+    /* Link the nodes into a balanced tree */
+    return buildset(copy, i);
 }
 
 set_iter_t *set_createiter(set_t *set) {
@@ -453,12 +604,24 @@ set_iter_t *set_createiter(set_t *set) {
         goto end;
     }
 
+    iter->set = set;
     iter->node = set->first;
 
 end:
     return iter;
 }
 
+/* Fails to compile unless set_iterbuf_t can hold the iterator */
+typedef char iterbuf_fits[(sizeof(set_iter_t) <= sizeof(set_iterbuf_t)) ? 1 : -1];
+
+set_iter_t *set_inititer(set_iterbuf_t *buf, set_t *set) {
+    set_iter_t *iter = (set_iter_t *)buf;
+
+    iter->set = set;
+    iter->node = set->first;
+    return iter;
+}
+
 void set_destroyiter(set_iter_t *iter) {
     free(iter);
 }
@@ -476,3 +639,24 @@ void *set_next(set_iter_t *iter) {
     return elem;
 }
 
+void set_skipto(set_iter_t *iter, void *elem) {
+    cmpfunc_t cmpfunc = iter->set->cmpfunc;
+    treenode_t *n, *bound = nullNode;
+
+    if (iter->node == nullNode || cmpfunc(iter->node->elem, elem) >= 0) {
+        return;
+    }
+
+    /* Find the lower bound from the root; it lies ahead of the current node */
+    n = iter->set->root;
+    while (n != nullNode) {
+        if (cmpfunc(n->elem, elem) < 0) {
+            n = n->right;
+        } else {
+            bound = n;
+            n = n->left;
+        }
+    }
+    iter->node = bound;
+}
+
@@ -6,25 +6,36 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
 
 #include "common.h"
 #include "index.h"
-#include "list.h"
+#include "querycache.h"
+#include "vector.h"
 #include "set.h"
 #include "printing.h"
 
 #define WORD_LENGTH ( 10 )
 #define NUM_ITEMS ( 100 )
 #define NUM_DOCS ( 500 )
+#define NUM_CHECKS ( 10 )   // documents the brute-force checks pick their words from
 #define PTIME  1
 
 typedef struct document {
     set_t *terms;
+    vector_t *tokens;  // the terms in the order they were indexed, for brute-force checks
     char path[20];
 } document_t;
 
-static document_t docs[NUM_DOCS];
+static document_t docs[NUM_DOCS + 2];
+static int n_docs = 0;      // documents added to the index: the random ones, then the fixed ones
+static int n_failed = 0;    // queries whose results did not match the brute-force results
+
+/* Words of more than one byte per character, for the fuzzy queries */
+static char *utf8_words[] = {
+    "blåbær", "blåbor", "smørbrød", "smorbrod", "grød", "grøt", NULL
+};
 
 
 /* Generates a random sequence of characters given a seed */
@@ -48,6 +59,7 @@ char *generate_string(unsigned int *seed) {
 void initialize_document(document_t *doc, unsigned int seed) {
     int i;
     // list_t *words; // note: unused
+    set_iter_t *iter;
     char *word;
 
     sprintf(doc->path, "document_%d.txt", seed);
@@ -62,6 +74,40 @@ void initialize_document(document_t *doc, unsigned int seed) {
             set_add(doc->terms, word);
         }
     }
+
+    doc->tokens = vector_create(compare_strings);
+    iter = set_createiter(doc->terms);
+    while (set_hasnext(iter)) {
+        vector_push(doc->tokens, set_next(iter));
+    }
+    set_destroyiter(iter);
+}
+
+/* Makes a document of the given words, in order */
+void initialize_words(document_t *doc, char *path, char **words) {
+    snprintf(doc->path, sizeof(doc->path), "%s", path);
+    doc->terms = set_create(compare_strings);
+    doc->tokens = vector_create(compare_strings);
+
+    for (; *words; words++) {
+        if (!set_contains(doc->terms, *words)) {
+            set_add(doc->terms, strdup(*words));
+        }
+        vector_push(doc->tokens, set_get(doc->terms, *words));
+    }
+}
+
+/* Adds the tokens of the given document to the index, in order */
+void index_document(index_t *ind, document_t *doc) {
+    vector_t *words = vector_create(compare_strings);
+    int i;
+
+    for (i = 0; i < vector_size(doc->tokens); i++) {
+        vector_push(words, strdup(vector_get(doc->tokens, i)));
+    }
+    index_addpath(ind, strdup(doc->path), words);
+    vector_destroy(words);
+    n_docs++;
 }
 
 /* Releases the memory used */
@@ -73,6 +119,599 @@ void doc_destroy(document_t *doc) {
     }
     set_destroyiter(iter);
     set_destroy(doc->terms);
+    vector_destroy(doc->tokens);
+}
+
+/* Returns a new query of the given tokens, terminated by NULL */
+vector_t *make_query(char *token, ...) {
+    vector_t *query = vector_create(compare_strings);
+    va_list args;
+
+    va_start(args, token);
+    for (; token; token = va_arg(args, char *)) {
+        vector_push(query, token);
+    }
+    va_end(args);
+    return query;
+}
+
+/* Returns the position of the given word in the document from 'from' on, or -1 */
+int find_token(document_t *doc, char *word, int from) {
+    for (; from < vector_size(doc->tokens); from++) {
+        if (strcmp(vector_get(doc->tokens, from), word) == 0) {
+            return from;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Returns a new set of the paths of the given query results, or NULL if
+ * there are none, as the query was rejected. The results are destroyed.
+ */
+set_t *result_paths(vector_t *result) {
+    query_result_t *res;
+    set_t *paths;
+
+    if (!result) {
+        return NULL;
+    }
+
+    paths = set_create(compare_strings);
+    while (vector_size(result) > 0) {
+        res = vector_pop(result);
+        set_add(paths, res->path);
+        free(res);
+    }
+    vector_destroy(result);
+    return paths;
+}
+
+/*
+ * Runs the given query, and returns a new set of the paths of its results,
+ * or NULL if the index rejected the query. The query is destroyed.
+ */
+set_t *query_paths(index_t *ind, vector_t *query) {
+    vector_t *result;
+    char *errmsg;
+
+    result = index_query(ind, query, &errmsg);
+    vector_destroy(query);
+    return result_paths(result);
+}
+
+/*
+ * Returns 1 if the index supports the given query, i.e. it returns the
+ * given document, which contains its word, and otherwise 0.
+ * Queries of features an index or parser lacks are rejected, or searched
+ * for as plain words, which no document contains.
+ */
+int supported(index_t *ind, vector_t *query, document_t *doc) {
+    set_t *paths = query_paths(ind, query);
+    int found = paths && set_contains(paths, doc->path);
+
+    if (paths) {
+        set_destroy(paths);
+    }
+    return found;
+}
+
+/*
+ * Checks that the paths of the results of a query are exactly the expected
+ * set of paths, found by a brute-force scan of the documents. The paths are
+ * NULL if the query was rejected. Both sets are destroyed.
+ */
+void check_paths(set_t *paths, set_t *expected, char *desc) {
+    set_iter_t *iter;
+    int same;
+
+    if (!paths) {
+        ERROR_PRINT("Query was rejected: %s\n", desc);
+        n_failed++;
+        set_destroy(expected);
+        return;
+    }
+
+    same = set_size(paths) == set_size(expected);
+    iter = set_createiter(paths);
+    while (same && set_hasnext(iter)) {
+        same = set_contains(expected, set_next(iter));
+    }
+    set_destroyiter(iter);
+
+    if (!same) {
+        ERROR_PRINT("Query returned %d documents, expected %d: %s\n",
+            set_size(paths), set_size(expected), desc);
+        n_failed++;
+    }
+    set_destroy(paths);
+    set_destroy(expected);
+}
+
+/*
+ * Runs the given query, and checks that it returns exactly the documents
+ * of the expected set of paths. Both the query and the set are destroyed.
+ */
+void check_query(index_t *ind, vector_t *query, set_t *expected, char *desc) {
+    check_paths(query_paths(ind, query), expected, desc);
+}
+
+/* Returns 1 if the words occur at consecutive positions of the document, in order */
+int has_phrase(document_t *doc, char **words, int n_words) {
+    int p, i;
+
+    for (p = find_token(doc, words[0], 0); p >= 0; p = find_token(doc, words[0], p + 1)) {
+        for (i = 1; i < n_words && p + i < vector_size(doc->tokens); i++) {
+            if (strcmp(vector_get(doc->tokens, p + i), words[i]) != 0) {
+                break;
+            }
+        }
+        if (i == n_words) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Returns 1 if a and b occur at distinct positions of the document, at most k apart */
+int has_near(document_t *doc, char *a, char *b, int k) {
+    int p, q;
+
+    for (p = find_token(doc, a, 0); p >= 0; p = find_token(doc, a, p + 1)) {
+        for (q = find_token(doc, b, 0); q >= 0; q = find_token(doc, b, q + 1)) {
+            if (q != p && abs(q - p) <= k) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Returns 1 if the word starts with the given prefix */
+int match_prefix(char *word, char *fix, int unused) {
+    return strncmp(word, fix, strlen(fix)) == 0;
+}
+
+/* Returns 1 if the word ends with the given suffix */
+int match_suffix(char *word, char *fix, int unused) {
+    size_t len = strlen(word), fix_len = strlen(fix);
+
+    return len >= fix_len && strcmp(word + len - fix_len, fix) == 0;
+}
+
+/* Returns the Levenshtein distance of the given words, counted in bytes */
+int edit_distance(char *a, char *b) {
+    int len_a = strlen(a), len_b = strlen(b);
+    int *row = malloc((len_b + 1) * sizeof(int));
+    int i, j, diag, above, dist;
+
+    for (j = 0; j <= len_b; j++) {
+        row[j] = j;
+    }
+    for (i = 1; i <= len_a; i++) {
+        diag = row[0];
+        row[0] = i;
+        for (j = 1; j <= len_b; j++) {
+            above = row[j];
+            dist = diag + (a[i - 1] != b[j - 1]);
+            if (above + 1 < dist) {
+                dist = above + 1;
+            }
+            if (row[j - 1] + 1 < dist) {
+                dist = row[j - 1] + 1;
+            }
+            row[j] = dist;
+            diag = above;
+        }
+    }
+
+    dist = row[len_b];
+    free(row);
+    return dist;
+}
+
+/* Returns 1 if the word is within the given edit distance of the term */
+int match_fuzzy(char *word, char *term, int max_dist) {
+    return edit_distance(word, term) <= max_dist;
+}
+
+/*
+ * Returns a new set of the paths of the documents that contain a word for
+ * which the given function returns 1, by a brute-force scan of their terms.
+ */
+set_t *scan_words(int (*match)(char *word, char *arg, int n), char *arg, int n) {
+    set_t *paths = set_create(compare_strings);
+    int d, i;
+
+    for (d = 0; d < n_docs; d++) {
+        for (i = 0; i < vector_size(docs[d].tokens); i++) {
+            if (match(vector_get(docs[d].tokens, i), arg, n)) {
+                set_add(paths, docs[d].path);
+                break;
+            }
+        }
+    }
+    return paths;
+}
+
+/*
+ * Checks "quoted phrase" and `a NEAR/k b` queries of words picked from the
+ * first documents against a brute-force scan of the token positions.
+ * NEAR is checked with words exactly k positions apart, and k + 1 apart.
+ */
+void validate_positional(index_t *ind) {
+    char phrase[64], near[16], desc[128], *words[5], *reversed[2];
+    int i, j, k, d, p, n_checks = 0;
+    document_t *doc = &docs[0];
+    set_t *expected;
+
+    snprintf(phrase, sizeof(phrase), "\"%s\"", (char *)vector_get(doc->tokens, 0));
+    if (!supported(ind, make_query(phrase, NULL), doc)) {
+        printf("> Phrase queries: not supported, skipped\n");
+        return;
+    }
+
+    for (i = 0; i < NUM_CHECKS; i++) {
+        doc = &docs[i];
+        p = (i * 7) % (vector_size(doc->tokens) - 4);
+        for (j = 0; j < 5; j++) {
+            words[j] = vector_get(doc->tokens, p + j);
+        }
+
+        /* two and three consecutive words */
+        for (j = 2; j <= 3; j++) {
+            snprintf(phrase, sizeof(phrase), (j == 2) ? "\"%s %s\"" : "\"%s %s %s\"",
+                words[0], words[1], words[2]);
+            expected = set_create(compare_strings);
+            for (d = 0; d < n_docs; d++) {
+                if (has_phrase(&docs[d], words, j)) {
+                    set_add(expected, docs[d].path);
+                }
+            }
+            check_query(ind, make_query(phrase, NULL), expected, phrase);
+            n_checks++;
+        }
+
+        /* two consecutive words in the wrong order */
+        reversed[0] = words[1];
+        reversed[1] = words[0];
+        snprintf(phrase, sizeof(phrase), "\"%s %s\"", reversed[0], reversed[1]);
+        expected = set_create(compare_strings);
+        for (d = 0; d < n_docs; d++) {
+            if (has_phrase(&docs[d], reversed, 2)) {
+                set_add(expected, docs[d].path);
+            }
+        }
+        check_query(ind, make_query(phrase, NULL), expected, phrase);
+        n_checks++;
+
+        /* words[k] is k positions from words[0] in this document, words[k + 1] is k + 1 */
+        for (k = 1; k <= 3; k++) {
+            snprintf(near, sizeof(near), "NEAR/%d", k);
+            for (j = k; j <= k + 1; j++) {
+                expected = set_create(compare_strings);
+                for (d = 0; d < n_docs; d++) {
+                    if (has_near(&docs[d], words[0], words[j], k)) {
+                        set_add(expected, docs[d].path);
+                    }
+                }
+                if (set_contains(expected, doc->path) != (j == k)) {
+                    ERROR_PRINT("Brute-force scan disagrees with the positions of %s\n", doc->path);
+                    n_failed++;
+                }
+                snprintf(desc, sizeof(desc), "%s %s %s", words[0], near, words[j]);
+                check_query(ind, make_query(words[0], near, words[j], NULL), expected, desc);
+                n_checks++;
+            }
+        }
+    }
+
+    printf("> Phrase queries: %d checked\n", n_checks);
+}
+
+/* Returns the first word of the document of at least the given length */
+char *pick_word(document_t *doc, int from, size_t min_len) {
+    int i, n = vector_size(doc->tokens);
+
+    for (i = 0; i < n; i++) {
+        if (strlen(vector_get(doc->tokens, (from + i) % n)) >= min_len) {
+            return vector_get(doc->tokens, (from + i) % n);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Checks `prefix*` and `*suffix` queries of the first and last letters of
+ * words picked from the first documents against a brute-force scan of the
+ * terms. The generated words never contain a 'z', so "zz" is neither the
+ * prefix nor the suffix of any, and those queries return nothing.
+ */
+void validate_patterns(index_t *ind) {
+    char pattern[64], fix[32], *word;
+    int i, len, n_checks = 0;
+    document_t *doc = &docs[0];
+
+    snprintf(pattern, sizeof(pattern), "%s*", (char *)vector_get(doc->tokens, 0));
+    if (!supported(ind, make_query(pattern, NULL), doc)) {
+        printf("> Pattern queries: not supported, skipped\n");
+        return;
+    }
+
+    for (i = 0; i < NUM_CHECKS; i++) {
+        doc = &docs[i];
+        word = pick_word(doc, i * 7, 4);
+
+        /* the first 3 letters, and the whole word */
+        snprintf(fix, sizeof(fix), "%.3s", word);
+        snprintf(pattern, sizeof(pattern), "%s*", fix);
+        check_query(ind, make_query(pattern, NULL), scan_words(match_prefix, fix, 0), pattern);
+        snprintf(pattern, sizeof(pattern), "%s*", word);
+        check_query(ind, make_query(pattern, NULL), scan_words(match_prefix, word, 0), pattern);
+        n_checks += 2;
+    }
+    check_query(ind, make_query("zz*", NULL), scan_words(match_prefix, "zz", 0), "zz*");
+    n_checks++;
+
+    doc = &docs[0];
+    snprintf(pattern, sizeof(pattern), "*%s", (char *)vector_get(doc->tokens, 0));
+    if (!supported(ind, make_query(pattern, NULL), doc)) {
+        printf("> Pattern queries: %d checked, *suffix not supported\n", n_checks);
+        return;
+    }
+
+    for (i = 0; i < NUM_CHECKS; i++) {
+        doc = &docs[i];
+        word = pick_word(doc, i * 7, 4);
+        len = strlen(word);
+
+        /* the last 3 letters, and the whole word */
+        snprintf(fix, sizeof(fix), "%s", word + len - 3);
+        snprintf(pattern, sizeof(pattern), "*%s", fix);
+        check_query(ind, make_query(pattern, NULL), scan_words(match_suffix, fix, 0), pattern);
+        snprintf(pattern, sizeof(pattern), "*%s", word);
+        check_query(ind, make_query(pattern, NULL), scan_words(match_suffix, word, 0), pattern);
+        n_checks += 2;
+    }
+    check_query(ind, make_query("*zz", NULL), scan_words(match_suffix, "zz", 0), "*zz");
+    n_checks++;
+
+    printf("> Pattern queries: %d checked\n", n_checks);
+}
+
+/*
+ * Checks `term~N` queries against a brute-force scan of the terms, by
+ * their Levenshtein distance in bytes: of words picked from the first
+ * documents, the same with a letter changed to 'z', which no generated
+ * word contains, and words of multi-byte characters, where each changed
+ * character is more than one edit. Nothing is within 2 of "zzzzzzzz".
+ */
+void validate_fuzzy(index_t *ind) {
+    static struct { char *term; int dist; } utf8_checks[] = {
+        { "blåbær", 1 }, { "blåbær", 2 }, { "grøt", 1 }, { "smorbrød", 2 }, { "blabær", 2 }
+    };
+    char pattern[64], changed[32], *word;
+    int i, n, n_checks = 0;
+    document_t *doc = &docs[0];
+
+    snprintf(pattern, sizeof(pattern), "%s~1", (char *)vector_get(doc->tokens, 0));
+    if (!supported(ind, make_query(pattern, NULL), doc)) {
+        printf("> Fuzzy queries: not supported, skipped\n");
+        return;
+    }
+
+    for (i = 0; i < NUM_CHECKS; i++) {
+        doc = &docs[i];
+        word = pick_word(doc, i * 7, 5);
+        snprintf(changed, sizeof(changed), "%s", word);
+        changed[i % strlen(word)] = 'z';
+
+        for (n = 0; n <= 2; n++) {
+            snprintf(pattern, sizeof(pattern), "%s~%d", word, n);
+            check_query(ind, make_query(pattern, NULL), scan_words(match_fuzzy, word, n), pattern);
+            snprintf(pattern, sizeof(pattern), "%s~%d", changed, n);
+            check_query(ind, make_query(pattern, NULL), scan_words(match_fuzzy, changed, n), pattern);
+            n_checks += 2;
+        }
+    }
+
+    for (i = 0; i < sizeof(utf8_checks) / sizeof(utf8_checks[0]); i++) {
+        snprintf(pattern, sizeof(pattern), "%s~%d", utf8_checks[i].term, utf8_checks[i].dist);
+        check_query(ind, make_query(pattern, NULL),
+            scan_words(match_fuzzy, utf8_checks[i].term, utf8_checks[i].dist), pattern);
+        n_checks++;
+    }
+    check_query(ind, make_query("zzzzzzzz~2", NULL), scan_words(match_fuzzy, "zzzzzzzz", 2), "zzzzzzzz~2");
+    n_checks++;
+
+    printf("> Fuzzy queries: %d checked\n", n_checks);
+}
+
+/*
+ * Checks queries of the unary NOT against the complements of the documents
+ * containing their words, picked from pairs of the first documents.
+ */
+void validate_not(index_t *ind) {
+    char desc[64], *a, *b;
+    int i, d, n_checks = 0;
+    set_t *expected;
+
+    if (!supported(ind, make_query("NOT", "zz", NULL), &docs[0])) {
+        printf("> NOT queries: not supported, skipped\n");
+        return;
+    }
+
+    for (i = 0; i < NUM_CHECKS; i++) {
+        a = pick_word(&docs[i], i * 7, 1);
+        b = pick_word(&docs[i + 1], i * 7, 1);
+
+        /* NOT a */
+        expected = set_create(compare_strings);
+        for (d = 0; d < n_docs; d++) {
+            if (!set_contains(docs[d].terms, a)) {
+                set_add(expected, docs[d].path);
+            }
+        }
+        snprintf(desc, sizeof(desc), "NOT %s", a);
+        check_query(ind, make_query("NOT", a, NULL), expected, desc);
+
+        /* a ANDNOT ( NOT b ), i.e. a AND b */
+        expected = set_create(compare_strings);
+        for (d = 0; d < n_docs; d++) {
+            if (set_contains(docs[d].terms, a) && set_contains(docs[d].terms, b)) {
+                set_add(expected, docs[d].path);
+            }
+        }
+        snprintf(desc, sizeof(desc), "%s ANDNOT ( NOT %s )", a, b);
+        check_query(ind, make_query(a, "ANDNOT", "(", "NOT", b, ")", NULL), expected, desc);
+
+        /* NOT ( a OR b ) */
+        expected = set_create(compare_strings);
+        for (d = 0; d < n_docs; d++) {
+            if (!set_contains(docs[d].terms, a) && !set_contains(docs[d].terms, b)) {
+                set_add(expected, docs[d].path);
+            }
+        }
+        snprintf(desc, sizeof(desc), "NOT ( %s OR %s )", a, b);
+        check_query(ind, make_query("NOT", "(", a, "OR", b, ")", NULL), expected, desc);
+        n_checks += 3;
+    }
+
+    printf("> NOT queries: %d checked\n", n_checks);
+}
+
+/* Returns 1 if the document contains the given word */
+int has_word(document_t *doc, char *word) {
+    return set_contains(doc->terms, word);
+}
+
+int match_a(document_t *doc)        { return has_word(doc, "a"); }
+int match_a_and_b(document_t *doc)  { return has_word(doc, "a") && has_word(doc, "b"); }
+int match_a_or_c(document_t *doc)   { return has_word(doc, "a") || has_word(doc, "c"); }
+int match_ab_and_c(document_t *doc) { return (has_word(doc, "a") || has_word(doc, "b")) && has_word(doc, "c"); }
+int match_c_andnot_d(document_t *doc) { return has_word(doc, "c") && !has_word(doc, "d"); }
+int match_d_or_ab(document_t *doc)  { return has_word(doc, "d") || has_word(doc, "a") || has_word(doc, "b"); }
+
+/*
+ * Queries of the cache checks, of single letters, which each occur in about
+ * a third of the documents. The fifth shares a subquery with the fourth,
+ * and the last is a reordering of the second, and shares its cache entry.
+ */
+static struct {
+    char *tokens[8];
+    int (*match)(document_t *doc);
+} cache_queries[] = {
+    { { "a", NULL }, match_a },
+    { { "a", "AND", "b", NULL }, match_a_and_b },
+    { { "a", "OR", "c", NULL }, match_a_or_c },
+    { { "(", "a", "OR", "b", ")", "AND", "c", NULL }, match_ab_and_c },
+    { { "d", "OR", "(", "b", "OR", "a", ")", NULL }, match_d_or_ab },
+    { { "c", "ANDNOT", "d", NULL }, match_c_andnot_d },
+    { { "b", "AND", "a", NULL }, match_a_and_b },
+};
+#define NUM_CACHE_QUERIES ( sizeof(cache_queries) / sizeof(cache_queries[0]) )
+
+/* Returns a new query of the tokens of the given cache query, which are joined in 'desc' */
+vector_t *cache_query(int q, char *desc, size_t size) {
+    vector_t *query = vector_create(compare_strings);
+    char **token;
+    size_t len = 0;
+
+    desc[0] = '\0';
+    for (token = cache_queries[q].tokens; *token; token++) {
+        vector_push(query, *token);
+        len += snprintf(desc + len, (len < size) ? size - len : 0, len ? " %s" : "%s", *token);
+    }
+    return query;
+}
+
+/* Returns a new set of the paths of the documents matching the given cache query */
+set_t *scan_cache_query(int q) {
+    set_t *paths = set_create(compare_strings);
+    int d;
+
+    for (d = 0; d < n_docs; d++) {
+        if (cache_queries[q].match(&docs[d])) {
+            set_add(paths, docs[d].path);
+        }
+    }
+    return paths;
+}
+
+/*
+ * Runs each cache query twice through the index, checking its results.
+ * The second run, and the later queries, reuse the subquery results cached
+ * by the parser of the index, if it has one.
+ */
+void run_uncached(index_t *ind) {
+    char desc[64];
+    int q, run;
+
+    for (q = 0; q < NUM_CACHE_QUERIES; q++) {
+        for (run = 0; run < 2; run++) {
+            check_query(ind, cache_query(q, desc, sizeof(desc)), scan_cache_query(q), desc);
+        }
+    }
+}
+
+/* Runs each cache query twice through the query cache, checking its results */
+void run_cached(index_t *ind, querycache_t *cache) {
+    vector_t *query;
+    char desc[64], *errmsg;
+    int q, run;
+
+    for (q = 0; q < NUM_CACHE_QUERIES; q++) {
+        for (run = 0; run < 2; run++) {
+            query = cache_query(q, desc, sizeof(desc));
+            check_paths(result_paths(qcache_query(cache, ind, query, &errmsg)),
+                scan_cache_query(q), desc);
+            vector_destroy(query);
+        }
+    }
+}
+
+/* Checks the hit and miss counters of the query cache */
+void check_stats(querycache_t *cache, unsigned long hits, unsigned long misses) {
+    unsigned long cache_hits, cache_misses;
+
+    qcache_stats(cache, &cache_hits, &cache_misses, NULL);
+    if (cache_hits != hits || cache_misses != misses) {
+        ERROR_PRINT("Query cache counted %lu hits and %lu misses, expected %lu and %lu\n",
+            cache_hits, cache_misses, hits, misses);
+        n_failed++;
+    }
+}
+
+/*
+ * Checks that repeated queries return the same results from the query
+ * cache, and the subquery cache of the index, as uncached, and that the
+ * caches are flushed once a document is added: the cached results then
+ * lack the new document, which contains all the words of the queries but "d".
+ */
+void validate_caches(index_t *ind) {
+    static char *late_words[] = { "a", "b", "c", NULL };
+    querycache_t *cache = qcache_create(1 << 20);
+    unsigned long version = index_version(ind);
+    int n = NUM_CACHE_QUERIES;
+
+    /* each query misses once and then hits, but for the reordered one, which only hits */
+    run_uncached(ind);
+    run_cached(ind, cache);
+    check_stats(cache, n + 1, n - 1);
+
+    initialize_words(&docs[n_docs], "document_late.txt", late_words);
+    index_document(ind, &docs[n_docs]);
+    if (index_version(ind) == version) {
+        ERROR_PRINT("Index version did not change when a document was added\n");
+        n_failed++;
+    }
+
+    run_uncached(ind);
+    run_cached(ind, cache);
+    check_stats(cache, 2 * (n + 1), 2 * (n - 1));
+
+    qcache_destroy(cache);
+    printf("> Cached queries: %d checked\n", (int)(8 * n));
 }
 
 /* Runs a series of queries and validates the index */
@@ -81,22 +720,22 @@ void validate_index(index_t *ind) {
 
     int i, hitCount;
     // set_t *w; // note: unused
-    list_t *query;
+    vector_t *query;
     set_iter_t *iter;
-    list_t *result;
+    vector_t *result;
     char *errmsg, *term;
     query_result_t *res;
 
-    query = list_create(compare_strings);
+    query = vector_create(compare_strings);
 
     /* Validate that all words returns the document */
-    for (i = 0; i < NUM_DOCS; i++) {
+    for (i = 0; i < n_docs; i++) {
         iter = set_createiter(docs[i].terms);
 
         while (set_hasnext(iter)) {
             /* Add to query */
             term = (char *)set_next(iter);
-            list_addfirst(query, term);
+            vector_push(query, term);
 
             if (PTIME) {
                 t_start = gettime();
@@ -114,23 +753,23 @@ void validate_index(index_t *ind) {
 
             /* Validate that the path is in the result set */
             hitCount = 0;
-            while (list_size(result) > 0) {
-                res = list_popfirst(result);
+            while (vector_size(result) > 0) {
+                res = vector_pop(result);
                 if (strcmp(res->path, docs[i].path) == 0) {
                     hitCount++;
                 }
                 free(res);
             }
-            list_destroy(result);
+            vector_destroy(result);
 
             if (hitCount == 0){
                 ERROR_PRINT("Document was not returned: term=%s path=%s", term, docs[i].path);
             }
-            list_popfirst(query);
+            vector_pop(query);
         }
         set_destroyiter(iter);
     }
-    list_destroy(query);
+    vector_destroy(query);
 
     if (PTIME) {
         // printf("> Query cumu. time: %llu μs. [wordlen=%d, n_words=%d, n_docs=%d]\n", 
@@ -143,8 +782,6 @@ void validate_index(index_t *ind) {
 int main(int argc, char **argv) {
     int i;
     index_t *ind;
-    list_t *words;
-    set_iter_t *iter;
 
     /* Create index */
     ind = index_create();
@@ -153,27 +790,32 @@ int main(int argc, char **argv) {
     /* Generate random documents */
     for (i = 0; i < NUM_DOCS; i++) {
         initialize_document(&docs[i], i);
-
-        words = list_create(compare_strings);
-        iter = set_createiter(docs[i].terms);
-
-        while (set_hasnext(iter)) {
-            list_addfirst(words, strdup((char *)set_next(iter)));
-        }
-
-        set_destroyiter(iter);
-        index_addpath(ind, strdup(docs[i].path), words);
-        list_destroy(words);
+        index_document(ind, &docs[i]);
     }
+    initialize_words(&docs[NUM_DOCS], "document_utf8.txt", utf8_words);
+    index_document(ind, &docs[NUM_DOCS]);
 
     DEBUG_PRINT("Running a series of single term queries to validate the index...\n");
     validate_index(ind);
     DEBUG_PRINT("Success!\n");
 
+    DEBUG_PRINT("Checking queries against brute-force scans of the documents...\n");
+    validate_positional(ind);
+    validate_patterns(ind);
+    validate_fuzzy(ind);
+    validate_not(ind);
+    validate_caches(ind);
+
     index_destroy(ind);
 
     /* Cleanup */
-    for (i = 0; i < NUM_DOCS; i++) {
+    for (i = 0; i < n_docs; i++) {
         doc_destroy(&docs[i]);
     }
+
+    if (n_failed) {
+        printf("> %d queries did not match the brute-force results\n", n_failed);
+        return 1;
+    }
+    return 0;
 }
@@ -34,7 +34,7 @@ static int is_operator(qnode_t *node);
 static void destroy_product(qnode_t *term);
 static void destroy_querynodes(qnode_t *leftmost);
 
-static void debug_print_query(char *msg, list_t *tokens, qnode_t *leftmost);
+static void debug_print_query(char *msg, vector_t *tokens, qnode_t *leftmost);
 static void debug_print_cattokens(qnode_t *oper);
 
 
@@ -97,6 +97,45 @@ char *parser_get_errmsg(parser_t *parser) {
     return parser->errmsg_buf;
 }
 
+/* Caching of subqueries is only supported by queryparser.c */
+int parser_enable_cache(parser_t *parser, size_t max_elems) {
+    return -1;
+}
+
+void parser_invalidate(parser_t *parser) {
+    return;
+}
+
+/* Query complexity is not limited by the assertive parser */
+void parser_set_maxtokens(parser_t *parser, int max_tokens) {
+    return;
+}
+
+/* Phrases are only supported by queryparser.c, and are treated as plain <word>'s here */
+void parser_set_phrase_func(parser_t *parser, phrase_func_t phrase_func) {
+    return;
+}
+
+/* Patterns are only supported by queryparser.c, and are treated as plain <word>'s here */
+void parser_set_expand_func(parser_t *parser, expand_func_t expand_func) {
+    return;
+}
+
+/* Terms are always resolved to sets here, through the term function */
+void parser_set_bitmap_func(parser_t *parser, bitmap_func_t bitmap_func) {
+    return;
+}
+
+/* Terms are resolved one at a time here, through the term function */
+void parser_set_batch_func(parser_t *parser, batch_func_t batch_func) {
+    return;
+}
+
+/* NOT is only supported by queryparser.c, and is treated as a plain <word> here */
+void parser_set_universe_func(parser_t *parser, universe_func_t universe_func) {
+    return;
+}
+
 set_t *parser_get_result(parser_t *parser) {
     if (!parser->leftmost) {
         ERROR_PRINT("parser has no node at leftmost\n");
@@ -112,8 +151,13 @@ set_t *parser_get_result(parser_t *parser) {
         return set_create((cmpfunc_t)strcmp);
     }
 
-    /* query yielded results. copy and return the result set */
-    set_t *result = set_copy(parser->leftmost->prod);
+    /* query yielded results. return the result set, sharing that of a <word> */
+    set_t *result = parser->leftmost->prod;
+    if (parser->leftmost->free_prod) {
+        parser->leftmost->prod = NULL;
+    } else {
+        set_retain(result);
+    }
     destroy_product(parser->leftmost);
     free(parser->leftmost);
     parser->leftmost = NULL;
@@ -121,7 +165,7 @@ set_t *parser_get_result(parser_t *parser) {
     return result;
 }
 
-parser_status_t parser_scan(parser_t *parser, list_t *tokens) {
+parser_status_t parser_scan(parser_t *parser, vector_t *tokens) {
     /* This function is rather nested, but has a simple purpose:
      * 1. Validate the syntax of query tokens
      * 2. 'converting' them into query nodes
@@ -135,17 +179,15 @@ parser_status_t parser_scan(parser_t *parser, list_t *tokens) {
     leftmost = prev = prev_nonpar = node = NULL;
 
     char *errmsg = NULL, *token = NULL;
-    pile_t *paren_pile = NULL, *tok_pile = NULL;
-    list_iter_t *tok_iter = NULL;
+    pile_buf_t paren_buf, tok_buf;
+    pile_t *paren_pile = pile_init(&paren_buf), *tok_pile = pile_init(&tok_buf);
+    int n_tok = 0, n_toks = vector_size(tokens);
     map_t *searched_words = NULL;
     parser_status_t status = SKIP_PARSE;
 
-    tok_iter = list_createiter(tokens);
-    paren_pile = pile_create();
-    tok_pile = pile_create();
     searched_words = map_create((cmpfunc_t)strcmp, hash_string);
 
-    if (!searched_words || !paren_pile || !searched_words) {
+    if (!searched_words) {
         status = ALLOC_FAILED;
         goto end;
     }
@@ -156,13 +198,13 @@ parser_status_t parser_scan(parser_t *parser, list_t *tokens) {
     dummy_str[1] = '\0';
 
     /* loop until an error message is set, or there are no more tokens */
-    while (!errmsg && list_hasnext(tok_iter)) {
+    while (!errmsg && n_tok < n_toks) {
         node = malloc(sizeof(qnode_t));
         if (!node) {
             status = ALLOC_FAILED;
             goto end;
         }
-        token = list_next(tok_iter);
+        token = vector_get(tokens, n_tok++);
 
         /* initialize the node */
         node->prod = NULL;
@@ -196,8 +238,8 @@ parser_status_t parser_scan(parser_t *parser, list_t *tokens) {
                     node->sibling->left->right = prev;
                 }
                 prev->left = node->sibling->left;
-                free(node);
                 free(node->sibling);
+                free(node);
                 node = NULL;  // defensive measure
             } else {
                 /* link the other parentheses */
@@ -284,13 +326,13 @@ parser_status_t parser_scan(parser_t *parser, list_t *tokens) {
         debug_print_query("[error]: ", NULL, leftmost);
 
         /* print a formatted error message to the parsers errmsg buffer */
-        if ((pile_size(tok_pile) > 2) && list_hasnext(tok_iter)) {
+        if ((pile_size(tok_pile) > 2) && n_tok < n_toks) {
             snprintf(parser->errmsg_buf, ERRMSG_MAXLEN,
                 "<br>Error around %s%s %s %s%s ~ %s.",
                 ((pile_size(tok_pile) > 3) ? ("[ ... ") : ("[")),
                 (char *)pile_peek(tok_pile, 1), token,
-                (char *)list_next(tok_iter), 
-                (list_hasnext(tok_iter) ? (" ... ]") : ("]")), errmsg);
+                (char *)vector_get(tokens, n_tok), 
+                ((n_tok + 1 < n_toks) ? (" ... ]") : ("]")), errmsg);
         } else {
             snprintf(parser->errmsg_buf, ERRMSG_MAXLEN,
                 "<br>Error around token %d: \"%s\" ~ %s.",
@@ -309,9 +351,8 @@ parser_status_t parser_scan(parser_t *parser, list_t *tokens) {
 
 end:
     /* cleanup and return */
-    if (tok_iter) list_destroyiter(tok_iter);
-    if (paren_pile) pile_destroy(paren_pile);
-    if (tok_pile) pile_destroy(tok_pile);
+    pile_finish(paren_pile);
+    pile_finish(tok_pile);
     if (searched_words) map_destroy(searched_words, NULL, NULL);
     if (status != PARSE_READY) destroy_querynodes(leftmost);
 
@@ -324,7 +365,13 @@ static qnode_t *parse_node(qnode_t *node) {
         case R_PAREN:
             printf("<<< goto l_paren\n");
             /* End of query/subquery. Splice parentheses and shift to lparen->right */
-            return parse_node(splice_nodes(node->sibling, node));
+            node = splice_nodes(node->sibling, node);
+            /* The subquery is the right operand of a pending operator. Consume it
+             * before moving on, to keep the left --> right evaluation order */
+            if (is_operator(node->left)) {
+                return parse_node(node->left);
+            }
+            return parse_node(node);
         case OP_OR:
             return term_or(node);
         case OP_AND:
@@ -600,21 +647,19 @@ static void debug_print_cattokens(qnode_t *oper) {
     }
 }
 
-static void debug_print_query(char *msg, list_t *tokens, qnode_t *leftmost) {
+static void debug_print_query(char *msg, vector_t *tokens, qnode_t *leftmost) {
     if (msg) DEBUG_PRINT("%s", msg);
 
     if (tokens) {
-        list_iter_t *tok_iter = list_createiter(tokens);
         printf("[q_tokens]\t`");
-        while (list_hasnext(tok_iter)) {
-            char *tok = (char *)list_next(tok_iter);
+        for (int i = 0; i < vector_size(tokens); i++) {
+            char *tok = (char *)vector_get(tokens, i);
             if (isupper(tok[0]))
                 printf(" %s ", tok);
             else
                 printf("%s", tok);
         }
         printf("`\n");
-        list_destroyiter(tok_iter);
     }
 
     if (leftmost) {
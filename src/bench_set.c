@@ -0,0 +1,261 @@
+/*
+ * Program to count the comparisons made by the set while building an index.
+ *
+ * Tokenizes the files of a directory, and adds every token to a set of
+ * words, as index_addpath does:
+ *  - get+add: set_get followed by set_add, walking the tree twice
+ *  - tryadd:  set_tryadd, finding or adding in a single pass
+ *
+ * Then adds the docid of every token to a set of docids of its word, as the
+ * postings are built, in ascending docid order:
+ *  - tryadd:      set_tryadd
+ *  - tryadd_last: set_tryadd_last, hinting the docid comes last
+ *
+ * Finally times the union, intersection and difference of the docids of
+ * each word and the next, through set.h, and through a set specialized
+ * for docids by SET_DEFINE.
+ *
+ * The set implementation is selected through SET_SRC in the Makefile.
+ *
+ * NOTE:
+ * Like time_index, the program does not clean up after itself.
+ */
+
+#include "set.h"
+#include "list.h"
+#include "vector.h"
+#include "typedset.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DOCID_CMP(a, b)  (((a) > (b)) - ((a) < (b)))
+
+SET_DEFINE(docset, uintptr_t, DOCID_CMP)
+
+typedef struct word {
+    char  *term;
+    set_t *docs;
+} word_t;
+
+static unsigned long n_cmps = 0;
+
+static int count_words(void *a, void *b) {
+    n_cmps++;
+    return strcmp(((word_t *)a)->term, ((word_t *)b)->term);
+}
+
+static int count_docids(void *a, void *b) {
+    n_cmps++;
+    return compare_pointers(a, b);
+}
+
+static void print_result(const char *stage, const char *variant, long n_tokens, unsigned long long t_time) {
+    printf("%-10s %-12s %6.2f cmps/token %8.1fms\n", stage, variant,
+           (double)n_cmps / n_tokens, (double)t_time / 1000);
+}
+
+/*
+ * Adds the tokens of all documents to a new set of words, either through
+ * set_get and set_add, or through set_tryadd.
+ * Returns the set, or NULL on failure.
+ */
+static set_t *add_words(vector_t **docs, int n_docs, long n_tokens, int single_pass) {
+    set_t *words = set_create(count_words);
+    word_t *buf = malloc(sizeof(word_t));
+    unsigned long long start;
+    int i, j;
+
+    if (!words || !buf) {
+        return NULL;
+    }
+
+    n_cmps = 0;
+    start = gettime();
+
+    for (i = 0; i < n_docs; i++) {
+        for (j = 0; j < vector_size(docs[i]); j++) {
+            buf->term = vector_get(docs[i], j);
+            if (single_pass) {
+                if (set_tryadd(words, buf) != buf) {
+                    continue;
+                }
+            } else {
+                if (set_get(words, buf)) {
+                    continue;
+                }
+                set_add(words, buf);
+            }
+
+            /* the buffer was added, replace it */
+            if (!(buf->docs = set_create(count_docids)) || !(buf = malloc(sizeof(word_t)))) {
+                return NULL;
+            }
+        }
+    }
+
+    print_result("words:", single_pass ? "tryadd" : "get+add", n_tokens, gettime() - start);
+    return words;
+}
+
+/*
+ * Adds the docid of every token to the docids of its word, in ascending
+ * docid order, either through set_tryadd or set_tryadd_last.
+ */
+static void add_docids(set_t *words, vector_t **docs, int n_docs, long n_tokens, int hinted) {
+    unsigned long long start, t_time = 0;
+    word_t buf, *word;
+    void *docid;
+    int i, j;
+
+    n_cmps = 0;
+    for (i = 0; i < n_docs; i++) {
+        /* docids start at 1, as 0 would be a NULL element */
+        docid = (void *)(uintptr_t)(i + 1);
+        for (j = 0; j < vector_size(docs[i]); j++) {
+            buf.term = vector_get(docs[i], j);
+
+            /* only time, and count the comparisons of, the docid sets */
+            unsigned long word_cmps = n_cmps;
+            word = set_get(words, &buf);
+            n_cmps = word_cmps;
+
+            start = gettime();
+            if (hinted) {
+                set_tryadd_last(word->docs, docid);
+            } else {
+                set_tryadd(word->docs, docid);
+            }
+            t_time += gettime() - start;
+        }
+    }
+
+    print_result("postings:", hinted ? "tryadd_last" : "tryadd", n_tokens, t_time);
+}
+
+/*
+ * Times the set operations between the docids of each word and the next,
+ * as sets of set.h and as docsets.
+ */
+static void set_ops(set_t *words) {
+    int n = set_size(words), i, j, k = 0;
+    set_t **sets = malloc(n * sizeof(set_t *));
+    docset_t **docsets = malloc(n * sizeof(docset_t *));
+    unsigned long long start, t_void, t_typed;
+    long n_void = 0, n_typed = 0;
+    word_t *word;
+    void *docid;
+
+    if (!sets || !docsets) {
+        printf("out of memory\n");
+        return;
+    }
+
+    /* copies, without counting comparisons */
+    SET_FOREACH(word, words) {
+        sets[k] = set_create(compare_pointers);
+        docsets[k] = docset_create();
+        SET_FOREACH(docid, word->docs) {
+            set_tryadd_last(sets[k], docid);
+            docset_add(docsets[k], (uintptr_t)docid);
+        }
+        k++;
+    }
+
+    start = gettime();
+    for (i = 0; i + 1 < n; i++) {
+        set_t *ops[3] = {
+            set_union(sets[i], sets[i + 1]),
+            set_intersection(sets[i], sets[i + 1]),
+            set_difference(sets[i], sets[i + 1])
+        };
+        for (j = 0; j < 3; j++) {
+            n_void += set_size(ops[j]);
+            set_destroy(ops[j]);
+        }
+    }
+    t_void = gettime() - start;
+
+    start = gettime();
+    for (i = 0; i + 1 < n; i++) {
+        docset_t *ops[3] = {
+            docset_union(docsets[i], docsets[i + 1]),
+            docset_intersection(docsets[i], docsets[i + 1]),
+            docset_difference(docsets[i], docsets[i + 1])
+        };
+        for (j = 0; j < 3; j++) {
+            n_typed += docset_size(ops[j]);
+            docset_destroy(ops[j]);
+        }
+    }
+    t_typed = gettime() - start;
+
+    if (n_void != n_typed) {
+        printf("ERROR: set operations disagree, %ld vs %ld elements\n", n_void, n_typed);
+    }
+    printf("%-10s %-12s %8.1fms\n", "set ops:", "set.h", (double)t_void / 1000);
+    printf("%-10s %-12s %8.1fms  (%.1fx)\n", "set ops:", "SET_DEFINE", (double)t_typed / 1000,
+           t_typed ? (double)t_void / t_typed : 0);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        printf("usage: bench_set <dir>\n");
+        return 1;
+    }
+
+    char *root_dir = argv[1], *fullpath;
+    list_t *files;
+    vector_t **docs;
+    list_iter_t *iter;
+    set_t *words, *twopass;
+    long n_tokens = 0;
+    int n_docs = 0;
+
+    /* Check that root_dir exists and is directory */
+    if (!is_valid_directory(root_dir)) {
+        printf("ERROR: invalid root_dir '%s'\n", root_dir);
+        return 1;
+    }
+
+    files = find_files(root_dir);
+    docs = malloc(list_size(files) * sizeof(vector_t *));
+    if (!docs) {
+        printf("out of memory\n");
+        return 1;
+    }
+
+    iter = list_createiter(files);
+    while (list_hasnext(iter)) {
+        fullpath = concatenate_strings(2, root_dir, list_next(iter));
+        docs[n_docs] = vector_create((cmpfunc_t)strcmp);
+        tokenize_file(fullpath, docs[n_docs]);
+        n_tokens += vector_size(docs[n_docs++]);
+        free(fullpath);
+    }
+    list_destroyiter(iter);
+
+    if (n_tokens == 0) {
+        printf("ERROR: no tokens found in '%s'\n", root_dir);
+        return 1;
+    }
+    printf("%d files, %ld tokens\n", n_docs, n_tokens);
+
+    /* each pass builds its own words, whose docid sets the postings fill */
+    twopass = add_words(docs, n_docs, n_tokens, 0);
+    words = add_words(docs, n_docs, n_tokens, 1);
+    if (!twopass || !words) {
+        printf("out of memory\n");
+        return 1;
+    }
+    printf("%d unique words\n", set_size(words));
+
+    add_docids(twopass, docs, n_docs, n_tokens, 0);
+    add_docids(words, docs, n_docs, n_tokens, 1);
+
+    set_ops(words);
+
+    return 0;
+}
@@ -0,0 +1,736 @@
+/*
+ * B+-tree implementation of set.h.
+ *
+ * Elements are kept in order in leaves of up to LEAF_MAX elements, linked
+ * for iteration. Inner nodes hold up to INNER_MAX keys separating their
+ * children, where keys[i] is the first element below children[i + 1].
+ * Nodes span a few cache lines each, so a lookup touches a handful of
+ * nodes rather than one node per comparison, as in a binary tree.
+ *
+ * Full nodes are split on the way down as elements are added, so a split
+ * never has to propagate upwards. Nodes on the rightmost path are split
+ * unevenly when the element is added past their last one, which leaves
+ * them full when elements are added in ascending order.
+ * Sets produced by set operations are bulk loaded from sorted elements,
+ * filling the leaves and building the inner nodes bottom-up.
+ */
+
+#include "set.h"
+#include "printing.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define DEBUG_CHECKSET 0
+
+#define LEAF_MAX   16   // elements per leaf
+#define INNER_MAX  15   // keys per inner node, which has one more child
+
+typedef struct leaf leaf_t;
+
+struct leaf {
+    int     n;
+    leaf_t *next;
+    void   *elems[LEAF_MAX];
+};
+
+typedef struct inner {
+    int   n;
+    void *keys[INNER_MAX];
+    void *children[INNER_MAX + 1];   // inner nodes, or leaves at height 1
+} inner_t;
+
+struct set {
+    void     *root;     /* Root of the tree, a leaf at height 0 (NULL if empty) */
+    leaf_t   *first;    /* Head of the linked leaves */
+    leaf_t   *last;     /* Tail of the linked leaves */
+    int       height;
+    int       size;
+    int       refs;     /* References to the set, see set_retain */
+    cmpfunc_t cmpfunc;
+};
+
+struct set_iter {
+    set_t  *set;
+    leaf_t *leaf;       /* NULL when exhausted */
+    int     pos;
+};
+
+/* State of a set being bulk loaded */
+typedef struct builder {
+    set_t  *set;
+    leaf_t *last;
+    int     failed;
+} builder_t;
+
+
+/*
+ * Asserts that the leaves of a set are ordered, and hold all its elements.
+ */
+static void checkset(set_t *set) {
+    leaf_t *leaf;
+    void *prev = NULL;
+    int i, size = 0;
+
+    for (leaf = set->first; leaf; leaf = leaf->next) {
+        assert(leaf->n > 0 && leaf->n <= LEAF_MAX);
+        for (i = 0; i < leaf->n; i++) {
+            assert(!size || set->cmpfunc(prev, leaf->elems[i]) < 0);
+            prev = leaf->elems[i];
+            size++;
+        }
+    }
+    assert(size == set->size);
+}
+
+static leaf_t *newleaf() {
+    leaf_t *leaf = malloc(sizeof(leaf_t));
+    if (leaf == NULL) {
+        ERROR_PRINT("out of memory");
+        return NULL;
+    }
+    leaf->n = 0;
+    leaf->next = NULL;
+    return leaf;
+}
+
+static inner_t *newinner() {
+    inner_t *node = malloc(sizeof(inner_t));
+    if (node == NULL) {
+        ERROR_PRINT("out of memory");
+        return NULL;
+    }
+    node->n = 0;
+    return node;
+}
+
+/*
+ * Frees the inner nodes of the subtree of the given height. Leaves are
+ * freed through their links instead.
+ */
+static void freeinner(void *node, int height) {
+    inner_t *inner = node;
+    int i;
+
+    if (height == 0) {
+        return;
+    }
+    for (i = 0; i <= inner->n; i++) {
+        freeinner(inner->children[i], height - 1);
+    }
+    free(inner);
+}
+
+/*
+ * Returns the index of the first of the n elems which is not less than
+ * elem, and sets found if it is equal.
+ */
+static int lowerbound(void **elems, int n, void *elem, cmpfunc_t cmpfunc, int *found) {
+    int lo = 0, hi = n, mid, cmp;
+
+    *found = 0;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        cmp = cmpfunc(elems[mid], elem);
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            *found = (cmp == 0);
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/*
+ * Returns the index of the child of an inner node below which elem
+ * belongs, i.e. the number of keys not greater than elem.
+ */
+static int childindex(inner_t *node, void *elem, cmpfunc_t cmpfunc) {
+    int lo = 0, hi = node->n, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (cmpfunc(node->keys[mid], elem) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Returns the leaf below which elem belongs */
+static leaf_t *findleaf(set_t *set, void *elem) {
+    void *node = set->root;
+    int h;
+
+    for (h = set->height; h > 0; h--) {
+        node = ((inner_t *)node)->children[childindex(node, elem, set->cmpfunc)];
+    }
+    return node;
+}
+
+set_t *set_create(cmpfunc_t cmpfunc) {
+    set_t *set = malloc(sizeof(set_t));
+    if (set == NULL) {
+        ERROR_PRINT("out of memory");
+        goto end;
+    }
+
+    set->root = NULL;
+    set->first = NULL;
+    set->last = NULL;
+    set->height = 0;
+    set->size = 0;
+    set->refs = 1;
+    set->cmpfunc = cmpfunc;
+
+end:
+    return set;
+}
+
+void set_destroy(set_t *set) {
+    leaf_t *leaf = set->first;
+
+    if (__atomic_sub_fetch(&set->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+    if (set->root) {
+        freeinner(set->root, set->height);
+    }
+    while (leaf) {
+        leaf_t *tmp = leaf;
+        leaf = leaf->next;
+        free(tmp);
+    }
+    free(set);
+}
+
+set_t *set_retain(set_t *set) {
+    __atomic_add_fetch(&set->refs, 1, __ATOMIC_RELAXED);
+    return set;
+}
+
+set_t *set_unshare(set_t *set) {
+    set_t *copy;
+
+    if (__atomic_load_n(&set->refs, __ATOMIC_ACQUIRE) == 1) {
+        return set;
+    }
+    if ((copy = set_copy(set)) != NULL) {
+        set_destroy(set);
+    }
+    return copy;
+}
+
+int set_size(set_t *set) {
+    return set->size;
+}
+
+cmpfunc_t set_cmpfunc(set_t *set) {
+    return set->cmpfunc;
+}
+
+/* Returns 1 if the given node of the given height is full, otherwise 0 */
+static int isfull(void *node, int height) {
+    if (height == 0) {
+        return ((leaf_t *)node)->n == LEAF_MAX;
+    }
+    return ((inner_t *)node)->n == INNER_MAX;
+}
+
+/*
+ * Returns 1 if elem would be added past the last element below the given
+ * node (last child of an inner node), otherwise 0.
+ */
+static int ispast(void *node, int height, void *elem, cmpfunc_t cmpfunc) {
+    if (height == 0) {
+        leaf_t *leaf = node;
+        return cmpfunc(elem, leaf->elems[leaf->n - 1]) > 0;
+    }
+    inner_t *inner = node;
+    return cmpfunc(elem, inner->keys[inner->n - 1]) >= 0;
+}
+
+/*
+ * Splits the full child i of the given parent, which has room for another
+ * key. If appending, the child keeps all it can, as elem is to be added
+ * past its last element.
+ * Returns 0 on success, or -1 on failure.
+ */
+static int splitchild(set_t *set, inner_t *parent, int i, int height, void *elem, int appending) {
+    void *key, *right;
+    int keep;
+
+    if (height == 0) {
+        leaf_t *l = parent->children[i], *r = newleaf();
+        if (!r) {
+            return -1;
+        }
+        keep = appending ? LEAF_MAX : LEAF_MAX / 2;
+        r->n = LEAF_MAX - keep;
+        memcpy(r->elems, l->elems + keep, r->n * sizeof(void *));
+        l->n = keep;
+        r->next = l->next;
+        l->next = r;
+        if (r->next == NULL) {
+            set->last = r;
+        }
+
+        /* elem is the first element of an empty right leaf */
+        key = appending ? elem : r->elems[0];
+        right = r;
+    } else {
+        inner_t *l = parent->children[i], *r = newinner();
+        if (!r) {
+            return -1;
+        }
+        /* the key at keep moves up to the parent */
+        keep = appending ? INNER_MAX - 1 : INNER_MAX / 2;
+        key = l->keys[keep];
+        r->n = INNER_MAX - keep - 1;
+        memcpy(r->keys, l->keys + keep + 1, r->n * sizeof(void *));
+        memcpy(r->children, l->children + keep + 1, (r->n + 1) * sizeof(void *));
+        l->n = keep;
+        right = r;
+    }
+
+    memmove(parent->keys + i + 1, parent->keys + i, (parent->n - i) * sizeof(void *));
+    memmove(parent->children + i + 2, parent->children + i + 1, (parent->n - i) * sizeof(void *));
+    parent->keys[i] = key;
+    parent->children[i + 1] = right;
+    parent->n++;
+    return 0;
+}
+
+/*
+ * Adds elem in a single pass from the root, unless an equal element is
+ * found. If last, elem is known to be greater than all elements, and is
+ * appended along the rightmost path without comparisons.
+ * Returns the element of the set, or NULL on failure.
+ */
+static void *insert(set_t *set, void *elem, int last) {
+    cmpfunc_t cmpfunc = set->cmpfunc;
+    int h, i, found = 0, rightmost = 1;
+    inner_t *inner;
+    leaf_t *leaf;
+    void *node;
+
+    if (set->root == NULL) {
+        if (!(set->root = set->first = set->last = newleaf())) {
+            return NULL;
+        }
+    } else if (isfull(set->root, set->height)) {
+        /* grow a new root, and split the old one below it */
+        if (!(inner = newinner())) {
+            return NULL;
+        }
+        inner->children[0] = set->root;
+        set->root = inner;
+        set->height++;
+    }
+
+    node = set->root;
+    for (h = set->height; h > 0; h--) {
+        inner = node;
+        i = last ? inner->n : childindex(inner, elem, cmpfunc);
+        rightmost = rightmost && i == inner->n;
+
+        if (isfull(inner->children[i], h - 1)) {
+            int appending = rightmost && (last || ispast(inner->children[i], h - 1, elem, cmpfunc));
+            if (splitchild(set, inner, i, h - 1, elem, appending) < 0) {
+                return NULL;
+            }
+            if (last || cmpfunc(elem, inner->keys[i]) >= 0) {
+                i++;
+            }
+            rightmost = rightmost && i == inner->n;
+        }
+        node = inner->children[i];
+    }
+
+    leaf = node;
+    i = last ? leaf->n : lowerbound(leaf->elems, leaf->n, elem, cmpfunc, &found);
+    if (found) {
+        return leaf->elems[i];
+    }
+    memmove(leaf->elems + i + 1, leaf->elems + i, (leaf->n - i) * sizeof(void *));
+    leaf->elems[i] = elem;
+    leaf->n++;
+    set->size++;
+
+    if (DEBUG_CHECKSET) {
+        checkset(set);
+    }
+    return elem;
+}
+
+void *set_tryadd(set_t *set, void *elem) {
+    return insert(set, elem, 0);
+}
+
+void *set_tryadd_last(set_t *set, void *elem) {
+    leaf_t *leaf = set->last;
+    int cmp;
+
+    if (leaf == NULL) {
+        return insert(set, elem, 0);
+    }
+    cmp = set->cmpfunc(elem, leaf->elems[leaf->n - 1]);
+    if (cmp == 0) {
+        return leaf->elems[leaf->n - 1];
+    }
+    return insert(set, elem, cmp > 0);
+}
+
+void set_add(set_t *set, void *elem) {
+    set_tryadd(set, elem);
+}
+
+void *set_get(set_t *set, void *elem) {
+    leaf_t *leaf;
+    int i, found;
+
+    if (set->root == NULL) {
+        return NULL;
+    }
+    leaf = findleaf(set, elem);
+    i = lowerbound(leaf->elems, leaf->n, elem, set->cmpfunc, &found);
+    return found ? leaf->elems[i] : NULL;
+}
+
+int set_contains(set_t *set, void *elem) {
+    return set_get(set, elem) != NULL;
+}
+
+/* Appends an element, greater than all before it, to a set being bulk loaded */
+static void build_add(builder_t *b, void *elem) {
+    leaf_t *leaf;
+
+    if (b->failed) {
+        return;
+    }
+    if (!b->last || b->last->n == LEAF_MAX) {
+        if (!(leaf = newleaf())) {
+            b->failed = 1;
+            return;
+        }
+        if (b->last) {
+            b->last->next = leaf;
+        } else {
+            b->set->first = leaf;
+        }
+        b->last = b->set->last = leaf;
+    }
+    b->last->elems[b->last->n++] = elem;
+    b->set->size++;
+}
+
+/*
+ * Builds the inner nodes of a set being bulk loaded, level by level over
+ * its leaves. Returns the set, or NULL on failure.
+ */
+static set_t *build_finish(builder_t *b) {
+    set_t *set = b->set;
+    void **nodes = NULL, **mins = NULL;
+    int n = 0, m, i, j, k;
+    inner_t *inner;
+    leaf_t *leaf;
+
+    if (b->failed) {
+        goto error;
+    }
+
+    for (leaf = set->first; leaf; leaf = leaf->next) {
+        n++;
+    }
+    nodes = malloc((n + 1) * sizeof(void *));
+    mins = malloc((n + 1) * sizeof(void *));
+    if (!nodes || !mins) {
+        ERROR_PRINT("out of memory");
+        goto error;
+    }
+    for (i = 0, leaf = set->first; leaf; leaf = leaf->next, i++) {
+        nodes[i] = leaf;
+        mins[i] = leaf->elems[0];
+    }
+
+    /* group the nodes of each level under the nodes of the next */
+    while (n > 1) {
+        for (i = 0, m = 0; i < n; i += k, m++) {
+            k = (n - i < INNER_MAX + 1) ? n - i : INNER_MAX + 1;
+            if (!(inner = newinner())) {
+                /* free the new nodes, and those not yet grouped */
+                for (j = 0; j < m; j++) {
+                    freeinner(nodes[j], set->height + 1);
+                }
+                for (j = i; j < n; j++) {
+                    freeinner(nodes[j], set->height);
+                }
+                goto error;
+            }
+            inner->n = k - 1;
+            for (j = 0; j < k; j++) {
+                inner->children[j] = nodes[i + j];
+                if (j > 0) {
+                    inner->keys[j - 1] = mins[i + j];
+                }
+            }
+            nodes[m] = inner;
+            mins[m] = mins[i];
+        }
+        n = m;
+        set->height++;
+    }
+    set->root = n ? nodes[0] : NULL;
+
+    free(nodes);
+    free(mins);
+    if (DEBUG_CHECKSET) {
+        checkset(set);
+    }
+    return set;
+
+error:
+    free(nodes);
+    free(mins);
+    set->root = NULL;
+    set->height = 0;
+    set_destroy(set);
+    return NULL;
+}
+
+/* Starts bulk loading a new set. Returns 0 on success, or -1 on failure */
+static int build_start(builder_t *b, cmpfunc_t cmpfunc) {
+    b->set = set_create(cmpfunc);
+    b->last = NULL;
+    b->failed = 0;
+    return b->set ? 0 : -1;
+}
+
+set_t *set_union(set_t *a, set_t *b) {
+    set_iter_t ia = { a, a->first, 0 }, ib = { b, b->first, 0 };
+    void *ea, *eb;
+    builder_t bld;
+    int cmp;
+
+    if (a->cmpfunc != b->cmpfunc) {
+        /* See comment @ set_union in aatreeset.c */
+        DEBUG_PRINT("Warning: sets do not share cmpfunc, undefined behavior may occur.\n");
+    }
+    if (build_start(&bld, a->cmpfunc) < 0) {
+        return NULL;
+    }
+
+    ea = set_next(&ia);
+    eb = set_next(&ib);
+    while (ea && eb) {
+        cmp = a->cmpfunc(ea, eb);
+        if (cmp < 0) {
+            /* Occurs in a only */
+            build_add(&bld, ea);
+            ea = set_next(&ia);
+        } else if (cmp > 0) {
+            /* Occurs in b only */
+            build_add(&bld, eb);
+            eb = set_next(&ib);
+        } else {
+            /* Occurs in both a and b */
+            build_add(&bld, ea);
+            ea = set_next(&ia);
+            eb = set_next(&ib);
+        }
+    }
+
+    /* Plus what's left of the remaining set (either a or b) */
+    for (; ea; ea = set_next(&ia)) {
+        build_add(&bld, ea);
+    }
+    for (; eb; eb = set_next(&ib)) {
+        build_add(&bld, eb);
+    }
+
+    return build_finish(&bld);
+}
+
+set_t *set_intersection(set_t *a, set_t *b) {
+    set_iter_t ia = { a, a->first, 0 }, ib = { b, b->first, 0 };
+    void *ea, *eb;
+    builder_t bld;
+    int cmp;
+
+    if (a->cmpfunc != b->cmpfunc) {
+        DEBUG_PRINT("Warning: sets do not share cmpfunc, undefined behavior may occur.\n");
+    }
+    if (build_start(&bld, a->cmpfunc) < 0) {
+        return NULL;
+    }
+
+    ea = set_next(&ia);
+    eb = set_next(&ib);
+    while (ea && eb) {
+        cmp = a->cmpfunc(ea, eb);
+        if (cmp < 0) {
+            /* Occurs in a only */
+            set_skipto(&ia, eb);
+            ea = set_next(&ia);
+        } else if (cmp > 0) {
+            /* Occurs in b only */
+            set_skipto(&ib, ea);
+            eb = set_next(&ib);
+        } else {
+            /* Occurs in both a and b, keep this one */
+            build_add(&bld, ea);
+            ea = set_next(&ia);
+            eb = set_next(&ib);
+        }
+    }
+
+    return build_finish(&bld);
+}
+
+set_t *set_difference(set_t *a, set_t *b) {
+    set_iter_t ia = { a, a->first, 0 }, ib = { b, b->first, 0 };
+    void *ea, *eb;
+    builder_t bld;
+    int cmp;
+
+    if (a->cmpfunc != b->cmpfunc) {
+        DEBUG_PRINT("Warning: sets do not share cmpfunc, undefined behavior may occur.\n");
+    }
+    if (build_start(&bld, a->cmpfunc) < 0) {
+        return NULL;
+    }
+
+    ea = set_next(&ia);
+    eb = set_next(&ib);
+    while (ea && eb) {
+        cmp = a->cmpfunc(ea, eb);
+        if (cmp < 0) {
+            /* Occurs in a only, keep this one */
+            build_add(&bld, ea);
+            ea = set_next(&ia);
+        } else if (cmp > 0) {
+            /* Occurs in b only */
+            set_skipto(&ib, ea);
+            eb = set_next(&ib);
+        } else {
+            /* Occurs in both a and b */
+            ea = set_next(&ia);
+            eb = set_next(&ib);
+        }
+    }
+
+    /* Plus what's left of a */
+    for (; ea; ea = set_next(&ia)) {
+        build_add(&bld, ea);
+    }
+
+    return build_finish(&bld);
+}
+
+set_t *set_copy(set_t *set) {
+    builder_t bld;
+    leaf_t *leaf;
+    int i;
+
+    if (build_start(&bld, set->cmpfunc) < 0) {
+        return NULL;
+    }
+    for (leaf = set->first; leaf; leaf = leaf->next) {
+        for (i = 0; i < leaf->n; i++) {
+            build_add(&bld, leaf->elems[i]);
+        }
+    }
+    return build_finish(&bld);
+}
+
+set_t *set_from_sorted_array(void **elems, int n, cmpfunc_t cmpfunc) {
+    builder_t bld;
+    int i;
+
+    if (build_start(&bld, cmpfunc) < 0) {
+        return NULL;
+    }
+    for (i = 0; i < n; i++) {
+        build_add(&bld, elems[i]);
+    }
+    return build_finish(&bld);
+}
+
+set_iter_t *set_createiter(set_t *set) {
+    set_iter_t *iter = malloc(sizeof(set_iter_t));
+
+    if (iter == NULL) {
+        ERROR_PRINT("out of memory");
+        goto end;
+    }
+
+    iter->set = set;
+    iter->leaf = set->first;
+    iter->pos = 0;
+
+end:
+    return iter;
+}
+
+/* Fails to compile unless set_iterbuf_t can hold the iterator */
+typedef char iterbuf_fits[(sizeof(set_iter_t) <= sizeof(set_iterbuf_t)) ? 1 : -1];
+
+set_iter_t *set_inititer(set_iterbuf_t *buf, set_t *set) {
+    set_iter_t *iter = (set_iter_t *)buf;
+
+    iter->set = set;
+    iter->leaf = set->first;
+    iter->pos = 0;
+    return iter;
+}
+
+void set_destroyiter(set_iter_t *iter) {
+    free(iter);
+}
+
+int set_hasnext(set_iter_t *iter) {
+    return (iter->leaf == NULL) ? 0 : 1;
+}
+
+void *set_next(set_iter_t *iter) {
+    leaf_t *leaf = iter->leaf;
+    void *elem;
+
+    if (leaf == NULL) {
+        return NULL;
+    }
+    elem = leaf->elems[iter->pos++];
+    if (iter->pos == leaf->n) {
+        iter->leaf = leaf->next;
+        iter->pos = 0;
+    }
+    return elem;
+}
+
+void set_skipto(set_iter_t *iter, void *elem) {
+    cmpfunc_t cmpfunc = iter->set->cmpfunc;
+    leaf_t *leaf = iter->leaf;
+    int from = iter->pos, found;
+
+    if (leaf == NULL || cmpfunc(leaf->elems[from], elem) >= 0) {
+        return;
+    }
+
+    if (cmpfunc(leaf->elems[leaf->n - 1], elem) < 0) {
+        /* Beyond the current leaf. Find the leaf from the root; it lies ahead */
+        leaf = findleaf(iter->set, elem);
+        from = 0;
+    }
+
+    iter->pos = from + lowerbound(leaf->elems + from, leaf->n - from, elem, cmpfunc, &found);
+    iter->leaf = leaf;
+    if (iter->pos == leaf->n) {
+        iter->leaf = leaf->next;
+        iter->pos = 0;
+    }
+}
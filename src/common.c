@@ -7,6 +7,7 @@
 
 #include "common.h"
 #include "list.h"
+#include "vector.h"
 #include "printing.h"
 
 #include <string.h>
@@ -21,7 +22,7 @@
 #include <sys/time.h>
 #include <ctype.h>
 
-void tokenize_file(const char *filename, list_t *list) {
+void tokenize_file(const char *filename, vector_t *tokens) {
     FILE *fp;
     char *c, *word;
     char buf[101];
@@ -54,7 +55,7 @@ void tokenize_file(const char *filename, list_t *list) {
             ERROR_PRINT("out of memory");
         }
 
-        list_addlast(list, word);
+        vector_push(tokens, word);
     }
 
     fclose(fp);
@@ -0,0 +1,611 @@
+/*
+ * Pull based set operations.
+ * Each cursor implements next() and advance(target), and operator cursors
+ * are built from those of their operands:
+ *  - AND leapfrogs its operands towards a common element,
+ *  - OR merges the heads of its operands through a min-heap,
+ *  - ANDNOT filters its left operand against the head of its right operand.
+ *
+ * Chains of the same associative operator are flattened into a single
+ * n-ary cursor as they are built, e.g. `a OR b OR c` is one OR cursor with
+ * three operands, and `a ANDNOT b ANDNOT c` is `a ANDNOT (b OR c)`.
+ * That keeps the cursor tree shallow for long machine generated queries.
+ *
+ * Bitmap operands are not streamed: two bitmap cursors meeting in the same
+ * operator are combined there and then with word-level operations, into a
+ * single bitmap cursor owning the result.
+ */
+
+#include "cursor.h"
+#include "vector.h"
+#include "printing.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+
+typedef void *(*nextfunc_t)(cursor_t *);
+typedef void *(*advancefunc_t)(cursor_t *, void *);
+
+typedef enum cursor_types {
+    CUR_SET,
+    CUR_BITMAP,
+    CUR_AND,
+    CUR_OR,
+    CUR_ANDNOT
+} cursor_types_t;
+
+/* Head of an OR operand, kept in a min-heap */
+typedef struct or_head {
+    void     *elem;
+    cursor_t *op;
+} or_head_t;
+
+struct cursor {
+    cursor_types_t type;
+    nextfunc_t     next;
+    advancefunc_t  advance;
+    cmpfunc_t      cmpfunc;
+    int            depth;     // height of the cursor tree
+    int            size;      // upper bound on the number of elements
+    cursor_t     **ops;       // operands of operator cursors
+    int            n_ops;
+    int            max_ops;
+    or_head_t     *heap;      // OR: heads of the operands that are not exhausted
+    int            n_heap;
+    void          *head_b;    // ANDNOT: lookahead of the right operand
+    int            started;   // whether the lookahead has been initialized
+    set_iter_t    *iter;      // for set cursors, held in iter_buf
+    set_iterbuf_t  iter_buf;
+    roaring_t     *bits;      // for bitmap cursors
+    roaring_iter_t *bits_iter;
+    int            owns_bits;
+};
+
+
+static cursor_t *newcursor(cursor_types_t type, nextfunc_t next, advancefunc_t advance, cmpfunc_t cmpfunc) {
+    cursor_t *cur = calloc(1, sizeof(cursor_t));
+    if (!cur) {
+        ERROR_PRINT("out of memory");
+        return NULL;
+    }
+    cur->type = type;
+    cur->next = next;
+    cur->advance = advance;
+    cur->cmpfunc = cmpfunc;
+    cur->depth = 1;
+    return cur;
+}
+
+/*
+ * Appends the given operand to an operator cursor.
+ * Returns 0 on success, or -1 on failure.
+ */
+static int push_operand(cursor_t *cur, cursor_t *op) {
+    if (cur->n_ops == cur->max_ops) {
+        int max_ops = cur->max_ops ? 2 * cur->max_ops : 4;
+        cursor_t **ops = realloc(cur->ops, max_ops * sizeof(cursor_t *));
+        if (!ops) {
+            ERROR_PRINT("out of memory");
+            return -1;
+        }
+        cur->ops = ops;
+        cur->max_ops = max_ops;
+    }
+    cur->ops[cur->n_ops++] = op;
+
+    if (op->depth + 1 > cur->depth) {
+        cur->depth = op->depth + 1;
+    }
+    return 0;
+}
+
+static cursor_t *bitmap_cursor(roaring_t *bits, int owns_bits);
+
+/*
+ * Replaces bitmap cursors a and b by a bitmap cursor over the result of the
+ * given operator applied to their bitmaps.
+ * Returns NULL on failure, leaving a and b as they were.
+ */
+static cursor_t *combine_bitmaps(cursor_types_t type, cursor_t *a, cursor_t *b) {
+    roaring_t *bits;
+    cursor_t *cur = NULL;
+
+    if (type == CUR_AND) {
+        bits = roaring_and(a->bits, b->bits);
+    } else if (type == CUR_OR) {
+        bits = roaring_or(a->bits, b->bits);
+    } else {
+        bits = roaring_andnot(a->bits, b->bits);
+    }
+
+    if (!bits) {
+        return NULL;
+    }
+    cur = bitmap_cursor(bits, 1);
+    if (!cur) {
+        roaring_destroy(bits);
+        return NULL;
+    }
+    cursor_destroy(a);
+    cursor_destroy(b);
+    return cur;
+}
+
+/*
+ * Adds operand b to the n-ary operator cursor a, absorbing the operands
+ * of b if it is an operator of the same type.
+ * Returns 0 on success, or -1 on failure.
+ */
+static int absorb(cursor_t *a, cursor_t *b) {
+    int i;
+
+    if (b->type == CUR_BITMAP) {
+        for (i = 0; i < a->n_ops; i++) {
+            if (a->ops[i]->type == CUR_BITMAP) {
+                /* fold b into the bitmap operand of a */
+                cursor_t *op = combine_bitmaps(a->type, a->ops[i], b);
+                if (!op) {
+                    return -1;
+                }
+                a->ops[i] = op;
+                return 0;
+            }
+        }
+    }
+
+    if (b->type != a->type) {
+        return push_operand(a, b);
+    }
+
+    for (i = 0; i < b->n_ops; i++) {
+        if (push_operand(a, b->ops[i]) < 0) {
+            /* leave the remaining operands to b */
+            b->n_ops -= i;
+            memmove(b->ops, b->ops + i, b->n_ops * sizeof(cursor_t *));
+            return -1;
+        }
+    }
+    b->n_ops = 0;
+    cursor_destroy(b);
+    return 0;
+}
+
+/*
+ * Creates (or extends) an n-ary AND/OR cursor over a and b.
+ */
+static cursor_t *nary_operator(cursor_types_t type, nextfunc_t next, advancefunc_t advance, cursor_t *a, cursor_t *b) {
+    cursor_t *cur, *tmp;
+    int i;
+
+    if (!a || !b) {
+        goto error;
+    }
+
+    if (a->type == CUR_BITMAP && b->type == CUR_BITMAP) {
+        if (!(cur = combine_bitmaps(type, a, b))) {
+            goto error;
+        }
+        return cur;
+    }
+
+    if (b->type == type && a->type != type) {
+        /* both operators are commutative. extend b instead */
+        tmp = a;
+        a = b;
+        b = tmp;
+    }
+
+    if (a->type == type) {
+        cur = a;
+    } else {
+        cur = newcursor(type, next, advance, a->cmpfunc);
+        if (!cur) {
+            goto error;
+        }
+        if (push_operand(cur, a) < 0) {
+            cursor_destroy(cur);
+            goto error;
+        }
+    }
+
+    if (absorb(cur, b) < 0) {
+        cursor_destroy(cur);
+        cursor_destroy(b);
+        return NULL;
+    }
+
+    /* update the size estimate. AND leads with its smallest operand. */
+    cur->size = (type == CUR_AND) ? INT_MAX : 0;
+    for (i = 0; i < cur->n_ops; i++) {
+        if (type == CUR_AND) {
+            if (cur->ops[i]->size < cur->ops[0]->size) {
+                tmp = cur->ops[0];
+                cur->ops[0] = cur->ops[i];
+                cur->ops[i] = tmp;
+            }
+            cur->size = cur->ops[0]->size;
+        } else if (cur->size < INT_MAX - cur->ops[i]->size) {
+            cur->size += cur->ops[i]->size;
+        } else {
+            cur->size = INT_MAX;
+        }
+    }
+    return cur;
+
+error:
+    if (a) cursor_destroy(a);
+    if (b) cursor_destroy(b);
+    return NULL;
+}
+
+
+/* Set cursors */
+
+static void *set_cursor_next(cursor_t *cur) {
+    return set_next(cur->iter);
+}
+
+static void *set_cursor_advance(cursor_t *cur, void *target) {
+    set_skipto(cur->iter, target);
+    return set_next(cur->iter);
+}
+
+cursor_t *cursor_create_set(set_t *set) {
+    cursor_t *cur = newcursor(CUR_SET, set_cursor_next, set_cursor_advance, set_cmpfunc(set));
+    if (!cur) {
+        return NULL;
+    }
+
+    cur->iter = set_inititer(&cur->iter_buf, set);
+    cur->size = set_size(set);
+    return cur;
+}
+
+
+/* Bitmap cursors. Elements are the values of the bitmap, cast to pointers */
+
+static void *bitmap_cursor_next(cursor_t *cur) {
+    uint32_t value;
+
+    if (!roaring_next(cur->bits_iter, &value)) {
+        return NULL;
+    }
+    return (void *)(uintptr_t)value;
+}
+
+static void *bitmap_cursor_advance(cursor_t *cur, void *target) {
+    uint32_t value;
+
+    if (!roaring_advance(cur->bits_iter, (uint32_t)(uintptr_t)target, &value)) {
+        return NULL;
+    }
+    return (void *)(uintptr_t)value;
+}
+
+static cursor_t *bitmap_cursor(roaring_t *bits, int owns_bits) {
+    cursor_t *cur = newcursor(CUR_BITMAP, bitmap_cursor_next, bitmap_cursor_advance, compare_pointers);
+    if (!cur) {
+        return NULL;
+    }
+
+    cur->bits_iter = roaring_createiter(bits);
+    if (!cur->bits_iter) {
+        free(cur);
+        return NULL;
+    }
+    cur->bits = bits;
+    cur->owns_bits = owns_bits;
+    cur->size = roaring_size(bits);
+    return cur;
+}
+
+cursor_t *cursor_create_bitmap(roaring_t *bits) {
+    return bitmap_cursor(bits, 0);
+}
+
+
+/* AND cursors */
+
+/* Leapfrogs the operands from x (an element of ops[0]), until all agree on an element */
+static void *and_align(cursor_t *cur, void *x) {
+    void *y;
+    int i = 1, agree = 1;
+
+    while (x) {
+        if (agree == cur->n_ops) {
+            return x;
+        }
+
+        y = cursor_advance(cur->ops[i], x);
+        if (!y) {
+            return NULL;
+        }
+
+        if (cur->cmpfunc(x, y) == 0) {
+            agree++;
+        } else {
+            /* operand i is ahead. the others have to catch up with it */
+            x = y;
+            agree = 1;
+        }
+        i = (i + 1) % cur->n_ops;
+    }
+    return NULL;
+}
+
+static void *and_next(cursor_t *cur) {
+    return and_align(cur, cursor_next(cur->ops[0]));
+}
+
+static void *and_advance(cursor_t *cur, void *target) {
+    return and_align(cur, cursor_advance(cur->ops[0], target));
+}
+
+cursor_t *cursor_create_and(cursor_t *a, cursor_t *b) {
+    return nary_operator(CUR_AND, and_next, and_advance, a, b);
+}
+
+
+/* OR cursors */
+
+static void heap_siftdown(cursor_t *cur, int i) {
+    or_head_t *heap = cur->heap, tmp;
+    int child;
+
+    while ((child = 2 * i + 1) < cur->n_heap) {
+        if (child + 1 < cur->n_heap && cur->cmpfunc(heap[child + 1].elem, heap[child].elem) < 0) {
+            child++;
+        }
+        if (cur->cmpfunc(heap[child].elem, heap[i].elem) >= 0) {
+            break;
+        }
+        tmp = heap[i];
+        heap[i] = heap[child];
+        heap[child] = tmp;
+        i = child;
+    }
+}
+
+/* Replaces the head at the top of the heap, dropping its operand if exhausted */
+static void heap_replacetop(cursor_t *cur, void *elem) {
+    if (elem) {
+        cur->heap[0].elem = elem;
+    } else {
+        cur->heap[0] = cur->heap[--cur->n_heap];
+    }
+    heap_siftdown(cur, 0);
+}
+
+/* Fills the heap with the first element (not less than target) of each operand */
+static int or_start(cursor_t *cur, void *target) {
+    void *elem;
+    int i;
+
+    cur->heap = malloc(cur->n_ops * sizeof(or_head_t));
+    if (!cur->heap) {
+        ERROR_PRINT("out of memory");
+        return -1;
+    }
+
+    for (i = 0; i < cur->n_ops; i++) {
+        elem = target ? cursor_advance(cur->ops[i], target) : cursor_next(cur->ops[i]);
+        if (elem) {
+            cur->heap[cur->n_heap].elem = elem;
+            cur->heap[cur->n_heap].op = cur->ops[i];
+            cur->n_heap++;
+        }
+    }
+    for (i = cur->n_heap / 2 - 1; i >= 0; i--) {
+        heap_siftdown(cur, i);
+    }
+    cur->started = 1;
+    return 0;
+}
+
+/*
+ * Drops exhausted operands when only two remain. These are merged directly
+ * (see or_pop), without keeping them in heap order.
+ */
+static void pair_compact(cursor_t *cur) {
+    if (!cur->heap[1].elem) {
+        cur->n_heap--;
+    }
+    if (!cur->heap[0].elem) {
+        cur->heap[0] = cur->heap[--cur->n_heap];
+    }
+}
+
+/* Returns the smallest head, moving every operand positioned at it forward */
+static void *or_pop(cursor_t *cur) {
+    or_head_t *heap = cur->heap;
+    void *x;
+    int cmp;
+
+    if (!cur->n_heap) {
+        return NULL;
+    }
+
+    if (cur->n_heap == 2) {
+        /* the common case of a plain `a OR b`. a single comparison will do */
+        cmp = cur->cmpfunc(heap[0].elem, heap[1].elem);
+        x = (cmp <= 0) ? heap[0].elem : heap[1].elem;
+        if (cmp <= 0) {
+            heap[0].elem = cursor_next(heap[0].op);
+        }
+        if (cmp >= 0) {
+            heap[1].elem = cursor_next(heap[1].op);
+        }
+        pair_compact(cur);
+        return x;
+    }
+
+    x = cur->heap[0].elem;
+    while (cur->n_heap && cur->cmpfunc(cur->heap[0].elem, x) == 0) {
+        heap_replacetop(cur, cursor_next(cur->heap[0].op));
+    }
+    return x;
+}
+
+static void *or_next(cursor_t *cur) {
+    if (!cur->started && or_start(cur, NULL) < 0) {
+        return NULL;
+    }
+    return or_pop(cur);
+}
+
+static void *or_advance(cursor_t *cur, void *target) {
+    int i;
+
+    if (!cur->started) {
+        if (or_start(cur, target) < 0) {
+            return NULL;
+        }
+    } else if (cur->n_heap == 2) {
+        for (i = 0; i < 2; i++) {
+            if (cur->cmpfunc(cur->heap[i].elem, target) < 0) {
+                cur->heap[i].elem = cursor_advance(cur->heap[i].op, target);
+            }
+        }
+        pair_compact(cur);
+    } else {
+        while (cur->n_heap && cur->cmpfunc(cur->heap[0].elem, target) < 0) {
+            heap_replacetop(cur, cursor_advance(cur->heap[0].op, target));
+        }
+    }
+    return or_pop(cur);
+}
+
+cursor_t *cursor_create_or(cursor_t *a, cursor_t *b) {
+    return nary_operator(CUR_OR, or_next, or_advance, a, b);
+}
+
+
+/* ANDNOT cursors */
+
+/* Skips elements of a from x onwards, which are also found in b */
+static void *andnot_filter(cursor_t *cur, void *x) {
+    while (x) {
+        if (!cur->started) {
+            cur->head_b = cursor_advance(cur->ops[1], x);
+            cur->started = 1;
+        } else if (cur->head_b && cur->cmpfunc(cur->head_b, x) < 0) {
+            cur->head_b = cursor_advance(cur->ops[1], x);
+        }
+
+        if (!cur->head_b || cur->cmpfunc(cur->head_b, x) != 0) {
+            return x;
+        }
+        x = cursor_next(cur->ops[0]);
+    }
+    return NULL;
+}
+
+static void *andnot_next(cursor_t *cur) {
+    return andnot_filter(cur, cursor_next(cur->ops[0]));
+}
+
+static void *andnot_advance(cursor_t *cur, void *target) {
+    return andnot_filter(cur, cursor_advance(cur->ops[0], target));
+}
+
+cursor_t *cursor_create_andnot(cursor_t *a, cursor_t *b) {
+    cursor_t *cur;
+
+    if (!a || !b) {
+        goto error;
+    }
+
+    if (a->type == CUR_BITMAP && b->type == CUR_BITMAP) {
+        if (!(cur = combine_bitmaps(CUR_ANDNOT, a, b))) {
+            goto error;
+        }
+        return cur;
+    }
+
+    if (a->type == CUR_ANDNOT) {
+        /* (x ANDNOT y) ANDNOT b === x ANDNOT (y OR b) */
+        a->ops[1] = cursor_create_or(a->ops[1], b);
+        if (!a->ops[1]) {
+            a->n_ops = 1;
+            cursor_destroy(a);
+            return NULL;
+        }
+        if (a->ops[1]->depth + 1 > a->depth) {
+            a->depth = a->ops[1]->depth + 1;
+        }
+        return a;
+    }
+
+    cur = newcursor(CUR_ANDNOT, andnot_next, andnot_advance, a->cmpfunc);
+    if (!cur) {
+        goto error;
+    }
+    if (push_operand(cur, a) < 0) {
+        cursor_destroy(cur);
+        goto error;
+    }
+    if (push_operand(cur, b) < 0) {
+        cursor_destroy(cur);
+        cursor_destroy(b);
+        return NULL;
+    }
+    cur->size = a->size;
+    return cur;
+
+error:
+    if (a) cursor_destroy(a);
+    if (b) cursor_destroy(b);
+    return NULL;
+}
+
+
+/* Common functions */
+
+void cursor_destroy(cursor_t *cur) {
+    int i;
+
+    for (i = 0; i < cur->n_ops; i++) {
+        cursor_destroy(cur->ops[i]);
+    }
+    free(cur->ops);
+    free(cur->heap);
+    if (cur->bits_iter) roaring_destroyiter(cur->bits_iter);
+    if (cur->owns_bits) roaring_destroy(cur->bits);
+    free(cur);
+}
+
+void *cursor_next(cursor_t *cur) {
+    return cur->next(cur);
+}
+
+void *cursor_advance(cursor_t *cur, void *target) {
+    return cur->advance(cur, target);
+}
+
+int cursor_depth(cursor_t *cur) {
+    return cur->depth;
+}
+
+set_t *cursor_collect(cursor_t *cur) {
+    vector_t *elems = vector_create(cur->cmpfunc);
+    set_t *set = NULL;
+    void *elem;
+
+    if (!elems) {
+        return NULL;
+    }
+
+    /* elements come in ascending order, so the set is built in bulk */
+    while ((elem = cur->next(cur))) {
+        if (!vector_push(elems, elem)) {
+            goto end;
+        }
+    }
+    set = set_from_sorted_array(vector_elems(elems), vector_size(elems), cur->cmpfunc);
+
+end:
+    vector_destroy(elems);
+    return set;
+}
@@ -0,0 +1,394 @@
+/*
+ * LRU cache of static files for the HTTP server.
+ * Entries are found through a map keyed on path, and ordered in a
+ * doubly linked list from most to least recently used.
+ */
+
+#include "filecache.h"
+#include "map.h"
+#include "printing.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#define FILECACHE_MAX_INLINE     (64 * 1024)  // max size of files kept in memory
+#define FILECACHE_REVALIDATE_US  1000000      // min time between stat() of an entry
+#define FILECACHE_HEADER_MAXLEN  512
+#define FILECACHE_SEND_CHUNK     (64 * 1024)
+
+#define HTTP_DATE_FMT  "%a, %d %b %Y %H:%M:%S GMT"
+
+typedef struct fc_entry fc_entry_t;
+
+struct fc_entry {
+    char       *path;
+    int         fd;
+    off_t       size;
+    time_t      mtime;
+    ino_t       ino;
+    char        etag[64];
+    char       *header;       // precomputed 200 OK response header
+    int         header_len;
+    char       *body;         // file contents, if size <= FILECACHE_MAX_INLINE
+    size_t      cost;         // bytes accounted for by this entry
+    unsigned long long checked;  // time of the last stat(), in microseconds
+    int         refs;         // the cache holds one reference while the entry is cached
+    fc_entry_t *prev;         // more recently used
+    fc_entry_t *next;         // less recently used
+};
+
+struct filecache {
+    pthread_mutex_t lock;
+    map_t      *entries;     // path => fc_entry_t
+    fc_entry_t *mru;
+    fc_entry_t *lru;
+    size_t      bytes;
+    size_t      max_bytes;
+    int         n_entries;
+    int         max_entries;
+};
+
+
+filecache_t *filecache_create(size_t max_bytes, int max_entries) {
+    filecache_t *cache = malloc(sizeof(filecache_t));
+    if (cache == NULL) {
+        ERROR_PRINT("out of memory");
+        return NULL;
+    }
+
+    cache->entries = map_create(compare_strings, hash_string);
+    if (cache->entries == NULL) {
+        free(cache);
+        return NULL;
+    }
+
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->mru = NULL;
+    cache->lru = NULL;
+    cache->bytes = 0;
+    cache->max_bytes = max_bytes;
+    cache->n_entries = 0;
+    cache->max_entries = max_entries;
+
+    return cache;
+}
+
+static void entry_destroy(fc_entry_t *e) {
+    close(e->fd);
+    free(e->path);
+    free(e->header);
+    free(e->body);
+    free(e);
+}
+
+/* Drops a reference to the entry, destroying it when no references remain. */
+static void entry_release(fc_entry_t *e) {
+    if (--e->refs == 0) {
+        entry_destroy(e);
+    }
+}
+
+static void lru_unlink(filecache_t *cache, fc_entry_t *e) {
+    if (e->prev) {
+        e->prev->next = e->next;
+    } else {
+        cache->mru = e->next;
+    }
+
+    if (e->next) {
+        e->next->prev = e->prev;
+    } else {
+        cache->lru = e->prev;
+    }
+    e->prev = e->next = NULL;
+}
+
+static void lru_pushfront(filecache_t *cache, fc_entry_t *e) {
+    e->prev = NULL;
+    e->next = cache->mru;
+    if (cache->mru) {
+        cache->mru->prev = e;
+    } else {
+        cache->lru = e;
+    }
+    cache->mru = e;
+}
+
+/* Removes an entry from the cache. Threads currently sending it keep their reference. */
+static void cache_evict(filecache_t *cache, fc_entry_t *e) {
+    map_remove(cache->entries, e->path);
+    lru_unlink(cache, e);
+    cache->bytes -= e->cost;
+    cache->n_entries--;
+    entry_release(e);
+}
+
+void filecache_destroy(filecache_t *cache) {
+    while (cache->lru) {
+        cache_evict(cache, cache->lru);
+    }
+    map_destroy(cache->entries, NULL, NULL);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+/*
+ * Opens the file at the given path and creates an entry for it,
+ * with a precomputed response header. Returns NULL if the file
+ * is not a readable regular file.
+ */
+static fc_entry_t *entry_load(const char *path, const char *content_type) {
+    struct stat st;
+    struct tm tm;
+    char date[64];
+    fc_entry_t *e;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+
+    e = calloc(1, sizeof(fc_entry_t));
+    if (e == NULL) {
+        ERROR_PRINT("out of memory");
+        close(fd);
+        return NULL;
+    }
+
+    e->fd = fd;
+    e->size = st.st_size;
+    e->mtime = st.st_mtime;
+    e->ino = st.st_ino;
+    e->checked = gettime();
+    e->refs = 1;
+    e->path = strdup(path);
+    e->header = malloc(FILECACHE_HEADER_MAXLEN);
+
+    if (!e->path || !e->header) {
+        goto error;
+    }
+
+    snprintf(e->etag, sizeof(e->etag), "\"%lx-%llx-%llx\"",
+        (unsigned long)e->ino, (unsigned long long)e->size, (unsigned long long)e->mtime);
+
+    gmtime_r(&e->mtime, &tm);
+    strftime(date, sizeof(date), HTTP_DATE_FMT, &tm);
+
+    e->header_len = snprintf(e->header, FILECACHE_HEADER_MAXLEN,
+        "HTTP/1.0 200 OK\r\nContent-Type: %s\r\nContent-Length: %lld\r\n"
+        "ETag: %s\r\nLast-Modified: %s\r\n\r\n",
+        content_type, (long long)e->size, e->etag, date);
+
+    if (e->header_len >= FILECACHE_HEADER_MAXLEN) {
+        goto error;
+    }
+
+    /* Keep small files in memory */
+    if (e->size <= FILECACHE_MAX_INLINE) {
+        ssize_t n = 0, got;
+
+        e->body = malloc(e->size + 1);
+        if (!e->body) {
+            goto error;
+        }
+
+        while (n < e->size) {
+            got = pread(fd, e->body + n, e->size - n, n);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got <= 0) {
+                goto error;
+            }
+            n += got;
+        }
+    }
+
+    e->cost = sizeof(fc_entry_t) + e->header_len + (e->body ? (size_t)e->size : 0);
+
+    return e;
+
+error:
+    entry_destroy(e);
+    return NULL;
+}
+
+/*
+ * Returns 1 if the cached entry still reflects the file at its path.
+ * Only stats the file once every FILECACHE_REVALIDATE_US.
+ */
+static int entry_isfresh(fc_entry_t *e) {
+    struct stat st;
+    unsigned long long now = gettime();
+
+    if (now - e->checked < FILECACHE_REVALIDATE_US) {
+        return 1;
+    }
+
+    if (stat(e->path, &st) < 0 || st.st_ino != e->ino
+        || st.st_size != e->size || st.st_mtime != e->mtime) {
+        return 0;
+    }
+
+    e->checked = now;
+    return 1;
+}
+
+/*
+ * Returns a referenced entry for the given path, loading it if it is not cached.
+ * The caller must release the entry with entry_release (under the cache lock).
+ */
+static fc_entry_t *cache_get(filecache_t *cache, const char *path, const char *content_type) {
+    fc_entry_t *e;
+
+    pthread_mutex_lock(&cache->lock);
+
+    e = map_get(cache->entries, (void *)path);
+    if (e && !entry_isfresh(e)) {
+        cache_evict(cache, e);
+        e = NULL;
+    }
+
+    if (e) {
+        /* hit, move to front */
+        lru_unlink(cache, e);
+        lru_pushfront(cache, e);
+        e->refs++;
+        pthread_mutex_unlock(&cache->lock);
+        return e;
+    }
+
+    /* Loading is done without holding the lock. Another thread may load
+     * the same path concurrently, in which case the last one is kept. */
+    pthread_mutex_unlock(&cache->lock);
+
+    e = entry_load(path, content_type);
+    if (!e) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+
+    if (e->cost <= cache->max_bytes) {
+        fc_entry_t *old = map_get(cache->entries, e->path);
+        if (old) {
+            cache_evict(cache, old);
+        }
+
+        /* make room for the new entry */
+        while (cache->lru && (cache->n_entries >= cache->max_entries
+                              || cache->bytes + e->cost > cache->max_bytes)) {
+            cache_evict(cache, cache->lru);
+        }
+
+        map_put(cache->entries, e->path, e);
+        lru_pushfront(cache, e);
+        cache->bytes += e->cost;
+        cache->n_entries++;
+        e->refs++;
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+
+    /* the caller holds the initial reference */
+    return e;
+}
+
+/*
+ * Returns 1 if the given conditional request header values
+ * match the entry, i.e. the client already has this version.
+ */
+static int entry_notmodified(fc_entry_t *e, const char *if_none_match, const char *if_modified_since) {
+    struct tm tm;
+
+    /* If-None-Match takes precedence over If-Modified-Since */
+    if (if_none_match) {
+        return (strcmp(if_none_match, "*") == 0) || (strstr(if_none_match, e->etag) != NULL);
+    }
+
+    if (if_modified_since) {
+        memset(&tm, 0, sizeof(tm));
+        if (strptime(if_modified_since, HTTP_DATE_FMT, &tm) == NULL) {
+            return 0;
+        }
+        return e->mtime <= timegm(&tm);
+    }
+
+    return 0;
+}
+
+/* Sends the full contents of the entry's file on fd, without using any buffer of its own. */
+static int entry_sendbody(fc_entry_t *e, int fd) {
+    off_t off = 0;
+    ssize_t n;
+
+#ifdef __linux__
+    while (off < e->size) {
+        n = sendfile(fd, e->fd, &off, e->size - off);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+    }
+#else
+    char buf[FILECACHE_SEND_CHUNK];
+
+    while (off < e->size) {
+        n = pread(e->fd, buf, sizeof(buf), off);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0 || write(fd, buf, n) != n) {
+            return -1;
+        }
+        off += n;
+    }
+#endif
+    return 0;
+}
+
+int filecache_send(filecache_t *cache, FILE *f, const char *path, const char *content_type,
+                   const char *if_none_match, const char *if_modified_since) {
+    fc_entry_t *e = cache_get(cache, path, content_type);
+    if (!e) {
+        return -1;
+    }
+
+    if (entry_notmodified(e, if_none_match, if_modified_since)) {
+        fprintf(f, "HTTP/1.0 304 Not Modified\r\nETag: %s\r\n\r\n", e->etag);
+    } else {
+        fwrite(e->header, 1, e->header_len, f);
+
+        if (e->body) {
+            fwrite(e->body, 1, e->size, f);
+        } else {
+            fflush(f);
+            entry_sendbody(e, fileno(f));
+        }
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    entry_release(e);
+    pthread_mutex_unlock(&cache->lock);
+
+    return 0;
+}
@@ -0,0 +1,629 @@
+/*
+ * Minimal acyclic finite state transducer, built from sorted keys.
+ *
+ * States are compiled bottom-up while keys are added: once a key diverges
+ * from the previous one, the states on the previous path below the common
+ * prefix can not change, and are replaced by an equivalent state if one
+ * was compiled before (same finality, and same labels and targets). That
+ * shares suffixes, while the path itself shares prefixes.
+ *
+ * Compiled states are stored in arrays: the arcs of state s are
+ * first[s] .. first[s + 1] - 1, ordered by label. The output of an arc is
+ * the number of keys ordered before those reached through it, i.e. whether
+ * its source state is final, plus the keys reached through the preceding
+ * arcs. Summing the outputs along the path of a key gives its ordinal.
+ */
+
+#include "fst.h"
+#include "printing.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define FST_MAGIC    0x31545346  // "FST1"
+#define NO_STATE     UINT32_MAX
+
+struct fst {
+    int            n_keys;
+    int            n_states;
+    int            n_arcs;
+    int            max_len;   // length of the longest key
+    uint32_t       root;
+    uint32_t      *first;     // first arc of each state, and the end of the last state's arcs
+    unsigned char *final;     // whether each state accepts
+    unsigned char *labels;    // of each arc
+    uint32_t      *targets;   // of each arc
+    uint32_t      *outputs;   // of each arc
+};
+
+struct fst_iter {
+    fst_t         *fst;
+    int            depth;
+    int            pending;   // whether the state at depth has yet to be considered as a key
+    int            rank;      // ordinal of the next key
+    uint32_t      *states;    // states on the current path, by depth
+    uint32_t      *arcs;      // next arc to follow from each state on the path
+    char          *key;       // labels of the current path
+};
+
+/* A state on the path of the last key added, yet to be compiled */
+typedef struct pending {
+    int            final;
+    int            n_arcs;
+    unsigned char  labels[256];
+    uint32_t       targets[256];  // the target of the last arc is the next pending state
+} pending_t;
+
+/* State of an fst while it is built */
+typedef struct builder {
+    fst_t         *fst;
+    int            max_states;
+    int            max_arcs;
+    uint32_t      *counts;    // number of keys accepted from each compiled state
+    uint32_t      *hashes;    // of each compiled state
+    uint32_t      *table;     // open addressing table of compiled states
+    uint32_t       table_size;
+} builder_t;
+
+/* State of a fuzzy search */
+typedef struct fuzzy {
+    fst_t         *fst;
+    const char    *key;
+    int            len;
+    int            max_dist;
+    int           *rows;      // one row of edit distances per depth
+    int           *ordinals;
+    int            max_ordinals;
+    int            n_matches;
+} fuzzy_t;
+
+
+/******************************************************************************
+ *                                 Building                                   *
+ ******************************************************************************/
+
+static uint32_t hash_pending(pending_t *p) {
+    uint32_t h = 2166136261u ^ p->final;
+    int i;
+
+    for (i = 0; i < p->n_arcs; i++) {
+        h = (h ^ p->labels[i]) * 16777619u;
+        h = (h ^ p->targets[i]) * 16777619u;
+    }
+    return h;
+}
+
+/* Returns 1 if the compiled state s is equivalent to the pending state p */
+static int same_state(fst_t *fst, uint32_t s, pending_t *p) {
+    uint32_t a = fst->first[s];
+    int i;
+
+    if (fst->final[s] != p->final || (int)(fst->first[s + 1] - a) != p->n_arcs) {
+        return 0;
+    }
+    for (i = 0; i < p->n_arcs; i++, a++) {
+        if (fst->labels[a] != p->labels[i] || fst->targets[a] != p->targets[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Doubles the table of compiled states, rehashing them.
+ * Returns 0 on success, or -1 on failure.
+ */
+static int grow_table(builder_t *b) {
+    uint32_t size = b->table_size ? 2 * b->table_size : 1024;
+    uint32_t *table = malloc(size * sizeof(uint32_t));
+    uint32_t s, i;
+
+    if (!table) {
+        return -1;
+    }
+    memset(table, 0xff, size * sizeof(uint32_t));
+
+    for (s = 0; s < (uint32_t)b->fst->n_states; s++) {
+        for (i = b->hashes[s] & (size - 1); table[i] != NO_STATE; i = (i + 1) & (size - 1));
+        table[i] = s;
+    }
+
+    free(b->table);
+    b->table = table;
+    b->table_size = size;
+    return 0;
+}
+
+/*
+ * Makes room for one more state with n_arcs arcs.
+ * Returns 0 on success, or -1 on failure.
+ */
+static int reserve_state(builder_t *b, int n_arcs) {
+    fst_t *fst = b->fst;
+
+    if (fst->n_states + 1 >= b->max_states) {
+        int max = b->max_states ? 2 * b->max_states : 1024;
+        void *first = realloc(fst->first, (max + 1) * sizeof(uint32_t));
+        if (first) fst->first = first;
+        void *final = realloc(fst->final, max);
+        if (final) fst->final = final;
+        void *counts = realloc(b->counts, max * sizeof(uint32_t));
+        if (counts) b->counts = counts;
+        void *hashes = realloc(b->hashes, max * sizeof(uint32_t));
+        if (hashes) b->hashes = hashes;
+
+        if (!first || !final || !counts || !hashes) {
+            return -1;
+        }
+        b->max_states = max;
+    }
+
+    if (fst->n_arcs + n_arcs > b->max_arcs) {
+        int max = b->max_arcs ? 2 * b->max_arcs : 4096;
+        void *labels = realloc(fst->labels, max);
+        if (labels) fst->labels = labels;
+        void *targets = realloc(fst->targets, max * sizeof(uint32_t));
+        if (targets) fst->targets = targets;
+        void *outputs = realloc(fst->outputs, max * sizeof(uint32_t));
+        if (outputs) fst->outputs = outputs;
+
+        if (!labels || !targets || !outputs) {
+            return -1;
+        }
+        b->max_arcs = max;
+    }
+
+    if (2 * (uint32_t)(fst->n_states + 1) > b->table_size) {
+        return grow_table(b);
+    }
+    return 0;
+}
+
+/*
+ * Compiles the given pending state, unless an equivalent state exists.
+ * Returns the compiled state, or NO_STATE on failure.
+ */
+static uint32_t compile(builder_t *b, pending_t *p) {
+    fst_t *fst = b->fst;
+    uint32_t h = hash_pending(p), i, s, count;
+    int k;
+
+    if (reserve_state(b, p->n_arcs) < 0) {
+        return NO_STATE;
+    }
+
+    for (i = h & (b->table_size - 1); b->table[i] != NO_STATE; i = (i + 1) & (b->table_size - 1)) {
+        if (b->hashes[b->table[i]] == h && same_state(fst, b->table[i], p)) {
+            return b->table[i];
+        }
+    }
+
+    s = fst->n_states++;
+    b->table[i] = s;
+    b->hashes[s] = h;
+    fst->final[s] = p->final;
+    fst->first[s] = fst->n_arcs;
+
+    count = p->final;
+    for (k = 0; k < p->n_arcs; k++, fst->n_arcs++) {
+        fst->labels[fst->n_arcs] = p->labels[k];
+        fst->targets[fst->n_arcs] = p->targets[k];
+        fst->outputs[fst->n_arcs] = count;
+        count += b->counts[p->targets[k]];
+    }
+    b->counts[s] = count;
+    fst->first[s + 1] = fst->n_arcs;
+
+    return s;
+}
+
+/*
+ * Compiles the pending states of the path below the given depth, down to
+ * (and including) depth 'to'. Each is set as the target of the last arc of
+ * its parent. Returns 0 on success, or -1 on failure.
+ */
+static int compile_path(builder_t *b, pending_t *path, int from, int to) {
+    uint32_t s;
+    int d;
+
+    for (d = from; d >= to; d--) {
+        if ((s = compile(b, &path[d])) == NO_STATE) {
+            return -1;
+        }
+        path[d - 1].targets[path[d - 1].n_arcs - 1] = s;
+    }
+    return 0;
+}
+
+/*
+ * Releases the slack of the arrays of a built fst.
+ * The arrays are left as they are if they can not be reallocated.
+ */
+static void shrink(fst_t *fst) {
+    size_t n_arcs = fst->n_arcs ? fst->n_arcs : 1;
+    void *p;
+
+    if ((p = realloc(fst->labels, n_arcs))) fst->labels = p;
+    if ((p = realloc(fst->targets, n_arcs * sizeof(uint32_t)))) fst->targets = p;
+    if ((p = realloc(fst->outputs, n_arcs * sizeof(uint32_t)))) fst->outputs = p;
+    if ((p = realloc(fst->first, (fst->n_states + 1) * sizeof(uint32_t)))) fst->first = p;
+    if ((p = realloc(fst->final, fst->n_states))) fst->final = p;
+}
+
+fst_t *fst_build(char **keys, int n_keys) {
+    builder_t b = { NULL, 0, 0, NULL, NULL, NULL, 0 };
+    pending_t *path = NULL;
+    const char *prev = "";
+    int i, d, len, prev_len = 0, common, max_len = 0;
+    uint32_t root;
+
+    for (i = 0; i < n_keys; i++) {
+        len = strlen(keys[i]);
+        if (len > max_len) {
+            max_len = len;
+        }
+        if (i && strcmp(keys[i - 1], keys[i]) >= 0) {
+            ERROR_PRINT("fst keys must be unique and sorted");
+            return NULL;
+        }
+    }
+
+    b.fst = calloc(1, sizeof(fst_t));
+    path = malloc((max_len + 1) * sizeof(pending_t));
+    if (!b.fst || !path) {
+        goto error;
+    }
+    b.fst->max_len = max_len;
+    path[0].final = 0;
+    path[0].n_arcs = 0;
+
+    for (i = 0; i < n_keys; i++) {
+        len = strlen(keys[i]);
+        for (common = 0; common < len && common < prev_len && prev[common] == keys[i][common]; common++);
+
+        /* the previous path below the common prefix is complete */
+        if (compile_path(&b, path, prev_len, common + 1) < 0) {
+            goto error;
+        }
+
+        /* extend the path with the rest of the key */
+        for (d = common; d < len; d++) {
+            path[d].labels[path[d].n_arcs] = keys[i][d];
+            path[d].targets[path[d].n_arcs] = NO_STATE;
+            path[d].n_arcs++;
+            path[d + 1].final = 0;
+            path[d + 1].n_arcs = 0;
+        }
+        path[len].final = 1;
+
+        prev = keys[i];
+        prev_len = len;
+    }
+
+    if (compile_path(&b, path, prev_len, 1) < 0 || (root = compile(&b, &path[0])) == NO_STATE) {
+        goto error;
+    }
+
+    b.fst->root = root;
+    b.fst->n_keys = n_keys;
+    free(b.counts);
+    free(b.hashes);
+    free(b.table);
+    free(path);
+
+    shrink(b.fst);
+    return b.fst;
+
+error:
+    ERROR_PRINT("out of memory");
+    if (b.fst) fst_destroy(b.fst);
+    free(b.counts);
+    free(b.hashes);
+    free(b.table);
+    free(path);
+    return NULL;
+}
+
+void fst_destroy(fst_t *fst) {
+    free(fst->first);
+    free(fst->final);
+    free(fst->labels);
+    free(fst->targets);
+    free(fst->outputs);
+    free(fst);
+}
+
+int fst_size(fst_t *fst) {
+    return fst->n_keys;
+}
+
+
+/******************************************************************************
+ *                                  Lookups                                   *
+ ******************************************************************************/
+
+/* Returns the first arc of state s with a label not less than c */
+static uint32_t lower_arc(fst_t *fst, uint32_t s, unsigned char c) {
+    uint32_t lo = fst->first[s], hi = fst->first[s + 1], mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (fst->labels[mid] < c) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Returns the number of keys accepted from state s */
+static int count_keys(fst_t *fst, uint32_t s) {
+    int count = 0;
+
+    /* the last arc leads to the keys after all others */
+    while (fst->first[s + 1] > fst->first[s]) {
+        count += fst->outputs[fst->first[s + 1] - 1];
+        s = fst->targets[fst->first[s + 1] - 1];
+    }
+    return count + fst->final[s];
+}
+
+int fst_get(fst_t *fst, const char *key) {
+    const unsigned char *c = (const unsigned char *)key;
+    uint32_t s = fst->root, a;
+    int ordinal = 0;
+
+    for (; *c; c++) {
+        a = lower_arc(fst, s, *c);
+        if (a == fst->first[s + 1] || fst->labels[a] != *c) {
+            return -1;
+        }
+        ordinal += fst->outputs[a];
+        s = fst->targets[a];
+    }
+    return fst->final[s] ? ordinal : -1;
+}
+
+fst_iter_t *fst_createiter(fst_t *fst, const char *from) {
+    const unsigned char *c = (const unsigned char *)(from ? from : "");
+    fst_iter_t *iter = malloc(sizeof(fst_iter_t));
+    uint32_t s, a;
+    int d = 0;
+
+    if (!iter) {
+        ERROR_PRINT("out of memory");
+        return NULL;
+    }
+    iter->states = malloc((fst->max_len + 1) * sizeof(uint32_t));
+    iter->arcs = malloc((fst->max_len + 1) * sizeof(uint32_t));
+    iter->key = malloc(fst->max_len + 1);
+    if (!iter->states || !iter->arcs || !iter->key) {
+        ERROR_PRINT("out of memory");
+        fst_destroyiter(iter);
+        return NULL;
+    }
+    iter->fst = fst;
+    iter->rank = 0;
+    iter->states[0] = s = fst->root;
+
+    /* follow 'from' for as long as there are arcs for it */
+    for (;;) {
+        if (!*c) {
+            /* the state reached is 'from' itself, followed by its extensions */
+            iter->arcs[d] = fst->first[s];
+            iter->pending = 1;
+            break;
+        }
+
+        a = lower_arc(fst, s, *c);
+        if (a < fst->first[s + 1] && fst->labels[a] == *c) {
+            iter->rank += fst->outputs[a];
+            iter->arcs[d] = a + 1;
+            iter->key[d++] = *c++;
+            iter->states[d] = s = fst->targets[a];
+            continue;
+        }
+
+        /* every key through the remaining arcs is greater than 'from' */
+        iter->rank += (a < fst->first[s + 1]) ? (int)fst->outputs[a] : count_keys(fst, s);
+        iter->arcs[d] = a;
+        iter->pending = 0;
+        break;
+    }
+    iter->depth = d;
+
+    return iter;
+}
+
+void fst_destroyiter(fst_iter_t *iter) {
+    free(iter->states);
+    free(iter->arcs);
+    free(iter->key);
+    free(iter);
+}
+
+char *fst_next(fst_iter_t *iter, int *ordinal) {
+    fst_t *fst = iter->fst;
+    uint32_t s, a;
+
+    for (;;) {
+        s = iter->states[iter->depth];
+        if (iter->pending) {
+            /* a key is ordered before any of its extensions */
+            iter->pending = 0;
+            if (fst->final[s]) {
+                iter->key[iter->depth] = '\0';
+                *ordinal = iter->rank++;
+                return iter->key;
+            }
+        }
+
+        a = iter->arcs[iter->depth];
+        if (a < fst->first[s + 1]) {
+            /* descend through the next arc */
+            iter->arcs[iter->depth] = a + 1;
+            iter->key[iter->depth++] = fst->labels[a];
+            iter->states[iter->depth] = fst->targets[a];
+            iter->arcs[iter->depth] = fst->first[fst->targets[a]];
+            iter->pending = 1;
+        } else if (iter->depth > 0) {
+            iter->depth--;
+        } else {
+            return NULL;
+        }
+    }
+}
+
+/*
+ * Steps a Levenshtein automaton for the key through the given arc, from the
+ * row of its source state at depth - 1, and continues with the arcs of its
+ * target state if any entry of the new row is within the maximum distance.
+ * Keys extending the path can not bring the row back down, so the search
+ * is pruned as soon as this is not the case.
+ * Recursion is bounded by the length of the longest key.
+ */
+static void fuzzy_visit(fuzzy_t *f, uint32_t arc, int depth, int ordinal) {
+    fst_t *fst = f->fst;
+    unsigned char label = fst->labels[arc];
+    uint32_t s = fst->targets[arc], a;
+    int *prev = f->rows + (depth - 1) * (f->len + 1);
+    int *row = prev + (f->len + 1);
+    int j, dist, min;
+
+    ordinal += fst->outputs[arc];
+
+    /* row[j] is the distance between the path so far and key[0..j) */
+    row[0] = min = depth;
+    for (j = 1; j <= f->len; j++) {
+        dist = prev[j - 1] + ((unsigned char)f->key[j - 1] != label);  // substitution
+        if (prev[j] + 1 < dist) {
+            dist = prev[j] + 1;                                       // insertion
+        }
+        if (row[j - 1] + 1 < dist) {
+            dist = row[j - 1] + 1;                                    // deletion
+        }
+        row[j] = dist;
+        if (dist < min) {
+            min = dist;
+        }
+    }
+
+    if (min > f->max_dist) {
+        return;
+    }
+    if (fst->final[s] && row[f->len] <= f->max_dist) {
+        if (f->n_matches < f->max_ordinals) {
+            f->ordinals[f->n_matches] = ordinal;
+        }
+        f->n_matches++;
+    }
+
+    for (a = fst->first[s]; a < fst->first[s + 1] && f->n_matches <= f->max_ordinals; a++) {
+        fuzzy_visit(f, a, depth + 1, ordinal);
+    }
+}
+
+int fst_fuzzy(fst_t *fst, const char *key, int max_dist, int *ordinals, int max_ordinals) {
+    fuzzy_t f;
+    uint32_t a;
+    int j;
+
+    f.fst = fst;
+    f.key = key;
+    f.len = strlen(key);
+    f.max_dist = max_dist;
+    f.ordinals = ordinals;
+    f.max_ordinals = max_ordinals;
+    f.n_matches = 0;
+
+    f.rows = malloc((size_t)(fst->max_len + 1) * (f.len + 1) * sizeof(int));
+    if (!f.rows) {
+        ERROR_PRINT("out of memory");
+        return -1;
+    }
+
+    /* the initial row: the empty path is j deletions away from key[0..j) */
+    for (j = 0; j <= f.len; j++) {
+        f.rows[j] = j;
+    }
+    if (fst->final[fst->root] && f.len <= max_dist) {
+        if (max_ordinals > 0) {
+            ordinals[0] = 0;
+        }
+        f.n_matches++;
+    }
+
+    for (a = fst->first[fst->root]; a < fst->first[fst->root + 1] && f.n_matches <= max_ordinals; a++) {
+        fuzzy_visit(&f, a, 1, 0);
+    }
+
+    free(f.rows);
+    return f.n_matches;
+}
+
+
+/******************************************************************************
+ *                               Serialization                                *
+ ******************************************************************************/
+
+int fst_save(fst_t *fst, FILE *file) {
+    int32_t header[6] = {
+        FST_MAGIC, fst->n_keys, fst->n_states, fst->n_arcs, fst->max_len, fst->root
+    };
+    size_t n_states = fst->n_states, n_arcs = fst->n_arcs;
+
+    if (fwrite(header, sizeof(header), 1, file) != 1
+        || fwrite(fst->first, sizeof(uint32_t), n_states + 1, file) != n_states + 1
+        || fwrite(fst->final, 1, n_states, file) != n_states
+        || fwrite(fst->labels, 1, n_arcs, file) != n_arcs
+        || fwrite(fst->targets, sizeof(uint32_t), n_arcs, file) != n_arcs
+        || fwrite(fst->outputs, sizeof(uint32_t), n_arcs, file) != n_arcs) {
+        ERROR_PRINT("failed to write fst");
+        return -1;
+    }
+    return 0;
+}
+
+fst_t *fst_load(FILE *file) {
+    int32_t header[6];
+    size_t n_states, n_arcs;
+    fst_t *fst;
+
+    if (fread(header, sizeof(header), 1, file) != 1 || header[0] != FST_MAGIC
+        || header[2] < 1 || header[3] < 0 || header[4] < 0 || header[5] < 0 || header[5] >= header[2]) {
+        ERROR_PRINT("not an fst");
+        return NULL;
+    }
+
+    fst = calloc(1, sizeof(fst_t));
+    if (!fst) {
+        ERROR_PRINT("out of memory");
+        return NULL;
+    }
+    fst->n_keys = header[1];
+    fst->n_states = header[2];
+    fst->n_arcs = header[3];
+    fst->max_len = header[4];
+    fst->root = header[5];
+    n_states = fst->n_states;
+    n_arcs = fst->n_arcs;
+
+    fst->first = malloc((n_states + 1) * sizeof(uint32_t));
+    fst->final = malloc(n_states);
+    fst->labels = malloc(n_arcs ? n_arcs : 1);
+    fst->targets = malloc((n_arcs ? n_arcs : 1) * sizeof(uint32_t));
+    fst->outputs = malloc((n_arcs ? n_arcs : 1) * sizeof(uint32_t));
+    if (!fst->first || !fst->final || !fst->labels || !fst->targets || !fst->outputs
+        || fread(fst->first, sizeof(uint32_t), n_states + 1, file) != n_states + 1
+        || fread(fst->final, 1, n_states, file) != n_states
+        || fread(fst->labels, 1, n_arcs, file) != n_arcs
+        || fread(fst->targets, sizeof(uint32_t), n_arcs, file) != n_arcs
+        || fread(fst->outputs, sizeof(uint32_t), n_arcs, file) != n_arcs) {
+        ERROR_PRINT("failed to read fst");
+        fst_destroy(fst);
+        return NULL;
+    }
+    return fst;
+}
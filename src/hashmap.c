@@ -140,6 +140,28 @@ void map_put(map_t *map, void *key, void *value) {
     }
 }
 
+void *map_remove(map_t *map, void *key) {
+    unsigned long hash = map->hashfunc(key);
+    int b = hash % map->numbuckets;
+    mapentry_t **e = &map->buckets[b];
+
+    while (*e != NULL && map->cmpfunc(key, (*e)->key) != 0) {
+        e = &(*e)->next;
+    }
+
+    if (*e == NULL) {
+        return NULL;
+    }
+
+    mapentry_t *tmp = *e;
+    void *value = tmp->value;
+    *e = tmp->next;
+    map->size--;
+    free(tmp);
+
+    return value;
+}
+
 int map_haskey(map_t *map, void *key) {
     unsigned long hash = map->hashfunc(key);
     int b = hash % map->numbuckets;
@@ -6,23 +6,26 @@
  */
 
 #include "httpd.h"
-#include "list.h"
 #include "printing.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <ctype.h>
 #include <errno.h>
 #include <signal.h>
 #include <sys/types.h>
+#include <sys/select.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <fcntl.h>
 #include <pthread.h>
 
 #define MAX_THREADS 50
+#define HTTP_BUFSIZE 8192   // max size of request line, header and body
+#define HTTP_MAX_ARGS 16
 
 static int server_is_running = 1;
 
@@ -41,35 +44,6 @@ static char *newstring(int length) {
     return r;
 }
 
-static char *stripstring(char *s, int len) {
-    char *r;
-    char *end = s+len-1;
-
-    while (end >= s && isspace((int)*end)) {
-        end--;
-    }
-
-    while (s <= end && isspace((int)*s)) {
-        s++;
-    }
-
-    r = newstring(end-s+1);
-    strncpy(r, s, end-s+1);
-    return r;
-}
-
-static int splitstring(char *s, int sep, char **left, char **right) {
-    char *p = strchr(s, sep);
-
-    if (p == NULL) {
-        return 0;
-    }
-
-    *left = stripstring(s, p-s);
-    *right = stripstring(p+1, strlen(p+1));
-    return 1;
-}
-
 static int hexdigit(char ch) {
     if (ch >= '0' && ch <= '9')
         return ch-'0';
@@ -82,31 +56,6 @@ static int hexdigit(char ch) {
     return -1;
 }
 
-static char *urldecode(char *s) {
-    char *r, *p;
-
-    r = p = newstring(strlen(s));
-
-    for (;;) {
-        int ch = *s++;
-        switch(ch) {
-        case 0:
-            return r;
-        case '+':
-            *p++ = ' ';
-            break;
-        case '%':
-            *p = hexdigit(*s++) * 16;
-            *p += hexdigit(*s++);
-            p++;
-            break;
-        default:
-            *p++ = ch;
-            break;
-        }
-    }
-}
-
 char *html_escape(char *s) {
     char *r, *p;
     r = p = newstring(strlen(s)*6);
@@ -155,248 +104,324 @@ typedef enum http_methods {
     HTTP_POST
 } http_method_t;
 
-struct http_header {
-    http_method_t method;
-    char *path;
-    map_t *header_fields;
-    map_t *query_fields;
+/*
+ * Header fields kept by the parser. Any field not listed here is skipped
+ * while parsing, and never stored.
+ */
+typedef enum http_fields {
+    FIELD_CONTENT_LENGTH,
+    FIELD_IF_NONE_MATCH,
+    FIELD_IF_MODIFIED_SINCE,
+    NUM_FIELDS
+} http_field_t;
+
+static const char *header_names[NUM_FIELDS] = {
+    "Content-Length",
+    "If-None-Match",
+    "If-Modified-Since",
 };
 
+struct http_arg {
+    char *key;
+    char *value;
+    int   decoded;  // whether value has been url decoded (in place)
+};
 
-static int http_parse_query(char *query, map_t *fields) {
-    char *buf, *p, *tmp, *key, *value;
-    buf = query;
-
-    while (buf) {
-        if ((p = strchr(buf, '&'))) {
-            *p = 0;
-        } else {
-            p = NULL;
-        }
-
-        if (splitstring(buf, '=', &key, &value)) {
-            tmp = key;
-            key = urldecode(tmp);
-            free(tmp);
+/*
+ * A request is parsed in place within its receive buffer. The request line,
+ * header fields and arguments are NUL terminated slices of ->buf.
+ */
+struct http_request {
+    http_method_t   method;
+    char           *path;
+    char           *fields[NUM_FIELDS];
+    int             n_args;
+    struct http_arg args[HTTP_MAX_ARGS];
+    int             len;
+    char            buf[HTTP_BUFSIZE + 1];
+};
 
-            tmp = value;
-            value = urldecode(tmp);
-            free(tmp);
 
-            map_put(fields, key, value);
-        } else {
-            key = newstring(strlen(buf));
-            strcpy(key, buf);
-            value = "";
-            map_put(fields, key, value);
-        }
+/*
+ * Decodes the given string in place, returns it.
+ * Malformed escape sequences are left untouched.
+ */
+static char *urldecode(char *s) {
+    char *r = s, *p = s;
 
-        if (p) {
-            *p++ = '&';
+    for (;;) {
+        int ch = *s++;
+        switch(ch) {
+        case 0:
+            *p = 0;
+            return r;
+        case '+':
+            *p++ = ' ';
+            break;
+        case '%':
+            if (isxdigit((unsigned char)s[0]) && isxdigit((unsigned char)s[1])) {
+                *p++ = hexdigit(s[0]) * 16 + hexdigit(s[1]);
+                s += 2;
+            } else {
+                *p++ = ch;
+            }
+            break;
+        default:
+            *p++ = ch;
+            break;
         }
-
-        buf = p;
     }
-
-    return 0;
 }
 
-static void http_destroy_header(struct http_header *hdr) {
-    if (hdr->path) {
-        free(hdr->path);
-        hdr->path = NULL;
+/* Strips leading and trailing whitespace in place. Returns the new start of s. */
+static char *strip(char *s, char *end) {
+    while (end > s && isspace((unsigned char)end[-1])) {
+        end--;
     }
+    *end = 0;
 
-    if (hdr->header_fields) {
-        map_destroy(hdr->header_fields, free, free);
-        hdr->header_fields = NULL;
+    while (*s && isspace((unsigned char)*s)) {
+        s++;
     }
+    return s;
+}
+
+/*
+ * Splits the given query string into key/value pairs in place.
+ * Values are not decoded here, see http_get_arg.
+ */
+static void http_split_args(char *query, http_request_t *req) {
+    char *p, *eq;
+
+    while (query && *query && req->n_args < HTTP_MAX_ARGS) {
+        if ((p = strchr(query, '&'))) {
+            *p++ = 0;
+        }
+
+        struct http_arg *arg = &req->args[req->n_args++];
+        if ((eq = strchr(query, '='))) {
+            *eq = 0;
+            arg->value = eq + 1;
+        } else {
+            arg->value = "";
+        }
+        arg->key = query;
+        arg->decoded = 0;
 
-    if (hdr->header_fields) {
-        map_destroy(hdr->query_fields, free, free);
-        hdr->header_fields = NULL;
+        query = p;
     }
 }
 
-static int http_parse_request_line(FILE *fp, struct http_header *hdr) {
-    int fd;
-    char *method = NULL, *path = NULL, *line = NULL;
+/*
+ * Waits for the socket to become readable, then reads as much as will
+ * fit into the remainder of the request buffer.
+ * Returns the number of bytes read, or <= 0 on timeout, error or EOF.
+ */
+static int http_recv(int fd, http_request_t *req) {
     struct timeval tv = { .tv_sec = 3, .tv_usec = 0 };
     fd_set rdfds;
+    ssize_t n;
 
-    fd = fileno(fp);
+    if (req->len >= HTTP_BUFSIZE) {
+        DEBUG_PRINT("Request does not fit in buffer!\n");
+        return -1;
+    }
 
     FD_ZERO(&rdfds);
     FD_SET(fd, &rdfds);
 
     if (select(fd + 1, &rdfds, NULL, NULL, &tv) <= 0)
-        goto error;
+        return -1;
+
+    do {
+        n = recv(fd, req->buf + req->len, HTTP_BUFSIZE - req->len, 0);
+    } while (n < 0 && errno == EINTR);
+
+    if (n > 0) {
+        req->len += n;
+        req->buf[req->len] = 0;
+    }
+    return (int)n;
+}
 
-    method = newstring(300);
-    if (!method)
-        goto error;
+/*
+ * Returns a pointer to the first line following the end of the header,
+ * or NULL if the buffer does not contain a complete header yet.
+ */
+static char *http_find_body(char *buf, int len, int from) {
+    char *p;
+
+    /* back up a little, in case the terminator was split between reads */
+    from = (from > 3) ? (from - 3) : 0;
 
-    path = newstring(300);
-    if (!path)
-        goto error;
+    for (p = buf + from; (p = memchr(p, '\n', len - (p - buf))) != NULL; p++) {
+        if (p[1] == '\n') {
+            return p + 2;
+        }
+        if (p[1] == '\r' && p[2] == '\n') {
+            return p + 3;
+        }
+    }
+    return NULL;
+}
 
-    line = newstring(300);
-    if (!line)
-        goto error;
+static int http_parse_request_line(char *line, http_request_t *req) {
+    char *method, *path, *query;
 
-    /* Read and parse the request line */
-    if (fscanf(fp, "%300s %300s %*s", method, path) != 2) {
+    method = line;
+    if (!(path = strchr(method, ' '))) {
         DEBUG_PRINT("Failed to read request line!\n");
-        goto error;
+        return -1;
     }
+    *path++ = 0;
 
-    /* Read the remainder of the request line */
-    fgets(line, 300, fp);
-    free(line);
-    line = NULL;
+    /* Cut off the protocol version */
+    path += strspn(path, " ");
+    path[strcspn(path, " ")] = 0;
 
     if (strcmp(method, "GET") == 0) {
-        hdr->method = HTTP_GET;
+        req->method = HTTP_GET;
     } else if (strcmp(method, "POST") == 0) {
-        hdr->method = HTTP_POST;
+        req->method = HTTP_POST;
     } else {
         DEBUG_PRINT("Got unknown HTTP method!\n");
-        goto error;
+        return -1;
     }
 
-    free(method);
-    method = NULL;
-
-    hdr->path = path;
+    if ((query = strchr(path, '?'))) {
+        *query++ = 0;
+        if (req->method == HTTP_GET) {
+            http_split_args(query, req);
+        }
+    }
 
+    req->path = urldecode(path);
     return 0;
+}
 
-error:
-    if (method)
-        free(method);
+/*
+ * Parses the header lines in [line, end), storing the known fields.
+ */
+static void http_parse_request_headers(char *line, char *end, http_request_t *req) {
+    char *eol, *colon;
+    int i;
 
-    if (path)
-        free(path);
+    for (; line < end; line = eol + 1) {
+        eol = memchr(line, '\n', end - line);
+        if (!eol) {
+            break;
+        }
 
-    if (line)
-        free(line);
+        colon = memchr(line, ':', eol - line);
+        if (!colon) {
+            continue;
+        }
 
-    return -1;
+        for (i = 0; i < NUM_FIELDS; i++) {
+            if (((colon - line) == (int)strlen(header_names[i]))
+                && (strncasecmp(line, header_names[i], colon - line) == 0)) {
+                req->fields[i] = strip(colon + 1, eol);
+                break;
+            }
+        }
+    }
 }
 
-static int http_parse_request_headers(FILE *fp, map_t *fields) {
-    char *name, *value, *line;
+/*
+ * Reads and parses a request from the given socket into req.
+ * No memory is allocated; all parts of the request point into req->buf.
+ */
+static int http_read_request(int fd, http_request_t *req) {
+    char *line_end, *body;
+    int i, scanned = 0;
+    long content_len;
+
+    req->path = NULL;
+    req->n_args = 0;
+    req->len = 0;
+    for (i = 0; i < NUM_FIELDS; i++) {
+        req->fields[i] = NULL;
+    }
+
+    /* Read until the full header has been received */
+    while (!(body = http_find_body(req->buf, req->len, scanned))) {
+        scanned = req->len;
+        if (http_recv(fd, req) <= 0) {
+            return -1;
+        }
+    }
+
+    /* Split off the request line */
+    line_end = memchr(req->buf, '\n', body - req->buf);
+    http_parse_request_headers(line_end + 1, body, req);
 
-    line = newstring(300);
-    if (!line) {
+    if (http_parse_request_line(strip(req->buf, line_end), req)) {
         return -1;
     }
 
-    /* Read and parse the header fields */
-    while (!feof(fp)) {
-        fgets(line, 300, fp);
+    if (req->method == HTTP_POST) {
+        if (!req->fields[FIELD_CONTENT_LENGTH]) {
+            DEBUG_PRINT("No Content-Length in POST request\n");
+            return -1;
+        }
 
-        if (strcmp(line, "\r\n") == 0 || strcmp(line, "\n") == 0) {
-            /* End of the HTTP header */
-            break;
+        content_len = strtol(req->fields[FIELD_CONTENT_LENGTH], NULL, 10);
+        if (content_len < 0 || content_len > (HTTP_BUFSIZE - (body - req->buf))) {
+            DEBUG_PRINT("Bad Content-Length in POST request\n");
+            return -1;
         }
 
-        /* Parse the name and value of the header field */
-        if (splitstring(line, ':', &name, &value))  {
-            map_put(fields, name, value);
+        /* Read the remainder of the body */
+        while ((req->buf + req->len) - body < content_len) {
+            if (http_recv(fd, req) <= 0) {
+                return -1;
+            }
         }
-    }
+        body[content_len] = 0;
 
-    free (line);
+        http_split_args(body, req);
+    }
 
     return 0;
 }
 
-static int http_parse_request(FILE *fp, struct http_header *hdr) {
-    int len;
-    char *query;
-
-    hdr->path = NULL;
-    hdr->header_fields = NULL;
-    hdr->query_fields = NULL;
-
-    if (http_parse_request_line(fp, hdr))
-        goto error;
-
-    hdr->header_fields = map_create(compare_strings, hash_string);
-    if (!hdr->header_fields)
-        goto error;
-
-    if (http_parse_request_headers(fp, hdr->header_fields))
-        goto error;
+char *http_get_path(http_request_t *req) {
+    return req->path;
+}
 
-    hdr->query_fields = map_create(compare_strings, hash_string);
-    if (!hdr->query_fields)
-        goto error;
+char *http_get_header(http_request_t *req, const char *name) {
+    int i;
 
-    if (hdr->method == HTTP_POST) {
-        if (!map_haskey(hdr->header_fields, "Content-Length")) {
-            DEBUG_PRINT("No Content-Length in POST request\n");
-            goto error;
+    for (i = 0; i < NUM_FIELDS; i++) {
+        if (strcasecmp(name, header_names[i]) == 0) {
+            return req->fields[i];
         }
-
-        len = atoi(map_get(hdr->header_fields, "Content-Length"));
-        query = newstring(len + 1);
-        fread(query, 1, len, fp);
-
-        http_parse_query(query, hdr->query_fields);
-        free(query);
     }
-
-    return 0;
-
-error:
-    http_destroy_header(hdr);
-
-    return -1;
+    return NULL;
 }
 
-/*
- * Open file descriptor as reading and writing streams.
- * Note: do not use file descriptor directly afterwards.
- * File descriptor is closed if streams could not be opened.
- */
-static int http_open_file_streams(int fd, FILE **inf, FILE **outf) {
-    int wd;
-    FILE *in, *out;
+char *http_get_arg(http_request_t *req, const char *key) {
+    int i;
 
-    *inf = NULL;
-    *outf = NULL;
+    for (i = 0; i < req->n_args; i++) {
+        struct http_arg *arg = &req->args[i];
 
-    if (!(in = fdopen(fd, "r"))) {
-        perror("fdopen");
-        close(fd);
-        return -1;
-    }
-
-    if ((wd = dup(fd)) < 0) {
-        perror("dup");
-        fclose(in);
-        return -1;
-    }
+        if (strcmp(arg->key, key) != 0) {
+            continue;
+        }
 
-    out = fdopen(wd, "w");
-    if (!out) {
-        perror("fdopen");
-        close(wd);
-        fclose(in);
-        return -1;
+        if (!arg->decoded) {
+            urldecode(arg->value);
+            arg->decoded = 1;
+        }
+        return arg->value;
     }
-
-    *inf = in;
-    *outf = out;
-    return 0;
+    return NULL;
 }
 
 static void *handle_request(void *arg) {
-    FILE *inf, *outf;
-    char *path;
-    struct http_header hdr;
+    FILE *outf;
+    http_request_t req;
     struct http_conn *conn;
     http_handler_t handler;
 
@@ -406,32 +431,26 @@ static void *handle_request(void *arg) {
     handler = conn->handler;
     free(conn);
 
-    if (http_open_file_streams(s, &inf, &outf)) {
-        DEBUG_PRINT("Failed to open file streams!\n");
-        goto end;
+    if (http_read_request(s, &req)) {
+        close(s);
+        return NULL;
     }
 
-    if (http_parse_request(inf, &hdr))
-        goto end;
-
-    path = urldecode(hdr.path);
-    free(hdr.path);
+    if (!(outf = fdopen(s, "w"))) {
+        perror("fdopen");
+        close(s);
+        return NULL;
+    }
 
     /* Invoke the request handler to write the response */
-    handler (path, hdr.header_fields, hdr.query_fields, outf);
-
-    free(path);
+    handler(&req, outf);
 
-    map_destroy(hdr.header_fields, free, free);
-    map_destroy(hdr.query_fields, free, free);
-
-end:
-    fclose(inf);
     fclose(outf);
 
     return NULL;
 }
 
+
 static void handle_kill_signal(int signum) {
     server_is_running = 0;
 }
@@ -8,6 +8,7 @@
 #include "common.h"
 #include "queryparser.h"
 #include "set.h"
+#include "vector.h"
 #include "map.h"
 // #include "assert.h"
 // #include "printing.h"
@@ -39,6 +40,7 @@ struct index {
     parser_t *parser;
     set_t    *query_words;  // temp set used to contain <word>'s being parsed
     int       n_docs;
+    unsigned long version;  // incremented whenever the index contents change
 };
 
 /* Type of indexed word */
@@ -73,6 +75,11 @@ int compare_query_results_by_score(query_result_t *a, query_result_t *b) {
     return 0;
 }
 
+/* Radix sort key ordering query results by descending score, as compare_query_results_by_score */
+static unsigned long long query_result_key(query_result_t *res) {
+    return ~vector_doublekey(res->score);
+}
+
 /* used by the parser to search within the index. */
 set_t *get_iword_docs(index_t *index, char *term) {
     index->iword_buf->term = term;
@@ -85,11 +92,51 @@ set_t *get_iword_docs(index_t *index, char *term) {
     return NULL;
 }
 
+/*
+ * Completes the given prefix by seeking into the ordered dictionary, and
+ * scanning the words sharing the prefix for the most frequent ones.
+ */
+int index_suggest(index_t *index, char *prefix, char **terms, int max_terms) {
+    size_t len = strlen(prefix);
+    int freqs[(max_terms > 0) ? max_terms : 1];
+    set_iterbuf_t word_buf;
+    set_iter_t *word_iter = set_inititer(&word_buf, index->indexed_words);
+    iword_t *iword;
+    int n = 0, i, freq;
+
+    index->iword_buf->term = prefix;
+    set_skipto(word_iter, index->iword_buf);
+    while ((iword = set_next(word_iter)) != NULL && strncmp(iword->term, prefix, len) == 0) {
+        freq = set_size(iword->in_docs);
+
+        /* insert by frequency; words are visited in order, so ties keep the earlier word */
+        for (i = n; i > 0 && freqs[i - 1] < freq; i--) {
+            if (i < max_terms) {
+                terms[i] = terms[i - 1];
+                freqs[i] = freqs[i - 1];
+            }
+        }
+        if (i < max_terms) {
+            terms[i] = iword->term;
+            freqs[i] = freq;
+            if (n < max_terms) {
+                n++;
+            }
+        }
+    }
+
+    return n;
+}
+
 /* TESTFUNC */
 int index_uniquewords(index_t *index) {
     return set_size(index->indexed_words);
 }
 
+unsigned long index_version(index_t *index) {
+    return index->version;
+}
+
 /******************************************************************************
  *                                                                            *
  *            Section 1: Index Creation, Building, Destruction                *
@@ -127,6 +174,7 @@ index_t *index_create() {
     index->iword_buf->in_docs = NULL;
 
     index->n_docs = 0;
+    index->version = 0;
     index->query_words = NULL;
 
     return index;
@@ -142,9 +190,10 @@ void index_destroy(index_t *index) {
      * such as double free or potentially dismembering trees.
      */
     set_t *all_docs = set_create(compare_pointers);
-    set_iter_t *iword_iter = set_createiter(index->indexed_words);
+    set_iterbuf_t iword_buf, doc_buf;
+    set_iter_t *iword_iter = set_inititer(&iword_buf, index->indexed_words);
 
-    if (!all_docs || !iword_iter) {
+    if (!all_docs) {
         // ERROR_PRINT("failed to allocate memory\n");
         return;
     }
@@ -152,17 +201,12 @@ void index_destroy(index_t *index) {
     /* free the set of indexed words while creating a joint set of documents. */
     while (set_hasnext(iword_iter)) {
         iword_t *curr = set_next(iword_iter);
-        set_iter_t *doc_iter = set_createiter(curr->in_docs);
-        if (!doc_iter) {
-            // ERROR_PRINT("failed to allocate memory\n");
-            return;
-        }
+        set_iter_t *doc_iter = set_inititer(&doc_buf, curr->in_docs);
 
         /* add to set of all docs */
         while (set_hasnext(doc_iter)) {
             set_add(all_docs, set_next(doc_iter));
         }
-        set_destroyiter(doc_iter);
 
         /* free the iword & its members */
         set_destroy(curr->in_docs);
@@ -170,14 +214,9 @@ void index_destroy(index_t *index) {
         free(curr);
         n_freed_words++;
     }
-    set_destroyiter(iword_iter);
     set_destroy(index->indexed_words);
 
-    set_iter_t *all_docs_iter = set_createiter(all_docs);
-    if (!all_docs_iter) {
-        // ERROR_PRINT("failed to allocate memory\n");
-        return;
-    }
+    set_iter_t *all_docs_iter = set_inititer(&doc_buf, all_docs);
 
     /* free the set of all documents */
     while (set_hasnext(all_docs_iter)) {
@@ -188,7 +227,6 @@ void index_destroy(index_t *index) {
         free(doc);
         n_freed_docs++;
     }
-    set_destroyiter(all_docs_iter);
     set_destroy(all_docs);
 
     /* free index & co */
@@ -200,20 +238,20 @@ void index_destroy(index_t *index) {
         n_freed_docs, n_freed_words);
 }
 
-void index_addpath(index_t *index, char *path, list_t *tokens) {
+void index_addpath(index_t *index, char *path, vector_t *tokens) {
     /*
      * Not certain how a malloc failure should be handled, and especially
      * not within this functions, seeing as there's no return value.
      * This seems like a function that absolutely should have one ...
      */
-    if (list_size(tokens) == 0) {
+    if (vector_size(tokens) == 0) {
         // DEBUG_PRINT("given path with no tokens: %s\n", path);
         return;
     }
 
-    list_iter_t *tok_iter = list_createiter(tokens);
+    int n_toks = vector_size(tokens), i;
     idocument_t *doc = malloc(sizeof(idocument_t));
-    if (!doc || !tok_iter) {
+    if (!doc) {
         // ERROR_PRINT("malloc failed\n");
         return;
     }
@@ -225,10 +263,11 @@ void index_addpath(index_t *index, char *path, list_t *tokens) {
     }
 
     index->n_docs++;
+    index->version++;
     doc->path = path;
 
-    while (list_hasnext(tok_iter)) {
-        char *tok = list_next(tok_iter);
+    for (i = 0; i < n_toks; i++) {
+        char *tok = vector_get(tokens, i);
 
         /* try to add the word to the index, using word_buf to allow comparison */
         index->iword_buf->term = tok;
@@ -272,11 +311,15 @@ void index_addpath(index_t *index, char *path, list_t *tokens) {
             *freq += 1;
         }
 
-        /* add path to the indexed words set. */
+        /* add path to the indexed words set, which may be shared with query results */
+        set_t *in_docs = set_unshare(iword->in_docs);
+        if (!in_docs) {
+            return;
+        }
+        iword->in_docs = in_docs;
         set_add(iword->in_docs, doc);
     }
 
-    list_destroyiter(tok_iter);
 }
 
 
@@ -288,31 +331,37 @@ void index_addpath(index_t *index, char *path, list_t *tokens) {
 
 
 /*
- * Returns a sorted list of query results, created from each path in the given set.
+ * Returns a sorted vector of query results, created from each path in the given set.
  * Calculates score through a naive implementation of if-idf
  */
-static list_t *format_query_results(index_t *index, set_t *docs) {
-    list_t *query_results = list_create((cmpfunc_t)compare_query_results_by_score);
-    set_iter_t *docs_iter = set_createiter(docs);
+static vector_t *format_query_results(index_t *index, set_t *docs) {
+    vector_t *query_results = vector_create((cmpfunc_t)compare_query_results_by_score);
+    set_iterbuf_t docs_buf, qword_buf;
+    set_iter_t *docs_iter = set_inititer(&docs_buf, docs);
 
-    if (!query_results || !docs_iter) {
+    if (!query_results) {
         goto alloc_error;
     }
 
     double n_total_docs = (double)index->n_docs;
 
+    if (!vector_reserve(query_results, set_size(docs))) {
+        goto alloc_error;
+    }
+
     while (set_hasnext(docs_iter)) {
         query_result_t *q_result = malloc(sizeof(query_result_t));
         idocument_t *doc = set_next(docs_iter);
 
         /* create iter for the set of query words */
-        set_iter_t *qword_iter = set_createiter(index->query_words);
-        if (!qword_iter || !q_result) {
+        set_iter_t *qword_iter = set_inititer(&qword_buf, index->query_words);
+        if (!q_result) {
             if (q_result) {
                 free(q_result);
             }
             goto alloc_error;
         }
+        q_result->score = 0.0;
 
         /* Naive implementation of the tf-idf scoring algorithm.
          * This is definitely a bottleneck, but cannot think of another way 
@@ -333,42 +382,35 @@ static list_t *format_query_results(index_t *index, set_t *docs) {
              * 2) division by zero may not occur, as all indexed words must stem from a document
             */
         }
-        set_destroyiter(qword_iter);
 
         /* assign the document path query result, then add it to the list of results */
         q_result->path = doc->path;
-        if (!list_addlast(query_results, q_result)) {
-            goto alloc_error;
-        }
+        vector_push(query_results, q_result);
     }
-    set_destroyiter(docs_iter);
 
-    /* sort the results by score */
-    list_sort(query_results);
+    /* sort the results by score, keeping equal scores in document order */
+    vector_radixsort(query_results, (keyfunc_t)query_result_key);
 
     return query_results;
 
 alloc_error:
-    if (docs_iter) {
-        set_destroyiter(docs_iter);
-    }
     if (query_results) {
         void *res;
-        while ((res = list_popfirst(query_results)) != NULL) {
+        while ((res = vector_pop(query_results)) != NULL) {
             free(res);
         }
-        list_destroy(query_results);
+        vector_destroy(query_results);
     }
     return NULL;
 }
 
-list_t *index_query(index_t *index, list_t *tokens, char **errmsg) {
-    if (!list_size(tokens)) {
+vector_t *index_query(index_t *index, vector_t *tokens, char **errmsg) {
+    if (!vector_size(tokens)) {
         *errmsg = "empty query";
         return NULL;
     }
 
-    list_t *ret_list = NULL;
+    vector_t *ret_list = NULL;
     set_t *results = NULL;
 
     /* create a set to store <word> token i_words, if any */
@@ -388,7 +430,7 @@ list_t *index_query(index_t *index, list_t *tokens, char **errmsg) {
             *errmsg = parser_get_errmsg(index->parser);
             break;
         case (SKIP_PARSE):
-            ret_list = list_create(DUMMY_CMPFUNC);
+            ret_list = vector_create(DUMMY_CMPFUNC);
             break;
         case (PARSE_READY):
             /* parse is ready, proceed to get results */
@@ -397,8 +439,8 @@ list_t *index_query(index_t *index, list_t *tokens, char **errmsg) {
             if (!results) {
                 *errmsg = "index failed to allocate memeory";
             } else if (!set_size(results)) {
-                /* query produced an empty set, return an empty list */
-                ret_list = list_create(DUMMY_CMPFUNC);
+                /* query produced an empty set, return an empty vector */
+                ret_list = vector_create(DUMMY_CMPFUNC);
             } else {
                 /* nonempty set, format results */
                 ret_list = format_query_results(index, results);
@@ -8,11 +8,17 @@
 #include "common.h"
 #include "queryparser.h"
 #include "set.h"
-#include "map.h"
+#include "vector.h"
+#include "fst.h"
+#include "eytzinger.h"
+#include "suggest.h"
+#include "roaring.h"
+#include "typedmap.h"
 // #include "assert.h"
 // #include "printing.h"
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <ctype.h>
 #include <string.h>
 #include <limits.h>
@@ -27,22 +33,71 @@
 
 
 #define DUMMY_CMPFUNC  &compare_pointers
+#define SUBQUERY_CACHE_ELEMS  (1 << 20)  // bound on the parsers cache of intermediate results
+#define QUERY_MAXTOKENS       4096       // longer queries are rejected by the parser
+#define POSITIONAL_INDEX      1          // record word positions, enabling phrase & NEAR queries
+#define SUFFIX_INDEX          1          // keep a reversed dictionary, enabling *suffix queries
+#define FUZZY_MAXDIST         2          // bound on N in term~N, which defaults to it
+#define SUGGEST_TOPK          10         // completions kept for each prefix by the suggester
+#define BITMAP_MINDOCS        256        // words in at least this many documents,
+#define BITMAP_DENSITY        64         // and one in this many, are kept as bitmaps
 
 
-/* Type of indexed word */
+/*
+ * Postings of a word within a single document.
+ * Positions are stored in ascending order, as the deltas between consecutive
+ * positions, encoded as varints (7 bits per byte, high bit set on all but the
+ * last byte of each delta).
+ */
+typedef struct posting {
+    unsigned short tf;
+    int            last_pos;  // last position added, base of the next delta
+    int            len;       // bytes in use
+    int            size;      // bytes allocated
+    unsigned char *pos;       // NULL unless POSITIONAL_INDEX
+} posting_t;
+
+/* docids are unique small integers, and hash to themselves */
+#define DOCID_HASH(docid)  ((unsigned long)(docid))
+#define DOCID_EQ(a, b)     ((a) == (b))
+
+/* Map of docid => posting_t *, probed for every result document and word */
+MAP_DEFINE(tfmap, uint32_t, posting_t *, DOCID_HASH, DOCID_EQ)
+
+/*
+ * Type of indexed word.
+ * Documents are identified by their docid, cast to a pointer. The documents
+ * of a word are kept in a set while the word is rare, and in a bitmap once
+ * it is frequent (see add_doc). Bitmaps are combined with word-level
+ * operations by the parser, which streams sets and bitmaps alike.
+ */
 typedef struct iword {
-    char   *term;
-    set_t  *paths;  // set of paths where ->word can be found
-    map_t  *tf;     // path => freq
+    char      *term;
+    set_t     *paths;  // set of docids where ->word can be found (or NULL, see get_iword_docs)
+    roaring_t *bits;   // bitmap of the same docids once the word is frequent (or NULL)
+    tfmap_t   *tf;     // docid => posting_t
 } iword_t;
 
 /* Type of index */
 struct index {
     set_t    *indexed_words;       // set of all indexed words
+    fst_t    *dict;                // frozen dictionary of indexed_words (or NULL)
+    iword_t **dict_iwords;         // iwords by their ordinal in dict
+    eytzinger_t *lookup;           // the terms of dict laid out for exact lookups (or NULL)
+    fst_t    *rdict;               // the same, of the reversed terms (or NULL unless SUFFIX_INDEX)
+    iword_t **rdict_iwords;        // iwords by their ordinal in rdict
+    suggester_t *suggester;        // top completions of each prefix of the dictionary (or NULL)
+    int       dict_words;          // number of words when the dictionaries were frozen
+    unsigned long suggester_version;  // version of the index when the suggester was built
     iword_t  *iword_buf;    // buffer of one iword for searching and adding words
     parser_t *parser;
     set_t    *query_words;  // temp set used to contain <word>'s being parsed
+    char    **doc_paths;    // path of each docid, starting at 1
+    int       max_docs;     // docids doc_paths has room for
+    roaring_t *universe;    // all docids, for NOT. a single run once optimized
     int       n_docs;
+    unsigned long version;  // incremented whenever the index contents change
+    unsigned long bits_version;  // version of the index when bitmaps were last optimized
 };
 
 
@@ -51,29 +106,694 @@ int strcmp_iwords(iword_t *a, iword_t *b) {
     return strcmp(a->term, b->term);
 }
 
+/* Returns the number of documents containing the given word */
+static int iword_df(iword_t *iword) {
+    return iword->bits ? roaring_size(iword->bits) : set_size(iword->paths);
+}
+
+/* Returns the postings of the given word within the given document, or NULL */
+static posting_t *get_posting(iword_t *iword, void *doc) {
+    posting_t **posting = tfmap_get(iword->tf, (uintptr_t)doc);
+    return posting ? *posting : NULL;
+}
+
+/* Returns a newly allocated copy of the given string, reversed */
+static char *reverse_string(const char *s, size_t len) {
+    char *r = malloc(len + 1);
+    size_t i;
+
+    if (r) {
+        for (i = 0; i < len; i++) {
+            r[i] = s[len - 1 - i];
+        }
+        r[len] = '\0';
+    }
+    return r;
+}
+
 int compare_query_results_by_score(query_result_t *a, query_result_t *b) {
     if (b->score < a->score) return -1;
     if (a->score < b->score) return 1;
     return 0;
 }
 
-/* used by the parser to search within the index. */
-set_t *get_iword_docs(index_t *index, char *term) {
+/* Radix sort key ordering query results by descending score, as compare_query_results_by_score */
+static unsigned long long query_result_key(query_result_t *res) {
+    return ~vector_doublekey(res->score);
+}
+
+/* Type of reversed term, paired with its word while the reversed dictionary is built */
+typedef struct rterm {
+    char    *rterm;
+    iword_t *iword;
+} rterm_t;
+
+/* strcmp wrapper, for sorting reversed terms */
+static int strcmp_rterms(const void *a, const void *b) {
+    return strcmp(((rterm_t *)a)->rterm, ((rterm_t *)b)->rterm);
+}
+
+/*
+ * Builds the reversed dictionary of the n words in iwords.
+ * Returns 0 on success, or -1 on failure.
+ */
+static int freeze_reversed(index_t *index, iword_t **iwords, int n) {
+    rterm_t *rterms = malloc((n + 1) * sizeof(rterm_t));
+    char **keys = malloc((n + 1) * sizeof(char *));
+    int i, made = 0, ret = -1;
+
+    index->rdict_iwords = malloc((n + 1) * sizeof(iword_t *));
+    if (!rterms || !keys || !index->rdict_iwords) {
+        goto end;
+    }
+
+    for (made = 0; made < n; made++) {
+        rterms[made].iword = iwords[made];
+        rterms[made].rterm = reverse_string(iwords[made]->term, strlen(iwords[made]->term));
+        if (!rterms[made].rterm) {
+            goto end;
+        }
+    }
+    qsort(rterms, n, sizeof(rterm_t), strcmp_rterms);
+
+    for (i = 0; i < n; i++) {
+        keys[i] = rterms[i].rterm;
+        index->rdict_iwords[i] = rterms[i].iword;
+    }
+    index->rdict = fst_build(keys, n);
+    ret = index->rdict ? 0 : -1;
+
+end:
+    for (i = 0; i < made; i++) {
+        free(rterms[i].rterm);
+    }
+    free(rterms);
+    free(keys);
+    if (ret < 0) {
+        free(index->rdict_iwords);
+        index->rdict_iwords = NULL;
+    }
+    return ret;
+}
+
+/*
+ * Freezes the dictionary of indexed words into a transducer mapping each
+ * term to its ordinal, which indexes the array of iwords. Pattern
+ * expansions are served by it, and lookups of single words by an
+ * Eytzinger layout of the same terms, while indexed_words is kept for
+ * adding words. Only rebuilt when words were added since the last freeze.
+ * On failure, the dictionaries are left NULL, and lookups fall back to
+ * indexed_words.
+ */
+static void freeze_dictionary(index_t *index) {
+    int n = set_size(index->indexed_words), i = 0;
+    iword_t *iword;
+    char **keys;
+
+    if (index->dict && index->dict_words == n) {
+        return;
+    }
+
+    if (index->dict) fst_destroy(index->dict);
+    if (index->rdict) fst_destroy(index->rdict);
+    if (index->lookup) eytzinger_destroy(index->lookup);
+    free(index->dict_iwords);
+    free(index->rdict_iwords);
+    index->dict = index->rdict = NULL;
+    index->dict_iwords = index->rdict_iwords = NULL;
+    index->lookup = NULL;
+
+    keys = malloc((n + 1) * sizeof(char *));
+    index->dict_iwords = malloc((n + 1) * sizeof(iword_t *));
+    if (!keys || !index->dict_iwords) {
+        goto end;
+    }
+
+    /* the set is ordered by term, which gives each word its ordinal */
+    SET_FOREACH(iword, index->indexed_words) {
+        index->dict_iwords[i] = iword;
+        keys[i++] = iword->term;
+    }
+    index->dict = fst_build(keys, n);
+    index->dict_words = n;
+
+    if (index->dict) {
+        /* not fatal; lookups are then served by the transducer */
+        index->lookup = eytzinger_build(keys, n);
+    }
+
+    if (index->dict && SUFFIX_INDEX) {
+        /* not fatal; *suffix patterns are just unsupported */
+        freeze_reversed(index, index->dict_iwords, n);
+    }
+
+end:
+    free(keys);
+    if (!index->dict) {
+        free(index->dict_iwords);
+        index->dict_iwords = NULL;
+    }
+}
+
+/* Returns the indexed word of the given term, or NULL if there is none */
+static iword_t *lookup_iword(index_t *index, char *term) {
+    int ordinal;
+
+    if (index->dict) {
+        ordinal = index->lookup ? eytzinger_get(index->lookup, term) : fst_get(index->dict, term);
+        return (ordinal < 0) ? NULL : index->dict_iwords[ordinal];
+    }
     index->iword_buf->term = term;
-    iword_t *result = set_get(index->indexed_words, index->iword_buf);
+    return set_get(index->indexed_words, index->iword_buf);
+}
+
+/*
+ * Stores the indexed word of each of the given terms in 'iwords', or NULL
+ * for terms there are none of. The terms are looked up together, which
+ * overlaps their cache misses, once the dictionary is frozen.
+ */
+static void lookup_iwords(index_t *index, char **terms, int n_terms, iword_t **iwords) {
+    int *ordinals = index->lookup ? malloc((n_terms + 1) * sizeof(int)) : NULL;
+    int i;
+
+    if (!ordinals) {
+        for (i = 0; i < n_terms; i++) {
+            iwords[i] = lookup_iword(index, terms[i]);
+        }
+        return;
+    }
+
+    eytzinger_getmany(index->lookup, terms, n_terms, ordinals);
+    for (i = 0; i < n_terms; i++) {
+        iwords[i] = (ordinals[i] < 0) ? NULL : index->dict_iwords[ordinals[i]];
+    }
+    free(ordinals);
+}
+
+/*
+ * Returns a new set of the docids in the given bitmap, or NULL on failure.
+ */
+static set_t *bitmap_to_set(roaring_t *bits) {
+    roaring_iter_t *iter = roaring_createiter(bits);
+    void **docs = malloc((roaring_size(bits) + 1) * sizeof(void *));
+    set_t *set = NULL;
+    uint32_t docid;
+    int n = 0;
+
+    if (iter && docs) {
+        while (roaring_next(iter, &docid)) {
+            docs[n++] = (void *)(uintptr_t)docid;
+        }
+        set = set_from_sorted_array(docs, n, compare_pointers);
+    }
+    if (iter) roaring_destroyiter(iter);
+    free(docs);
+    return set;
+}
+
+/*
+ * used by the parser to search within the index. Frequent words are served
+ * by get_iword_bits, unless the parser does not support bitmaps, in which
+ * case a set of their documents is made on demand, and kept up to date
+ * from then on.
+ */
+set_t *get_iword_docs(index_t *index, char *term) {
+    iword_t *result = lookup_iword(index, term);
 
     if (result) {
         set_add(index->query_words, result);
+        if (!result->paths) {
+            result->paths = bitmap_to_set(result->bits);
+        }
         return result->paths;
     }
     return NULL;
 }
 
+/* used by the parser to search within the index, for the bitmaps of frequent words. */
+roaring_t *get_iword_bits(index_t *index, char *term) {
+    iword_t *result = lookup_iword(index, term);
+
+    if (result && result->bits) {
+        set_add(index->query_words, result);
+        return result->bits;
+    }
+    return NULL;
+}
+
+/*
+ * used by the parser to search within the index for all <word>'s of a query
+ * at once, producing what get_iword_bits, or else get_iword_docs, would.
+ */
+void get_iword_batch(index_t *index, char **terms, int n_terms, set_t **prods, roaring_t **bits) {
+    iword_t **iwords = malloc((n_terms + 1) * sizeof(iword_t *));
+    int i;
+
+    if (!iwords) {
+        /* look the terms up one at a time instead */
+        for (i = 0; i < n_terms; i++) {
+            if (bits) {
+                bits[i] = get_iword_bits(index, terms[i]);
+            }
+            prods[i] = (bits && bits[i]) ? NULL : get_iword_docs(index, terms[i]);
+        }
+        return;
+    }
+
+    lookup_iwords(index, terms, n_terms, iwords);
+    for (i = 0; i < n_terms; i++) {
+        prods[i] = NULL;
+        if (bits) {
+            bits[i] = NULL;
+        }
+        if (!iwords[i]) {
+            continue;
+        }
+
+        set_add(index->query_words, iwords[i]);
+        if (bits && iwords[i]->bits) {
+            bits[i] = iwords[i]->bits;
+        } else {
+            if (!iwords[i]->paths) {
+                iwords[i]->paths = bitmap_to_set(iwords[i]->bits);
+            }
+            prods[i] = iwords[i]->paths;
+        }
+    }
+    free(iwords);
+}
+
+/*
+ * Adds the given docid to the documents of a word, converting them to a
+ * bitmap once the word occurs in at least BITMAP_MINDOCS documents, and
+ * 1/BITMAP_DENSITY of all documents. Docids are added in ascending order,
+ * which both bitmaps and sets append to cheaply.
+ */
+static void add_doc(index_t *index, iword_t *iword, int docid) {
+    void *doc = (void *)(uintptr_t)docid;
+    roaring_t *bits;
+    set_t *paths;
+
+    /* the set may be shared with query results, which must not change */
+    if (iword->paths) {
+        if (!(paths = set_unshare(iword->paths))) {
+            return;
+        }
+        iword->paths = paths;
+    }
+    if (iword->bits) {
+        roaring_add(iword->bits, docid);
+        if (iword->paths) {
+            set_tryadd_last(iword->paths, doc);
+        }
+        return;
+    }
+
+    set_tryadd_last(iword->paths, doc);
+    if (set_size(iword->paths) < BITMAP_MINDOCS
+        || (long)set_size(iword->paths) * BITMAP_DENSITY < index->n_docs) {
+        return;
+    }
+
+    /* on failure, the word is just kept as a set */
+    if (!(bits = roaring_create())) {
+        return;
+    }
+    SET_FOREACH(doc, iword->paths) {
+        if (roaring_add(bits, (uintptr_t)doc) < 0) {
+            roaring_destroy(bits);
+            return;
+        }
+    }
+    set_destroy(iword->paths);
+    iword->paths = NULL;
+    iword->bits = bits;
+}
+
+/* used by the parser to complement terms (NOT). */
+roaring_t *get_universe(index_t *index) {
+    return roaring_size(index->universe) ? index->universe : NULL;
+}
+
+/*
+ * Compresses the bitmaps of frequent words (see roaring_optimize), whenever
+ * the index changed since they last were.
+ */
+static void optimize_bitmaps(index_t *index) {
+    int i;
+
+    if (!index->dict || index->bits_version == index->version) {
+        return;
+    }
+    roaring_optimize(index->universe);
+    for (i = 0; i < index->dict_words; i++) {
+        if (index->dict_iwords[i]->bits) {
+            roaring_optimize(index->dict_iwords[i]->bits);
+        }
+    }
+    index->bits_version = index->version;
+}
+
+/*
+ * Appends the given position to the postings. Positions must be added in ascending order.
+ * Returns 0 on success, or -1 on failure.
+ */
+static int posting_addpos(posting_t *posting, int pos) {
+    unsigned int delta = pos - posting->last_pos;
+
+    if (posting->len + 5 > posting->size) {
+        int size = posting->size ? 2 * posting->size : 8;
+        unsigned char *buf = realloc(posting->pos, size);
+        if (!buf) {
+            return -1;
+        }
+        posting->pos = buf;
+        posting->size = size;
+    }
+
+    while (delta >= 0x80) {
+        posting->pos[posting->len++] = (delta & 0x7f) | 0x80;
+        delta >>= 7;
+    }
+    posting->pos[posting->len++] = delta;
+    posting->last_pos = pos;
+
+    return 0;
+}
+
+/*
+ * Decodes the positions of the given postings into buf, growing it as needed.
+ * Returns the number of positions, or -1 on failure.
+ */
+static int posting_decode(posting_t *posting, int **buf, int *buf_size) {
+    int i = 0, n = 0, pos = 0, shift;
+    unsigned int delta;
+
+    if (*buf_size < posting->tf) {
+        int *tmp = realloc(*buf, posting->tf * sizeof(int));
+        if (!tmp) {
+            return -1;
+        }
+        *buf = tmp;
+        *buf_size = posting->tf;
+    }
+
+    while (i < posting->len && n < *buf_size) {
+        delta = 0;
+        shift = 0;
+        do {
+            delta |= (unsigned int)(posting->pos[i] & 0x7f) << shift;
+            shift += 7;
+        } while (posting->pos[i++] & 0x80);
+
+        pos += delta;
+        (*buf)[n++] = pos;
+    }
+    return n;
+}
+
+/*
+ * Returns 1 if the position lists contain the words of a phrase at
+ * consecutive positions (window 0), or two words within 'window'
+ * positions of each other, otherwise 0.
+ */
+static int positions_match(int **lists, int *lens, int n_lists, int window) {
+    int i, j, k, p, *idx;
+
+    if (window) {
+        /* NEAR: for each position of the first word, look for the second around it */
+        for (i = 0, j = 0; i < lens[0]; i++) {
+            p = lists[0][i];
+            while (j < lens[1] && lists[1][j] < p - window) {
+                j++;
+            }
+            /* the same word on both sides must match two distinct occurrences */
+            for (k = j; k < lens[1] && lists[1][k] <= p + window; k++) {
+                if (lists[1][k] != p) {
+                    return 1;
+                }
+            }
+        }
+        return 0;
+    }
+
+    /* phrase: for each position p of the first word, word k must occur at p + k */
+    idx = calloc(n_lists, sizeof(int));
+    if (!idx) {
+        return 0;
+    }
+    for (i = 0; i < lens[0]; i++) {
+        p = lists[0][i];
+        for (k = 1; k < n_lists; k++) {
+            while (idx[k] < lens[k] && lists[k][idx[k]] < p + k) {
+                idx[k]++;
+            }
+            if (idx[k] == lens[k]) {
+                free(idx);
+                return 0;
+            }
+            if (lists[k][idx[k]] != p + k) {
+                break;
+            }
+        }
+        if (k == n_lists) {
+            free(idx);
+            return 1;
+        }
+    }
+    free(idx);
+    return 0;
+}
+
+/*
+ * Used by the parser to resolve phrase and NEAR terms. Candidate documents
+ * are the documents of the least frequent word which contain every other word.
+ * The position lists of each candidate are then matched against each other.
+ */
+set_t *get_phrase_docs(index_t *index, char **terms, int n_terms, int window) {
+    iword_t **iwords = NULL;
+    int **lists = NULL, *lens = NULL, *sizes = NULL;
+    set_iter_t *doc_iter = NULL;
+    set_iterbuf_t doc_buf;
+    roaring_iter_t *bits_iter = NULL;
+    set_t *result = NULL;
+    posting_t *posting;
+    uint32_t docid;
+    void *doc;
+    int i, lead = 0;
+
+    iwords = calloc(n_terms, sizeof(iword_t *));
+    lists = calloc(n_terms, sizeof(int *));
+    lens = calloc(n_terms, sizeof(int));
+    sizes = calloc(n_terms, sizeof(int));
+    result = set_create(compare_pointers);
+    if (!iwords || !lists || !lens || !sizes || !result) {
+        goto end;
+    }
+
+    lookup_iwords(index, terms, n_terms, iwords);
+    for (i = 0; i < n_terms; i++) {
+        if (!iwords[i]) {
+            goto end;
+        }
+        if (iword_df(iwords[i]) < iword_df(iwords[lead])) {
+            lead = i;
+        }
+    }
+
+    if (iwords[lead]->bits) {
+        bits_iter = roaring_createiter(iwords[lead]->bits);
+    } else {
+        doc_iter = set_inititer(&doc_buf, iwords[lead]->paths);
+    }
+    if (!doc_iter && !bits_iter) {
+        goto end;
+    }
+
+    while (1) {
+        if (doc_iter) {
+            doc = set_next(doc_iter);
+        } else {
+            doc = roaring_next(bits_iter, &docid) ? (void *)(uintptr_t)docid : NULL;
+        }
+        if (!doc) {
+            break;
+        }
+        for (i = 0; i < n_terms; i++) {
+            if (!(posting = get_posting(iwords[i], doc))) {
+                break;
+            }
+            lens[i] = posting_decode(posting, &lists[i], &sizes[i]);
+            if (lens[i] < 0) {
+                goto end;
+            }
+        }
+        if (i == n_terms && positions_match(lists, lens, n_terms, window)) {
+            set_tryadd_last(result, doc);
+        }
+    }
+
+end:
+    if (bits_iter) roaring_destroyiter(bits_iter);
+    if (lists) {
+        for (i = 0; i < n_terms; i++) {
+            free(lists[i]);
+        }
+    }
+    free(lists);
+    free(lens);
+    free(sizes);
+    free(iwords);
+
+    return result;
+}
+
+/*
+ * Expands `term~N` into the words within edit distance N of term, through
+ * a Levenshtein automaton run over the frozen dictionary.
+ */
+static int get_fuzzy_terms(index_t *index, char *pattern, char **terms, int max_terms) {
+    char *tilde = strrchr(pattern, '~'), *end, *term;
+    long dist = FUZZY_MAXDIST;
+    int *ordinals;
+    int i, n;
+
+    if (tilde == pattern) {
+        return -1;
+    }
+    if (tilde[1] != '\0') {
+        dist = strtol(tilde + 1, &end, 10);
+        if (!isdigit((unsigned char)tilde[1]) || *end || dist > FUZZY_MAXDIST) {
+            return -1;
+        }
+    }
+
+    if (!index->dict) {
+        return 0;
+    }
+
+    term = strndup(pattern, tilde - pattern);
+    ordinals = malloc((max_terms + 1) * sizeof(int));
+    if (!term || !ordinals) {
+        free(term);
+        free(ordinals);
+        return 0;
+    }
+
+    n = fst_fuzzy(index->dict, term, dist, ordinals, max_terms);
+    for (i = 0; i < n && i < max_terms; i++) {
+        terms[i] = index->dict_iwords[ordinals[i]]->term;
+    }
+
+    free(ordinals);
+    free(term);
+    return (n < 0) ? 0 : n;
+}
+
+/*
+ * Used by the parser to expand `prefix*`, `*suffix` and `term~N` patterns.
+ * Prefixed words are found by seeking to the first one not less than the
+ * prefix in the frozen dictionary (or the reversed suffix in the reversed
+ * dictionary), and scanning in order for as long as the words share it.
+ */
+int get_pattern_terms(index_t *index, char *pattern, char **terms, int max_terms) {
+    size_t len = strlen(pattern) - 1;
+    fst_t *dict = index->dict;
+    iword_t **iwords = index->dict_iwords;
+    fst_iter_t *word_iter;
+    char *fix, *key;
+    int n = 0, ordinal;
+
+    if (strchr(pattern, '~')) {
+        return get_fuzzy_terms(index, pattern, terms, max_terms);
+    }
+
+    if (len == 0 || (pattern[0] == '*' && pattern[len] == '*')) {
+        /* a lone '*', or an infix */
+        return -1;
+    }
+
+    if (pattern[len] == '*') {
+        fix = strndup(pattern, len);
+    } else if (SUFFIX_INDEX) {
+        dict = index->rdict;
+        iwords = index->rdict_iwords;
+        fix = reverse_string(pattern + 1, len);
+    } else {
+        return -1;
+    }
+
+    word_iter = (fix && dict) ? fst_createiter(dict, fix) : NULL;
+    if (!word_iter) {
+        free(fix);
+        return 0;
+    }
+
+    while (n <= max_terms && (key = fst_next(word_iter, &ordinal)) != NULL) {
+        if (strncmp(key, fix, len) != 0) {
+            break;
+        }
+        if (n < max_terms) {
+            terms[n] = iwords[ordinal]->term;
+        }
+        n++;
+    }
+
+    fst_destroyiter(word_iter);
+    free(fix);
+    return n;
+}
+
+/*
+ * Builds the suggester of the frozen dictionary, ranking the completions
+ * of each prefix by their document frequency.
+ */
+static void freeze_suggester(index_t *index) {
+    int n = index->dict_words, i;
+    char **keys = malloc((n + 1) * sizeof(char *));
+    int *freqs = malloc((n + 1) * sizeof(int));
+
+    if (keys && freqs) {
+        for (i = 0; i < n; i++) {
+            keys[i] = index->dict_iwords[i]->term;
+            freqs[i] = iword_df(index->dict_iwords[i]);
+        }
+        index->suggester = suggester_build(keys, freqs, n, SUGGEST_TOPK);
+        index->suggester_version = index->version;
+    }
+
+    free(keys);
+    free(freqs);
+}
+
+/*
+ * Completes the given prefix from the suggester, which is rebuilt whenever
+ * the index changed since it was built, as document frequencies may have.
+ * At most SUGGEST_TOPK words are known for each prefix.
+ */
+int index_suggest(index_t *index, char *prefix, char **terms, int max_terms) {
+    freeze_dictionary(index);
+
+    if (index->suggester && index->suggester_version != index->version) {
+        suggester_destroy(index->suggester);
+        index->suggester = NULL;
+    }
+    if (!index->suggester && index->dict) {
+        freeze_suggester(index);
+    }
+
+    return index->suggester ? suggester_lookup(index->suggester, prefix, terms, max_terms) : 0;
+}
+
 /* TESTFUNC */
 int index_uniquewords(index_t *index) {
     return set_size(index->indexed_words);
 }
 
+unsigned long index_version(index_t *index) {
+    return index->version;
+}
+
 /******************************************************************************
  *                                                                            *
  *            Section 1: Index Creation, Building, Destruction                *
@@ -93,9 +813,21 @@ index_t *index_create() {
         return NULL;
     }
 
+    /* frozen on the first query */
+    index->dict = index->rdict = NULL;
+    index->dict_iwords = index->rdict_iwords = NULL;
+    index->lookup = NULL;
+    index->dict_words = 0;
+    index->suggester = NULL;
+    index->suggester_version = 0;
+    index->bits_version = 0;
+
     index->iword_buf = malloc(sizeof(iword_t));
-    if (!index->iword_buf) {
+    index->universe = roaring_create();
+    if (!index->iword_buf || !index->universe) {
         set_destroy(index->indexed_words);
+        free(index->iword_buf);
+        if (index->universe) roaring_destroy(index->universe);
         free(index);
         return NULL;
     }
@@ -104,14 +836,30 @@ index_t *index_create() {
     if (!index->parser) {
         set_destroy(index->indexed_words);
         free(index->iword_buf);
+        roaring_destroy(index->universe);
         free(index);
         return NULL;
     }
+    /* not fatal; queries are just evaluated from scratch */
+    parser_enable_cache(index->parser, SUBQUERY_CACHE_ELEMS);
+    parser_set_maxtokens(index->parser, QUERY_MAXTOKENS);
+    if (POSITIONAL_INDEX) {
+        parser_set_phrase_func(index->parser, (phrase_func_t)get_phrase_docs);
+    }
+    parser_set_expand_func(index->parser, (expand_func_t)get_pattern_terms);
+    parser_set_bitmap_func(index->parser, (bitmap_func_t)get_iword_bits);
+    parser_set_batch_func(index->parser, (batch_func_t)get_iword_batch);
+    parser_set_universe_func(index->parser, (universe_func_t)get_universe);
+
     index->iword_buf->term = NULL;
     index->iword_buf->paths = NULL;
+    index->iword_buf->bits = NULL;
     index->iword_buf->tf = NULL;
 
+    index->doc_paths = NULL;
+    index->max_docs = 0;
     index->n_docs = 0;
+    index->version = 0;
     index->query_words = NULL;
 
     return index;
@@ -122,26 +870,42 @@ void index_destroy(index_t *index) {
     /* TODO / downprioritized, as it is mostly irrelevant for time testing purposes. */
 }
 
-void index_addpath(index_t *index, char *path, list_t *tokens) {
+void index_addpath(index_t *index, char *path, vector_t *tokens) {
     /*
      * Not certain how a malloc failure should be handled, and especially
      * not within this functions, seeing as there's no return value.
      * This seems like a function that absolutely should have one ...
      */
-    if (list_size(tokens) == 0) {
+    if (vector_size(tokens) == 0) {
         free(path);
         return;
     }
 
-    list_iter_t *tok_iter = list_createiter(tokens);
-    if (!tok_iter) {
-        return;
+    if (index->n_docs + 1 >= index->max_docs) {
+        int max_docs = index->max_docs ? 2 * index->max_docs : 1024;
+        char **doc_paths = realloc(index->doc_paths, max_docs * sizeof(char *));
+        if (!doc_paths) {
+            free(path);
+            return;
+        }
+        index->doc_paths = doc_paths;
+        index->max_docs = max_docs;
     }
 
+    int n_toks = vector_size(tokens), pos;
+
+    /* docids start at 1, as 0 would be a NULL element */
     index->n_docs++;
+    index->doc_paths[index->n_docs] = path;
+    /* on failure, NOT will not match this document */
+    roaring_add(index->universe, index->n_docs);
+    void *doc = (void *)(uintptr_t)index->n_docs;
+    index->version++;
+    parser_invalidate(index->parser);
 
-    while (list_hasnext(tok_iter)) {
-        char *tok = list_next(tok_iter);
+    /* the position of each word is its index among the tokens */
+    for (pos = 0; pos < n_toks; pos++) {
+        char *tok = vector_get(tokens, pos);
 
         /* try to add the word to the index, using word_buf to allow comparison */
         index->iword_buf->term = tok;
@@ -150,8 +914,9 @@ void index_addpath(index_t *index, char *path, list_t *tokens) {
         if (iword == index->iword_buf) {
             /* first index entry for this word. initialize it as an indexed word. */
             iword->term = tok;
-            iword->paths = set_create((cmpfunc_t)strcmp);
-            iword->tf = map_create((cmpfunc_t)strcmp, hash_string);
+            iword->paths = set_create(compare_pointers);
+            iword->bits = NULL;
+            iword->tf = tfmap_create();
 
             /* Since the search word was added, recreate buffer. */
             index->iword_buf = malloc(sizeof(iword_t));
@@ -163,25 +928,31 @@ void index_addpath(index_t *index, char *path, list_t *tokens) {
             free(tok);
         }
 
-        if (set_contains(iword->paths, path)) {
+        posting_t *posting = get_posting(iword, doc);
+        if (posting) {
             /* duplicate word within document */
-            unsigned short *tf = map_get(iword->tf, path);
-            if (*tf < USHRT_MAX) {
-                *tf += 1;
+            if (posting->tf == USHRT_MAX) {
+                /* further positions would not be decoded, see posting_decode */
+                continue;
             }
+            posting->tf++;
         } else {
-            /* add path to the indexed words set. */
-            set_add(iword->paths, path);
-            /* allocate a tf pointer */
-            unsigned short *tf = malloc(sizeof(unsigned short));
-            if (tf) {
-                *tf = 1;
-                map_put(iword->tf, path, tf);
+            /* add the document to those of the indexed word. */
+            add_doc(index, iword, index->n_docs);
+            /* allocate the postings of the word within this document */
+            posting = calloc(1, sizeof(posting_t));
+            if (!posting || tfmap_put(iword->tf, index->n_docs, posting) < 0) {
+                free(posting);
+                continue;
             }
+            posting->tf = 1;
         }
-    }
 
-    list_destroyiter(tok_iter);
+        if (POSITIONAL_INDEX) {
+            /* on failure, phrases will not match this occurrence */
+            posting_addpos(posting, pos);
+        }
+    }
 }
 
 
@@ -192,53 +963,54 @@ void index_addpath(index_t *index, char *path, list_t *tokens) {
  ******************************************************************************/
 
 /*
- * Returns a sorted list of query results, created from each path in the given set.
+ * Returns a vector of query results, created from each docid in the given set.
  */
-static list_t *format_query_results(index_t *index, set_t *paths) {
-    list_t *results = list_create((cmpfunc_t)compare_query_results_by_score);
-    set_iter_t *path_iter = set_createiter(paths);
+static vector_t *format_query_results(index_t *index, set_t *docs) {
+    vector_t *results = vector_create((cmpfunc_t)compare_query_results_by_score);
 
     /* calculate log docs preemptively */
     double log_ndocs = log((double)index->n_docs);
     double tf, idf;
-    char *path;
+    posting_t *posting;
+    void *doc;
     iword_t *iword;
 
-    /* iterate over all paths */
-    while ((path = set_next(path_iter)) != NULL) {
+    if (!results) {
+        return NULL;
+    }
+    vector_reserve(results, set_size(docs));
+
+    /* iterate over all documents */
+    SET_FOREACH(doc, docs) {
         query_result_t *q_result = malloc(sizeof(query_result_t));
-        q_result->path = path;
+        q_result->path = index->doc_paths[(uintptr_t)doc];
         q_result->score = 0.00f;
 
-        /* create iterator for words terminated by the parser */
-        set_iter_t *qword_iter = set_createiter(index->query_words);
-
-        while ((iword = set_next(qword_iter)) != NULL) {
-            /* if path is contained within the word struct, get tf and calc tfidf */
-            if (set_contains(iword->paths, path)) {
-                tf = (double)(*(unsigned short *)map_get(iword->tf, path));
-                idf = log_ndocs - log((double)set_size(iword->paths));
+        /* iterate over the words terminated by the parser */
+        SET_FOREACH(iword, index->query_words) {
+            /* if the document contains the word, get tf and calc tfidf */
+            if ((posting = get_posting(iword, doc)) != NULL) {
+                tf = (double)posting->tf;
+                idf = log_ndocs - log((double)iword_df(iword));
                 q_result->score += tf * idf;
             }
         }
 
-        set_destroyiter(qword_iter);
-        list_addlast(results, q_result);
+        vector_push(results, q_result);
     }
-    set_destroyiter(path_iter);
 
     return results;
 }
 
-list_t *index_query(index_t *index, list_t *tokens, char **errmsg) {
+vector_t *index_query(index_t *index, vector_t *tokens, char **errmsg) {
     /* guess the following won't happen after checking out indexer */
-    // if (!list_size(tokens)) {
+    // if (!vector_size(tokens)) {
     //     *errmsg = "empty query";
     //     return NULL;
     //
     // }
 
-    list_t *ret_list = NULL;
+    vector_t *ret_list = NULL;
     set_t *results = NULL;
 
     /* create a set to store <word> token i_words, if any */
@@ -248,6 +1020,9 @@ list_t *index_query(index_t *index, list_t *tokens, char **errmsg) {
         return NULL;
     }
 
+    freeze_dictionary(index);
+    optimize_bitmaps(index);
+
     /* give tokens to the parser for scanning */
     switch (parser_scan(index->parser, tokens)) {
         case (ALLOC_FAILED):
@@ -258,7 +1033,7 @@ list_t *index_query(index_t *index, list_t *tokens, char **errmsg) {
             *errmsg = parser_get_errmsg(index->parser);
             break;
         case (SKIP_PARSE):
-            ret_list = list_create(DUMMY_CMPFUNC);
+            ret_list = vector_create(DUMMY_CMPFUNC);
             break;
         case (PARSE_READY):
             /* parse is ready, proceed to get results */
@@ -267,13 +1042,17 @@ list_t *index_query(index_t *index, list_t *tokens, char **errmsg) {
             if (!results) {
                 *errmsg = "index failed to allocate memeory";
             } else if (!set_size(results)) {
-                /* query produced an empty set, return an empty list */
-                ret_list = list_create(DUMMY_CMPFUNC);
+                /* query produced an empty set, return an empty vector */
+                ret_list = vector_create(DUMMY_CMPFUNC);
             } else {
                 /* nonempty set, format results */
                 ret_list = format_query_results(index, results);
-                /* sort the results by score */
-                list_sort(ret_list);
+                if (!ret_list) {
+                    *errmsg = "index failed to allocate memeory";
+                } else {
+                    /* sort the results by score, keeping equal scores in docid order */
+                    vector_radixsort(ret_list, (keyfunc_t)query_result_key);
+                }
             }
             break;
     }
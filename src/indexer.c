@@ -6,7 +6,10 @@
  */
 
 #include "index.h"
+#include "list.h"
 #include "httpd.h"
+#include "filecache.h"
+#include "querycache.h"
 #include "printing.h"
 
 #include <string.h>
@@ -14,16 +17,33 @@
 #include <stdio.h>
 #include <pthread.h>
 #include <ctype.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 
 #define ADDPATH_PRINT_INTERVAL 500
 
 #define PORT_NUM 8080
 
+#define TEMPLATE_PATH "template.html"
+#define TEMPLATE_RECHECK_US 1000000
+
+#define PAGE_CACHE_BYTES    (32 * 1024 * 1024)
+#define PAGE_CACHE_ENTRIES  256
+
+#define QUERY_CACHE_BYTES   (64 * 1024 * 1024)
+
+#define SUGGEST_RESULTS     10
+
 static pthread_mutex_t query_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static char *root_dir;
 static index_t *idx;
+static filecache_t *page_cache;
+static querycache_t *query_cache;
 
 static void print_title(FILE *, char *);
 static void print_processed_querystring(FILE *, char *);
@@ -42,6 +62,26 @@ const struct tag_mapping tag_mappings[] = {
 
 #define NUM_TAGS (sizeof(tag_mappings) / sizeof(struct tag_mapping))
 
+/*
+ * A template is compiled into a sequence of chunks, which are either
+ * static bytes of the template source, or a tag to be rendered.
+ */
+struct tpl_chunk {
+    const char *data;   // static text, NULL for tags
+    size_t      len;
+    void (*render) (FILE *fp, char *query);
+};
+
+struct template {
+    char             *src;       // template file contents, referenced by chunks
+    struct tpl_chunk *chunks;
+    int               n_chunks;
+    time_t            mtime;     // modification time of the compiled file
+    unsigned long long checked;  // time of the last modification check
+};
+
+static struct template page_template;
+
 struct mime_entry {
     const char *file_type;
     const char *mime_type;
@@ -71,10 +111,14 @@ static int is_reserved_word(char *word) {
         return 1;
     else if (strcmp(word, "OR") == 0)
         return 1;
+    else if (strcmp(word, "NOT") == 0)
+        return 1;
     else if (strcmp(word, "(") == 0)
         return 1;
     else if (strcmp(word, ")") == 0)
         return 1;
+    else if (strncmp(word, "NEAR/", 5) == 0)
+        return 1;
     else
         return 0;
 }
@@ -109,11 +153,51 @@ end:
     return s;
 }
 
-/* Splits the query into a list of tokens */
-static list_t *tokenize_query(char *query) {
+/*
+ * Copies the "quoted phrase" at 'start' into a single token. The words of the
+ * phrase are split as tokenize_file would split them, lowercased, and
+ * separated by single spaces. 'end' is set past the closing quote.
+ */
+static char *phrase_token(char *start, char **end) {
+    char *s, *c, *t, *term;
+    int n;
+
+    for (s = start + 1; (*s != '"') && (*s != '\0'); s++);
+    *end = (*s == '"') ? (s + 1) : s;
+
+    /* each word may be followed by a separator, in addition to the quotes */
+    term = malloc(2 * (s - start) + 3);
+    if (term == NULL) {
+        ERROR_PRINT("out of memory");
+        return NULL;
+    }
+
+    t = term;
+    *t++ = '"';
+    for (c = start + 1; c < s; ) {
+        if (!isalnum((unsigned char)*c)) {
+            c++;
+            continue;
+        }
+        if (t > term + 1) {
+            *t++ = ' ';
+        }
+        /* words are at most 100 characters long */
+        for (n = 0; (c < s) && isalnum((unsigned char)*c) && (n < 100); c++, n++) {
+            *t++ = tolower(*c);
+        }
+    }
+    *t++ = '"';
+    *t = '\0';
+
+    return term;
+}
+
+/* Splits the query into a vector of tokens */
+static vector_t *tokenize_query(char *query) {
     char *term;
-    list_t *processed;
-    processed = list_create(compare_strings);
+    vector_t *processed;
+    processed = vector_create(compare_strings);
 
     while (*query != '\0') {
         if (isspace(*query)) {
@@ -121,11 +205,14 @@ static list_t *tokenize_query(char *query) {
             query++;
             continue;
         } else if (*query == '(') {
-            list_addlast(processed, strdup("("));
+            vector_push(processed, strdup("("));
             query++;
         } else if (*query == ')') {
-            list_addlast(processed, strdup(")"));
+            vector_push(processed, strdup(")"));
             query++;
+        } else if (*query == '"') {
+            /* "quoted phrase" */
+            vector_push(processed, phrase_token(query, &query));
         } else {
             /* Get length of term */
             char *s;
@@ -135,8 +222,8 @@ static list_t *tokenize_query(char *query) {
             term = substring(query, s);
             query = s;
 
-            /* add to list */
-            list_addlast(processed, term);
+            /* add to vector */
+            vector_push(processed, term);
         }
     }
 
@@ -147,20 +234,19 @@ static list_t *tokenize_query(char *query) {
  * Processes and tokenizes the query. Would normally include
  * stemming and stopword removal
  */
-static list_t *preprocess_query(char *query) {
+static vector_t *preprocess_query(char *query) {
     char *word, *c, *prev;
-    list_t *tokens;
-    list_t *processed;
-    list_iter_t *iter;
+    vector_t *tokens;
+    vector_t *processed;
+    int i;
 
     /* Create tokens */
     tokens = tokenize_query(query);
-    processed = list_create(compare_strings);
+    processed = vector_create(compare_strings);
     prev = NULL;
 
-    iter = list_createiter(tokens);
-    while (list_hasnext(iter)) {
-        word = list_next(iter);
+    for (i = 0; i < vector_size(tokens); i++) {
+        word = vector_get(tokens, i);
 
         /* Is a word */
         if (!is_reserved_word(word)) {
@@ -173,28 +259,27 @@ static list_t *preprocess_query(char *query) {
 
             /* Adjacent words */
             if (prev != NULL && !is_reserved_word(prev)) {
-                list_addlast(processed, strdup("OR"));
+                vector_push(processed, strdup("OR"));
             }
         }
         /* Add to processed tokens */
-        list_addlast(processed, word);
+        vector_push(processed, word);
         prev = word;
     }
 
-    list_destroyiter(iter);
-    list_destroy(tokens);
+    vector_destroy(tokens);
 
     return processed;
 }
-// static void send_results(FILE *f, char *query, list_t *results, unsigned long long *time) {
+// static void send_results(FILE *f, char *query, vector_t *results, unsigned long long *time) {
 
-static void send_results(FILE *f, char *query, list_t *results, unsigned long long t_time) {
+static void send_results(FILE *f, char *query, vector_t *results, unsigned long long t_time) {
     char *tmp;
-    list_iter_t *it;
+    int i;
 
     tmp = html_escape(query);
 
-    int n_results = list_size(results);
+    int n_results = vector_size(results);
     double ms_time = (float)(t_time) / 1000;
 
     fprintf(f, "<hr/><h3>Your query for \"%s\" returned %d result%s in %.3fms</h3>\n",
@@ -203,9 +288,8 @@ static void send_results(FILE *f, char *query, list_t *results, unsigned long lo
     free(tmp);
 
     fprintf(f, "<ol id=\"results\">\n");
-    it = list_createiter(results);
-    while (list_hasnext(it)) {
-        query_result_t *res = list_next(it);
+    for (i = 0; i < n_results; i++) {
+        query_result_t *res = vector_get(results, i);
         tmp = html_escape(res->path + 1);
         fprintf(f, "<li><span class=\"score\">[%.2lf]</span> <a href=\"/indexed_files/%s\">%s</a></li>\n",
                 res->score, tmp, tmp);
@@ -214,45 +298,42 @@ static void send_results(FILE *f, char *query, list_t *results, unsigned long lo
         free(tmp);
         free(res);
     }
-    list_destroyiter(it);
 
     fprintf(f, "</ol>\n");
 }
 
 static void run_query(FILE *f, char *query) {
     char *errmsg;
-    list_t *result;
-    list_t *tokens = NULL;
-    list_iter_t *iter;
+    vector_t *result;
+    vector_t *tokens = NULL;
+    int i;
 
     tokens = preprocess_query(query);
 
     /* Don't run query if query is empty */
-    if (!list_size(tokens))
+    if (!vector_size(tokens))
         goto end;
 
     unsigned long long a_time = gettime();
 
-    result = index_query(idx, tokens, &errmsg);
+    result = qcache_query(query_cache, idx, tokens, &errmsg);
 
     if (result != NULL){
         send_results(f, query, result, (gettime() - a_time));
-        list_destroy(result);
+        vector_destroy(result);
     } else {
         fprintf(f, "<hr/><h3>Error</h3>\n");
         fprintf(f, "<p>Your query for \"%s\" caused the following error(s): <b>%s</b></p>\n", query, errmsg);
     }
 
     /* Cleanup */
-    iter = list_createiter(tokens);
-    while (list_hasnext(iter)) {
-        free(list_next(iter));
+    for (i = 0; i < vector_size(tokens); i++) {
+        free(vector_get(tokens, i));
     }
-    list_destroyiter(iter);
 
 end:
     if (tokens) {
-        list_destroy(tokens);
+        vector_destroy(tokens);
     }
 }
 
@@ -269,61 +350,237 @@ static void print_title(FILE *fp, char *query) {
     fprintf(fp, "%s", title);
 }
 
-static void parse_html_template(FILE *in, FILE *out, char *query) {
-    char *tok, *c, *line = NULL;
-    size_t len = 0;
-    int i, read, found, num_tokens;
+/*
+ * Compiles the template at the given path into a sequence of chunks.
+ * Returns 0 on success, or -1 if the template could not be read.
+ */
+static int compile_template(struct template *tpl, const char *path) {
+    struct stat st;
+    struct tpl_chunk *chunks = NULL;
+    char *src = NULL, *p, *tag, *end;
+    int i, n_chunks = 0, max_chunks;
+    FILE *in;
+
+    if (!(in = fopen(path, "r"))) {
+        return -1;
+    }
 
-    num_tokens = NUM_TAGS;
+    if (fstat(fileno(in), &st) < 0 || !(src = malloc(st.st_size + 1))) {
+        goto error;
+    }
 
-    while ((read = (int) getline(&line, &len, in)) != -1) {
-        if ((tok = strstr(line, "<#="))) {
-            *tok = 0;
-            fprintf(out, "%s", line);
-            *tok = '<';
+    if (fread(src, 1, st.st_size, in) != (size_t)st.st_size) {
+        goto error;
+    }
+    src[st.st_size] = 0;
 
-            tok += 3;
+    /* worst case: a static chunk before each tag, plus a final static chunk */
+    max_chunks = 1;
+    for (p = src; (p = strstr(p, "<#=")); p += 3) {
+        max_chunks += 2;
+    }
+    if (!(chunks = malloc(max_chunks * sizeof(struct tpl_chunk)))) {
+        goto error;
+    }
 
-            c = strchr(tok, '>');
-            if (c) {
-                *c++ = 0;
+    p = src;
+    tag = src;
+    while ((tag = strstr(tag, "<#="))) {
+        end = strchr(tag + 3, '>');
+        if (!end) {
+            break;
+        }
 
-                found = 0;
-                for (i = 0; i < num_tokens; i++) {
-                    if (strcmp(tok, tag_mappings[i].tag) != 0) {
-                        continue;
-                    }
+        for (i = 0; i < NUM_TAGS; i++) {
+            if ((end - (tag + 3)) == (int)strlen(tag_mappings[i].tag)
+                && strncmp(tag + 3, tag_mappings[i].tag, end - (tag + 3)) == 0) {
+                break;
+            }
+        }
 
-                    tag_mappings[i].render (out, query);
-                    found = 1;
+        if (i == NUM_TAGS) {
+            /* unknown tag, leave it in place as text */
+            tag += 3;
+            continue;
+        }
 
-                    break;
-                }
+        if (tag > p) {
+            chunks[n_chunks++] = (struct tpl_chunk){ p, tag - p, NULL };
+        }
+        chunks[n_chunks++] = (struct tpl_chunk){ NULL, 0, tag_mappings[i].render };
 
-                if (!found) {
-                    *(c-1) = '>';
-                    c = tok - 3;
-                }
-            } else {
-                c = tok - 3;
-            }
-            fprintf(out, "%s", c);
-        } else {
-            fprintf(out, "%s", line);
+        p = tag = end + 1;
+    }
+
+    if (*p) {
+        chunks[n_chunks++] = (struct tpl_chunk){ p, strlen(p), NULL };
+    }
+    fclose(in);
+
+    free(tpl->src);
+    free(tpl->chunks);
+    tpl->src = src;
+    tpl->chunks = chunks;
+    tpl->n_chunks = n_chunks;
+    tpl->mtime = st.st_mtime;
+    tpl->checked = gettime();
+
+    return 0;
+
+error:
+    fclose(in);
+    free(src);
+    free(chunks);
+    return -1;
+}
+
+/*
+ * Recompiles the template if its file has been modified.
+ * Checks the file at most once every TEMPLATE_RECHECK_US.
+ * On failure, the previously compiled template is kept.
+ */
+static void refresh_template(struct template *tpl, const char *path) {
+    struct stat st;
+    unsigned long long now = gettime();
+
+    if (now - tpl->checked < TEMPLATE_RECHECK_US) {
+        return;
+    }
+    tpl->checked = now;
+
+    if (stat(path, &st) == 0 && st.st_mtime != tpl->mtime) {
+        if (compile_template(tpl, path) != 0) {
+            ERROR_PRINT("failed to reload template '%s'\n", path);
+        }
+    }
+}
+
+/* Writes all of the given buffers, continuing after partial writes. */
+static int writev_all(int fd, struct iovec *iov, int iovcnt) {
+    ssize_t n;
+
+    while (iovcnt > 0) {
+        n = writev(fd, iov, (iovcnt > IOV_MAX) ? IOV_MAX : iovcnt);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+
+        /* skip the buffers that were written in full */
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
         }
     }
+    return 0;
+}
+
+/*
+ * Renders the compiled template. The dynamic chunks are rendered into a
+ * single memory stream, then all chunks are sent with one writev call.
+ */
+static void render_template(struct template *tpl, FILE *out, char *query) {
+    char *dynbuf = NULL;
+    size_t dynlen = 0;
+    long end;
+    FILE *dyn;
+    int i;
 
-    if (line) {
-        free(line);
+    /* an empty template has no chunks, and renders nothing */
+    if (tpl->n_chunks == 0) {
+        return;
     }
+
+    struct iovec iov[tpl->n_chunks];
+    long offsets[tpl->n_chunks];
+
+    if (!(dyn = open_memstream(&dynbuf, &dynlen))) {
+        return;
+    }
+
+    for (i = 0; i < tpl->n_chunks; i++) {
+        if (tpl->chunks[i].render) {
+            fflush(dyn);
+            offsets[i] = (long)dynlen;
+            tpl->chunks[i].render(dyn, query);
+        }
+    }
+    fclose(dyn);
+
+    /* The stream may have moved its buffer while rendering, so resolve chunks last.
+     * Each rendered chunk ends where the next rendered chunk begins. */
+    end = (long)dynlen;
+    for (i = tpl->n_chunks - 1; i >= 0; i--) {
+        if (tpl->chunks[i].render) {
+            iov[i].iov_base = dynbuf + offsets[i];
+            iov[i].iov_len = end - offsets[i];
+            end = offsets[i];
+        } else {
+            iov[i].iov_base = (void *)tpl->chunks[i].data;
+            iov[i].iov_len = tpl->chunks[i].len;
+        }
+    }
+
+    fflush(out);
+    writev_all(fileno(out), iov, tpl->n_chunks);
+
+    free(dynbuf);
 }
 
 static void handle_query(FILE *f, char *query) {
+    refresh_template(&page_template, TEMPLATE_PATH);
+
     http_ok(f, "text/html");
+    render_template(&page_template, f, query);
+}
+
+/* Writes the given string as the contents of a JSON string */
+static void print_json_string(FILE *f, const char *s) {
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(f, "\\%c", *s);
+        } else if ((unsigned char)*s < 0x20) {
+            fprintf(f, "\\u%04x", (unsigned char)*s);
+        } else {
+            fputc(*s, f);
+        }
+    }
+}
+
+/*
+ * Sends the top completions of the given prefix, ranked by the number of
+ * documents containing them, as a JSON array of words.
+ */
+static void handle_suggest(FILE *f, char *prefix) {
+    char *terms[SUGGEST_RESULTS];
+    char *word, *c;
+    int i, n = 0;
+
+    /* words are indexed in lowercase */
+    word = strdup(prefix);
+    if (word != NULL) {
+        for (c = word; *c; c++) {
+            *c = tolower(*c);
+        }
+        n = index_suggest(idx, word, terms, SUGGEST_RESULTS);
+        free(word);
+    }
 
-    FILE *tpl = fopen("template.html", "r");
-    parse_html_template(tpl, f, query);
-    fclose(tpl);
+    http_ok(f, "application/json");
+    fputc('[', f);
+    for (i = 0; i < n; i++) {
+        fputs((i > 0) ? ",\"" : "\"", f);
+        print_json_string(f, terms[i]);
+        fputc('"', f);
+    }
+    fputs("]\n", f);
 }
 
 static const char *get_mime_type(const char *path) {
@@ -351,60 +608,45 @@ end:
     return type;
 }
 
-static void handle_page(FILE *f, char *path, char *query) {
-    int in_root = 0;
+static void handle_page(http_request_t *req, FILE *f, char *path) {
     const char *idx_prefix = "indexed_files";
-    char *fullpath;
-    FILE *pagef;
+    const char *mime_type;
+    char fullpath[PATH_MAX];
+    int n;
+
+    /* Never serve files outside of the static and search directories,
+     * i.e. reject absolute paths (such as a request for //etc/passwd) and parent references */
+    if (path[0] == '/' || strstr(path, "..")) {
+        http_notfound(f, path);
+        return;
+    }
 
     /* If path starts with "/indexed_files", the request is for a file in the search
      * directory (root_dir), else, the request is for a file in the static directory.
+     * Consider MIME-type if serving a file in the same directory as the indexer application.
      */
     if (strncmp(path, idx_prefix, strlen(idx_prefix)) == 0) {
-        in_root = 0;
-        fullpath = concatenate_strings(2, root_dir, path + strlen(idx_prefix));
+        n = snprintf(fullpath, sizeof(fullpath), "%s%s", root_dir, path + strlen(idx_prefix));
+        mime_type = "text/html";
     } else {
-        in_root = 1;
-        fullpath = strdup(path);
+        n = snprintf(fullpath, sizeof(fullpath), "%s", path);
+        mime_type = get_mime_type(fullpath);
     }
 
-    if (!is_valid_file(fullpath)) {
+    if (n >= sizeof(fullpath)
+        || filecache_send(page_cache, f, fullpath, mime_type,
+                          http_get_header(req, "If-None-Match"),
+                          http_get_header(req, "If-Modified-Since")) != 0) {
         http_notfound(f, path);
-        return;
     }
-
-    pagef = fopen(fullpath, "r");
-
-    if (pagef == NULL) {
-        http_notfound(f, path);
-    } else {
-        char buf[1024];
-        size_t n;
-
-        /* Consider MIME-type if serving a file in the same directory
-         * as the indexer application.
-         */
-        if (in_root) {
-            http_ok(f, get_mime_type(fullpath));
-        } else {
-            http_ok(f, "text/html");
-        }
-
-        while (!feof(pagef)) {
-            n = fread(buf, 1, sizeof(buf), pagef);
-            fwrite(buf, 1, n, f);
-        }
-        fclose(pagef);
-    }
-
-    free(fullpath);
 }
 
-static int http_handler(char *path, map_t *header, map_t *args, FILE *f) {
-    char *query = "";
+static int http_handler(http_request_t *req, FILE *f) {
+    char *path = http_get_path(req);
+    char *query = http_get_arg(req, "query");
 
-    if (map_haskey(args, "query")) {
-        query = map_get(args, "query");
+    if (!query) {
+        query = "";
     }
 
     if (strcmp(path, "/") == 0) {
@@ -413,8 +655,16 @@ static int http_handler(char *path, map_t *header, map_t *args, FILE *f) {
         handle_query(f, query);
         pthread_mutex_unlock(&query_lock);
     }
+    else if (strcmp(path, "/suggest") == 0) {
+        char *prefix = http_get_arg(req, "q");
+
+        /* the index may freeze its dictionary, so this is serialized as well */
+        pthread_mutex_lock(&query_lock);
+        handle_suggest(f, prefix ? prefix : "");
+        pthread_mutex_unlock(&query_lock);
+    }
     else if (path[0] == '/') {
-        handle_page(f, path+1, query);
+        handle_page(req, f, path+1);
     }
 
     return 0;
@@ -422,8 +672,10 @@ static int http_handler(char *path, map_t *header, map_t *args, FILE *f) {
 
 int main(int argc, char **argv) {
     int status;
+    unsigned long hits, misses;
     char *relpath, *fullpath;
-    list_t *files, *words;
+    list_t *files;
+    vector_t *words;
     list_iter_t *iter;
 
     if (argc != 2) {
@@ -443,7 +695,8 @@ int main(int argc, char **argv) {
 
     files = find_files(root_dir);
     idx = index_create();
-    if (idx == NULL) { 
+    words = vector_create((cmpfunc_t)strcmp);
+    if (idx == NULL || words == NULL) { 
         printf("Failed to create index\n");
         return 1;
     }
@@ -462,21 +715,44 @@ int main(int argc, char **argv) {
             fflush(stdout);
         }
 
-        words = list_create((cmpfunc_t)strcmp);
+        /* the words are owned by the index, so the vector is reused */
+        vector_clear(words);
         tokenize_file(fullpath, words);
 
         index_addpath(idx, relpath, words);
 
         free(fullpath);
-        list_destroy(words);
     }
 
+    vector_destroy(words);
     list_destroyiter(iter);
     list_destroy(files);
 
+    if (compile_template(&page_template, TEMPLATE_PATH) != 0) {
+        printf("Failed to read template '%s'\n", TEMPLATE_PATH);
+        return 1;
+    }
+
+    query_cache = qcache_create(QUERY_CACHE_BYTES);
+    if (query_cache == NULL) {
+        printf("Failed to create query cache\n");
+        return 1;
+    }
+
+    page_cache = filecache_create(PAGE_CACHE_BYTES, PAGE_CACHE_ENTRIES);
+    if (page_cache == NULL) {
+        printf("Failed to create page cache\n");
+        return 1;
+    }
+
     printf("\nServing queries on port %s:%d\n", "127.0.0.1", (int)PORT_NUM);
 
     status = http_server((int)PORT_NUM, http_handler);
+    qcache_stats(query_cache, &hits, &misses, NULL);
+    printf("Query cache: %lu hits, %lu misses\n", hits, misses);
+
+    filecache_destroy(page_cache);
+    qcache_destroy(query_cache);
     index_destroy(idx);
 
     return status;
@@ -299,6 +299,16 @@ list_iter_t *list_createiter(list_t *list) {
     return iter;
 }
 
+/* Fails to compile unless list_iterbuf_t can hold the iterator */
+typedef char iterbuf_fits[(sizeof(list_iter_t) <= sizeof(list_iterbuf_t)) ? 1 : -1];
+
+list_iter_t *list_inititer(list_iterbuf_t *buf, list_t *list) {
+    list_iter_t *iter = (list_iter_t *)buf;
+
+    iter->node = list->head;
+    return iter;
+}
+
 void list_destroyiter(list_iter_t *iter) {
     free(iter);
 }
@@ -2,82 +2,96 @@
  * Simple stack implementation.
  * Named pile for the obvious namespace issues.
  * allows peeking and may clean the plates. (free elems)
+ *
+ * The plates are kept in an array, from the bottom up. The first
+ * PILE_INLINE plates are held within the pile itself, and the array moves
+ * to the heap, doubling, once the pile grows taller.
 */
 
 #include "pile.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 
-struct plate;
-typedef struct plate plate_t;
-
-struct plate {
-    void *elem;
-    plate_t *next;
-};
-
 struct pile {
+    void **plates;      /* plates[height - 1] is the top plate */
     int height;
-    plate_t *top;
+    int capacity;
+    void *inline_plates[PILE_INLINE];
 };
 
+typedef char pilebuf_fits[(sizeof(pile_t) <= sizeof(pile_buf_t)) ? 1 : -1];
+
+
+pile_t *pile_init(pile_buf_t *buf) {
+    pile_t *pile = (pile_t *)buf;
+
+    pile->plates = pile->inline_plates;
+    pile->height = 0;
+    pile->capacity = PILE_INLINE;
+    return pile;
+}
+
+void pile_finish(pile_t *pile) {
+    if (pile->plates != pile->inline_plates) {
+        free(pile->plates);
+    }
+}
 
 pile_t *pile_create() {
     pile_t *pile = malloc(sizeof(pile_t));
     if (pile == NULL) {
         return NULL;
     }
-
-    pile->height = 0;
-    pile->top = NULL;
-    return pile;
+    return pile_init((pile_buf_t *)pile);
 }
 
 void pile_destroy(pile_t *pile) {
-    plate_t *p;
-    while (pile->top != NULL) {
-        p = pile->top;
-        pile->top = pile->top->next;
-        free(p);
-    }
+    pile_finish(pile);
     free(pile);
 }
 
-void pile_push(pile_t *pile, void *elem) {
-    plate_t *p = malloc(sizeof(plate_t));
-    if (p != NULL) {
-        p->elem = elem;
-        p->next = pile->top;
-        pile->top = p;
-        pile->height++;
+int pile_push(pile_t *pile, void *elem) {
+    void **plates;
+
+    if (pile->height == pile->capacity) {
+        if (pile->plates == pile->inline_plates) {
+            plates = malloc(2 * pile->capacity * sizeof(void *));
+            if (plates != NULL) {
+                memcpy(plates, pile->inline_plates, pile->height * sizeof(void *));
+            }
+        } else {
+            plates = realloc(pile->plates, 2 * pile->capacity * sizeof(void *));
+        }
+        if (plates == NULL) {
+            return 0;
+        }
+        pile->plates = plates;
+        pile->capacity *= 2;
     }
+
+    pile->plates[pile->height++] = elem;
+    return 1;
 }
 
 void *pile_pop(pile_t *pile) {
     if (!pile->height) {
         return NULL;
     }
-
-    plate_t *p = pile->top;
-    void *elem = p->elem;
-    pile->top = p->next;
-
-    free(p);
-    pile->height--;
-
-    return elem;
+    return pile->plates[--pile->height];
 }
 
 void *pile_peek(pile_t *pile, int depth) {
     if (!pile->height) {
         return NULL;
     }
-
-    plate_t *p = pile->top;
-    for (int i = 0; (i < depth && p->next != NULL); p = p->next, i++);
-
-    return p->elem;
+    if (depth < 0) {
+        depth = 0;
+    } else if (depth >= pile->height) {
+        depth = pile->height - 1;
+    }
+    return pile->plates[pile->height - 1 - depth];
 }
 
 int pile_size(pile_t *pile) {
@@ -86,13 +100,8 @@ int pile_size(pile_t *pile) {
 
 void pile_cleanplates(pile_t *pile, void (*freefunc)(void *)) {
     if (freefunc != NULL) {
-        plate_t *p;
-        while (pile->top != NULL) {
-            p = pile->top;
-            pile->top = pile->top->next;
-            freefunc(p->elem);
-            free(p);
+        while (pile->height) {
+            freefunc(pile->plates[--pile->height]);
         }
-        pile->height = 0;
     }
 }
@@ -0,0 +1,525 @@
+/*
+ * LRU cache of query results, keyed on canonicalized queries.
+ * Entries are found through a map keyed on the canonical query, and
+ * ordered in a doubly linked list from most to least recently used.
+ */
+
+#include "querycache.h"
+#include "map.h"
+#include "printing.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#define CANON_MAXDEPTH  128   // max nesting of parentheses in a cacheable query
+
+/* Operators of canonical groups */
+typedef enum canon_op {
+    C_NONE   = 0,  // a single operand
+    C_OR     = 1,
+    C_AND    = 2,
+    C_ANDNOT = 3
+} canon_op_t;
+
+/*
+ * A group of operands sharing one operator, e.g. `a OR b OR c`.
+ * Operands are canonical strings. Groups are only collapsed into a
+ * string once complete, so nested groups of the same commutative
+ * operator may be flattened into their parent.
+ */
+typedef struct cgroup {
+    canon_op_t op;
+    char     **args;
+    int        n;
+    int        cap;
+} cgroup_t;
+
+typedef struct qc_entry qc_entry_t;
+
+struct qc_entry {
+    char           *key;
+    query_result_t *results;
+    int             n_results;
+    size_t          cost;     // bytes accounted for by this entry
+    qc_entry_t     *prev;     // more recently used
+    qc_entry_t     *next;     // less recently used
+};
+
+struct querycache {
+    pthread_mutex_t lock;
+    map_t         *entries;   // canonical query => qc_entry_t
+    qc_entry_t    *mru;
+    qc_entry_t    *lru;
+    size_t         bytes;
+    size_t         max_bytes;
+    unsigned long  version;   // index version of the cached entries
+    unsigned long  hits;
+    unsigned long  misses;
+};
+
+
+/******************************************************************************
+ *                           Query canonicalization                           *
+ ******************************************************************************/
+
+static canon_op_t canon_operator(const char *tok) {
+    if (strcmp(tok, "OR") == 0)
+        return C_OR;
+    if (strcmp(tok, "AND") == 0)
+        return C_AND;
+    if (strcmp(tok, "ANDNOT") == 0)
+        return C_ANDNOT;
+    return C_NONE;
+}
+
+static const char *canon_opname(canon_op_t op) {
+    switch (op) {
+        case C_OR:
+            return "OR";
+        case C_AND:
+            return "AND";
+        default:
+            return "ANDNOT";
+    }
+}
+
+static void group_clear(cgroup_t *g) {
+    int i;
+    for (i = 0; i < g->n; i++) {
+        free(g->args[i]);
+    }
+    free(g->args);
+    g->args = NULL;
+    g->n = g->cap = 0;
+    g->op = C_NONE;
+}
+
+static int group_add(cgroup_t *g, char *arg) {
+    if (g->n == g->cap) {
+        int cap = g->cap ? g->cap * 2 : 4;
+        char **args = realloc(g->args, cap * sizeof(char *));
+        if (!args) {
+            free(arg);
+            return -1;
+        }
+        g->args = args;
+        g->cap = cap;
+    }
+    g->args[g->n++] = arg;
+    return 0;
+}
+
+static int compare_args(const void *a, const void *b) {
+    return strcmp(*(char **)a, *(char **)b);
+}
+
+/*
+ * Collapses the group into its canonical string, leaving the group empty.
+ * Operands of commutative operators are sorted, and duplicates removed.
+ */
+static char *group_collapse(cgroup_t *g) {
+    char *s, *p;
+    size_t len;
+    int i, n;
+
+    if (g->op == C_OR || g->op == C_AND) {
+        qsort(g->args, g->n, sizeof(char *), compare_args);
+
+        /* `x OR x` == `x AND x` == x */
+        for (i = 1, n = 1; i < g->n; i++) {
+            if (strcmp(g->args[i], g->args[n - 1]) == 0) {
+                free(g->args[i]);
+            } else {
+                g->args[n++] = g->args[i];
+            }
+        }
+        g->n = n;
+    }
+
+    if (g->n == 1) {
+        s = g->args[0];
+        g->n = 0;
+        group_clear(g);
+        return s;
+    }
+
+    len = strlen(canon_opname(g->op)) + 3;
+    for (i = 0; i < g->n; i++) {
+        len += strlen(g->args[i]) + 1;
+    }
+
+    s = p = malloc(len);
+    if (s) {
+        p += sprintf(p, "(%s", canon_opname(g->op));
+        for (i = 0; i < g->n; i++) {
+            p += sprintf(p, " %s", g->args[i]);
+        }
+        sprintf(p, ")");
+    }
+    group_clear(g);
+
+    return s;
+}
+
+/*
+ * Adds a parsed operand group to g. If both share the same commutative
+ * operator, the operands are moved into g, otherwise the operand is collapsed.
+ */
+static int group_merge(cgroup_t *g, cgroup_t *operand) {
+    int i;
+
+    if (operand->op == g->op && (g->op == C_OR || g->op == C_AND)) {
+        for (i = 0; i < operand->n; i++) {
+            if (group_add(g, operand->args[i]) != 0) {
+                operand->n = 0;
+                group_clear(operand);
+                return -1;
+            }
+        }
+        operand->n = 0;
+        group_clear(operand);
+        return 0;
+    }
+
+    char *s = group_collapse(operand);
+    return s ? group_add(g, s) : -1;
+}
+
+static int canon_expr(char **toks, int n_toks, int *pos, int depth, cgroup_t *g);
+
+/* Parses a single <word>, parenthesized query or NOT of either into g. */
+static int canon_primary(char **toks, int n_toks, int *pos, int depth, cgroup_t *g) {
+    cgroup_t operand = { C_NONE, NULL, 0, 0 };
+    char *tok, *word, *c, *s;
+
+    if (*pos >= n_toks) {
+        return -1;
+    }
+    tok = toks[(*pos)++];
+
+    if (strcmp(tok, "(") == 0) {
+        if (depth >= CANON_MAXDEPTH || canon_expr(toks, n_toks, pos, depth + 1, g) != 0) {
+            return -1;
+        }
+        if (*pos >= n_toks || strcmp(toks[*pos], ")") != 0) {
+            group_clear(g);
+            return -1;
+        }
+        (*pos)++;
+        return 0;
+    }
+
+    if (strcmp(tok, "NOT") == 0) {
+        /* a single operand, "(NOT x)" */
+        if (depth >= CANON_MAXDEPTH || canon_primary(toks, n_toks, pos, depth + 1, &operand) != 0) {
+            return -1;
+        }
+        if (!(s = group_collapse(&operand))) {
+            return -1;
+        }
+        word = malloc(strlen(s) + 7);
+        if (word) {
+            sprintf(word, "(NOT %s)", s);
+        }
+        free(s);
+        g->op = C_NONE;
+        return word ? group_add(g, word) : -1;
+    }
+
+    if (strcmp(tok, ")") == 0 || canon_operator(tok) != C_NONE) {
+        return -1;
+    }
+
+    if (!(word = strdup(tok))) {
+        return -1;
+    }
+    for (c = word; *c; c++) {
+        *c = tolower(*c);
+    }
+
+    g->op = C_NONE;
+    return group_add(g, word);
+}
+
+/*
+ * Parses a query up to a closing parenthesis or the end of the tokens into g.
+ * Operators are evaluated left to right, as done by the query parser.
+ */
+static int canon_expr(char **toks, int n_toks, int *pos, int depth, cgroup_t *g) {
+    cgroup_t operand = { C_NONE, NULL, 0, 0 };
+    canon_op_t op;
+    char *s;
+
+    if (canon_primary(toks, n_toks, pos, depth, g) != 0) {
+        return -1;
+    }
+
+    while (*pos < n_toks && strcmp(toks[*pos], ")") != 0) {
+        op = canon_operator(toks[(*pos)++]);
+        if (op == C_NONE) {
+            goto error;
+        }
+
+        if (canon_primary(toks, n_toks, pos, depth, &operand) != 0) {
+            goto error;
+        }
+
+        if (g->op != op || op == C_ANDNOT) {
+            /* the left hand side becomes the first operand of a new group */
+            if (!(s = group_collapse(g))) {
+                goto error;
+            }
+            g->op = op;
+            if (group_add(g, s) != 0) {
+                goto error;
+            }
+        }
+
+        if (group_merge(g, &operand) != 0) {
+            goto error;
+        }
+    }
+    return 0;
+
+error:
+    group_clear(&operand);
+    group_clear(g);
+    return -1;
+}
+
+char *qcache_canonicalize(vector_t *tokens) {
+    cgroup_t g = { C_NONE, NULL, 0, 0 };
+    char **toks = (char **)vector_elems(tokens), *key = NULL;
+    int pos = 0, n_toks = vector_size(tokens);
+
+    if (!n_toks) {
+        return NULL;
+    }
+
+    if (canon_expr(toks, n_toks, &pos, 0, &g) == 0) {
+        if (pos == n_toks) {
+            key = group_collapse(&g);
+        } else {
+            /* unmatched closing parenthesis */
+            group_clear(&g);
+        }
+    }
+
+    return key;
+}
+
+
+/******************************************************************************
+ *                                 LRU cache                                  *
+ ******************************************************************************/
+
+querycache_t *qcache_create(size_t max_bytes) {
+    querycache_t *cache = malloc(sizeof(querycache_t));
+    if (cache == NULL) {
+        ERROR_PRINT("out of memory");
+        return NULL;
+    }
+
+    cache->entries = map_create(compare_strings, hash_string);
+    if (cache->entries == NULL) {
+        free(cache);
+        return NULL;
+    }
+
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->mru = NULL;
+    cache->lru = NULL;
+    cache->bytes = 0;
+    cache->max_bytes = max_bytes;
+    cache->version = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+
+    return cache;
+}
+
+static void lru_unlink(querycache_t *cache, qc_entry_t *e) {
+    if (e->prev) {
+        e->prev->next = e->next;
+    } else {
+        cache->mru = e->next;
+    }
+
+    if (e->next) {
+        e->next->prev = e->prev;
+    } else {
+        cache->lru = e->prev;
+    }
+    e->prev = e->next = NULL;
+}
+
+static void lru_pushfront(querycache_t *cache, qc_entry_t *e) {
+    e->prev = NULL;
+    e->next = cache->mru;
+    if (cache->mru) {
+        cache->mru->prev = e;
+    } else {
+        cache->lru = e;
+    }
+    cache->mru = e;
+}
+
+static void cache_evict(querycache_t *cache, qc_entry_t *e) {
+    map_remove(cache->entries, e->key);
+    lru_unlink(cache, e);
+    cache->bytes -= e->cost;
+
+    free(e->key);
+    free(e->results);
+    free(e);
+}
+
+static void cache_flush(querycache_t *cache) {
+    while (cache->lru) {
+        cache_evict(cache, cache->lru);
+    }
+}
+
+void qcache_destroy(querycache_t *cache) {
+    cache_flush(cache);
+    map_destroy(cache->entries, NULL, NULL);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+void qcache_stats(querycache_t *cache, unsigned long *hits, unsigned long *misses, size_t *bytes) {
+    pthread_mutex_lock(&cache->lock);
+    if (hits) *hits = cache->hits;
+    if (misses) *misses = cache->misses;
+    if (bytes) *bytes = cache->bytes;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/* Returns a vector of copies of the entry's results, as index_query would. */
+static vector_t *entry_results(qc_entry_t *e) {
+    vector_t *results = vector_create(compare_pointers);
+    query_result_t *res;
+    int i;
+
+    if (!results || !vector_reserve(results, e->n_results)) {
+        goto error;
+    }
+
+    for (i = 0; i < e->n_results; i++) {
+        if (!(res = malloc(sizeof(query_result_t)))) {
+            goto error;
+        }
+        *res = e->results[i];
+        vector_push(results, res);
+    }
+    return results;
+
+error:
+    if (results) {
+        while ((res = vector_pop(results)) != NULL) {
+            free(res);
+        }
+        vector_destroy(results);
+    }
+    return NULL;
+}
+
+/* Creates an entry holding a copy of the given results. Takes ownership of key. */
+static qc_entry_t *entry_create(char *key, vector_t *results) {
+    qc_entry_t *e = malloc(sizeof(qc_entry_t));
+    int i;
+
+    if (!e) {
+        return NULL;
+    }
+
+    e->n_results = vector_size(results);
+    e->results = malloc((e->n_results ? e->n_results : 1) * sizeof(query_result_t));
+    if (!e->results) {
+        free(e);
+        return NULL;
+    }
+
+    for (i = 0; i < e->n_results; i++) {
+        e->results[i] = *(query_result_t *)vector_get(results, i);
+    }
+
+    e->key = key;
+    e->cost = sizeof(qc_entry_t) + strlen(key) + 1 + e->n_results * sizeof(query_result_t);
+    e->prev = e->next = NULL;
+
+    return e;
+}
+
+vector_t *qcache_query(querycache_t *cache, index_t *index, vector_t *tokens, char **errmsg) {
+    unsigned long version = index_version(index);
+    vector_t *results;
+    qc_entry_t *e;
+    char *key;
+
+    key = qcache_canonicalize(tokens);
+    if (!key) {
+        /* not a valid query, let the index report the error */
+        return index_query(index, tokens, errmsg);
+    }
+
+    pthread_mutex_lock(&cache->lock);
+
+    if (cache->version != version) {
+        /* the index has changed since the entries were cached */
+        cache_flush(cache);
+        cache->version = version;
+    }
+
+    e = map_get(cache->entries, key);
+    if (e) {
+        cache->hits++;
+        lru_unlink(cache, e);
+        lru_pushfront(cache, e);
+        results = entry_results(e);
+        pthread_mutex_unlock(&cache->lock);
+
+        free(key);
+        if (!results) {
+            *errmsg = "failed to allocate memory";
+        }
+        return results;
+    }
+
+    cache->misses++;
+    pthread_mutex_unlock(&cache->lock);
+
+    results = index_query(index, tokens, errmsg);
+    if (!results || !(e = entry_create(key, results))) {
+        free(key);
+        return results;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+
+    if (cache->version != version || e->cost > cache->max_bytes) {
+        /* stale, or too large to be cached */
+        free(e->key);
+        free(e->results);
+        free(e);
+    } else {
+        qc_entry_t *old = map_get(cache->entries, e->key);
+        if (old) {
+            cache_evict(cache, old);
+        }
+
+        while (cache->lru && cache->bytes + e->cost > cache->max_bytes) {
+            cache_evict(cache, cache->lru);
+        }
+
+        map_put(cache->entries, e->key, e);
+        lru_pushfront(cache, e);
+        cache->bytes += e->cost;
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+
+    return results;
+}
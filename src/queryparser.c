@@ -5,56 +5,112 @@
 #include "queryparser.h"
 #include "pile.h"
 #include "map.h"
+#include "setcache.h"
+#include "cursor.h"
 
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 
 #define ERRMSG_MAXLEN  254
-
-typedef enum qnode_types qnode_types_t;
-typedef struct qnode qnode_t;
+#define KEY_MAXLEN     1024  // subqueries with longer canonical forms are not cached
+#define EVAL_MAXDEPTH  64    // cursor trees growing any deeper are collected into a set
+#define NEAR_MAXWINDOW 1000  // bound on k in `a NEAR/k b`
+#define PATTERN_MAXTERMS 256 // bound on the number of terms a pattern may expand to
+
+typedef enum qtok_types qtok_types_t;
+typedef struct qinstr qinstr_t;
+typedef struct qterm qterm_t;
 typedef struct parser parser_t;
 
 
 struct parser {
     void        *parent;
     term_func_t term_func;
-    qnode_t     *leftmost;
+    bitmap_func_t bitmap_func; // resolves terms to bitmaps, NULL if unsupported
+    batch_func_t batch_func;   // resolves the terms of a query at once, NULL if unsupported
+    universe_func_t universe_func; // all documents, for NOT. NULL if unsupported
+    phrase_func_t phrase_func; // resolves phrases and NEAR terms, NULL if unsupported
+    expand_func_t expand_func; // expands patterns into terms, NULL if unsupported
     char        *errmsg_buf;
+    qinstr_t    *prog;        // postfix program of the scanned query
+    int          prog_len;
+    qterm_t     *stack;       // operand stack used to evaluate prog
+    char       **words;       // distinct <word>'s of the scanned query, see resolve_words
+    set_t      **word_prods;  // results of each of words
+    roaring_t  **word_bits;
+    qtok_types_t *ops;        // operator stack used to compile prog
+    int          capacity;    // number of tokens prog, stack and ops have room for
+    int          max_tokens;  // queries with more tokens are rejected, 0 = no limit
+    setcache_t  *cache;       // results of subqueries, NULL if caching is disabled
+    pile_t      *held;        // cache entries referenced by the query being evaluated
+    pile_t      *temps;       // sets collected while evaluating the query, see materialize
+    pile_t      *keys;        // keys built for NEAR terms while scanning
 };
 
-/* Types of query node (qnode_t->type).
+/* Types of query tokens.
  * Note: `is_operator` relies on operators being defined > 0 */
-enum qnode_types {
-    TERM      =  0,  // Terminated node. All perator nodes end up as a TERM.
+enum qtok_types {
+    WORD      =  0,
     OP_OR     =  1,
     OP_AND    =  2,
     OP_ANDNOT =  3,
+    OP_NOT    =  4,  // unary, binding tighter than the other operators
     L_PAREN   = -2,
-    R_PAREN   = -1
+    R_PAREN   = -1,
+    NONE      = -3,  // no token, e.g. prior to the first token
+    NEAR      = -4   // binds the adjacent <word>'s into a single term, see scan_near
+};
+
+/* Instruction of a compiled query: a <word> to push, or an operator to apply */
+struct qinstr {
+    qtok_types_t type;
+    char     *token;
+    set_t    *prod;       // For <word>'s, points directly to an iword->paths (or NULL)
+    roaring_t *bits;      // For <word>'s, points directly to an iword->bits (or NULL)
+    int       deferred;   // Whether the <word> is resolved once the query is scanned
 };
 
-/* Type of query node */
-struct qnode {
-    qnode_types_t type;
-    qnode_t  *left;
-    qnode_t  *right;
-    qnode_t  *sibling;    // For matching left/right parentheses
-    set_t    *prod;       // Product of a TERM. For <word>'s, points directly to an iword->paths (or NULL)
-    int       free_prod;  // Whether product is result of an operation or points to some iword->paths
+/* Operand on the evaluation stack */
+struct qterm {
+    set_t    *prod;       // Points directly to an iword->paths or a cached set (or NULL)
+    roaring_t *bits;      // Points directly to an iword->bits (or NULL)
+    cursor_t *cur;        // Result of an operation, streamed on demand (or NULL)
+    char     *key;        // Canonical form of the (sub)query producing the term, or NULL
+    int       free_key;   // Whether key was built by the parser or points to a token
+    int       negated;    // Whether the term is the complement of its product, see eval_not
 };
 
 
 /* declarations of static functions to allow reference prior to initialization. */
 
-static qnode_t *parse_node(qnode_t *node);
-static qnode_t *term_andnot(qnode_t *oper);
-static qnode_t *term_and(qnode_t *oper);
-static qnode_t *term_or(qnode_t *oper);
-static qnode_t *splice_nodes(qnode_t *a, qnode_t *z);
-static int is_operator(qnode_t *node);
-static void destroy_product(qnode_t *term);
-static void destroy_querynodes(qnode_t *leftmost);
+static int reserve(parser_t *parser, int n_tokens);
+static void lookup_term(parser_t *parser, char *word, set_t **prod, roaring_t **bits);
+static void resolve_words(parser_t *parser, int n_words, map_t *searched_words, map_t *searched_bits);
+static char *scan_phrase(parser_t *parser, qinstr_t *instr);
+static char *scan_near(parser_t *parser, qinstr_t *instr, char *token, int window);
+static char *scan_pattern(parser_t *parser, qinstr_t *instr);
+static set_t *held_product(parser_t *parser, char *key);
+static set_t *keep_product(parser_t *parser, char *key, set_t *set);
+static set_t *positional_product(parser_t *parser, char *key, char **words, int n_words, int window);
+static void release_query(parser_t *parser);
+static int is_plain_word(char *token);
+static int is_pattern(char *token);
+static void eval_operator(parser_t *parser, qtok_types_t op, qterm_t *a, qterm_t *c);
+static qtok_types_t rewrite_negations(qtok_types_t op, qterm_t *a, qterm_t *c, int *negate);
+static void eval_not(qterm_t *term);
+static void eval_complement(parser_t *parser, qterm_t *term);
+static void materialize(parser_t *parser, qterm_t *term);
+static int is_operator(qtok_types_t type);
+static int is_empty(qterm_t *term);
+static int same_product(qterm_t *a, qterm_t *c);
+static cursor_t *take_cursor(qterm_t *term);
+static void inherit_product(qterm_t *oper, qterm_t *term);
+static void destroy_product(qterm_t *term);
+static void destroy_key(qterm_t *term);
+static void combine_keys(parser_t *parser, qterm_t *oper, qterm_t *a, qterm_t *c, qtok_types_t op);
+static int cached_product(parser_t *parser, qterm_t *oper);
+static set_t *cache_result(parser_t *parser, qterm_t *term, set_t *result);
 
 
 /******************************************************************************
@@ -75,207 +131,389 @@ parser_t *parser_create(void *parent, term_func_t term_func) {
         return NULL;
     }
 
+    parser->held = pile_create();
+    parser->temps = pile_create();
+    parser->keys = pile_create();
+    if (!parser->held || !parser->temps || !parser->keys) {
+        if (parser->held) pile_destroy(parser->held);
+        if (parser->temps) pile_destroy(parser->temps);
+        if (parser->keys) pile_destroy(parser->keys);
+        free(parser->errmsg_buf);
+        free(parser);
+        return NULL;
+    }
+
     parser->parent = parent;
     parser->term_func = term_func;
-    parser->leftmost = NULL;
+    parser->bitmap_func = NULL;
+    parser->batch_func = NULL;
+    parser->universe_func = NULL;
+    parser->phrase_func = NULL;
+    parser->expand_func = NULL;
+    parser->prog = NULL;
+    parser->prog_len = 0;
+    parser->stack = NULL;
+    parser->words = NULL;
+    parser->word_prods = NULL;
+    parser->word_bits = NULL;
+    parser->ops = NULL;
+    parser->capacity = 0;
+    parser->max_tokens = 0;
+    parser->cache = NULL;
 
     return parser;
 }
 
 void parser_destroy(parser_t *parser) {
+    if (parser->cache) setcache_destroy(parser->cache);
+    pile_destroy(parser->held);
+    pile_destroy(parser->temps);
+    pile_destroy(parser->keys);
+    free(parser->prog);  // prog, stack, ops and the word arrays share one allocation
     free(parser->errmsg_buf);
     free(parser);
 }
 
+int parser_enable_cache(parser_t *parser, size_t max_elems) {
+    if (parser->cache) {
+        setcache_destroy(parser->cache);
+    }
+    parser->cache = setcache_create(max_elems);
+    return parser->cache ? 0 : -1;
+}
+
+void parser_invalidate(parser_t *parser) {
+    if (parser->cache) {
+        setcache_clear(parser->cache);
+    }
+}
+
+void parser_set_maxtokens(parser_t *parser, int max_tokens) {
+    parser->max_tokens = max_tokens;
+}
+
+void parser_set_phrase_func(parser_t *parser, phrase_func_t phrase_func) {
+    parser->phrase_func = phrase_func;
+}
+
+void parser_set_expand_func(parser_t *parser, expand_func_t expand_func) {
+    parser->expand_func = expand_func;
+}
+
+void parser_set_bitmap_func(parser_t *parser, bitmap_func_t bitmap_func) {
+    parser->bitmap_func = bitmap_func;
+}
+
+void parser_set_batch_func(parser_t *parser, batch_func_t batch_func) {
+    parser->batch_func = batch_func;
+}
+
+void parser_set_universe_func(parser_t *parser, universe_func_t universe_func) {
+    parser->universe_func = universe_func;
+}
+
 char *parser_get_errmsg(parser_t *parser) {
     return parser->errmsg_buf;
 }
 
-parser_status_t parser_scan(parser_t *parser, list_t *tokens) {
+parser_status_t parser_scan(parser_t *parser, vector_t *tokens) {
     /* This function is rather nested, but has a simple purpose:
      * 1. Validate the syntax of query tokens
-     * 2. 'converting' them into query nodes
+     * 2. Compile them into a postfix program (shunting-yard)
      * 3. Produce terminable tokens, determining if a scan is needed
      */
-
-    /* declare and initialize all pointers */
-    qnode_t *leftmost, *prev, *prev_nonpar, *node;
-    leftmost = prev = prev_nonpar = node = NULL;
-
-    char *errmsg = NULL, *token = NULL;
-    pile_t *paren_pile = NULL, *tok_pile = NULL;
-    list_iter_t *tok_iter = NULL;
+    qtok_types_t type, prev = NONE, prev_nonpar = NONE;
+    char *errmsg = NULL, *token = NULL, *prev_token = NULL;
     map_t *searched_words = NULL;
+    map_t *searched_bits = NULL;
     parser_status_t status = SKIP_PARSE;
+    qinstr_t *instr = NULL;
+    int n_ops = 0, depth = 0, n_tok = 0, n_toks = vector_size(tokens), plain = 0, n_words = 0, i;
+    long window = 0;
+    char *end;
+
+    parser->prog_len = 0;
+
+    if (parser->max_tokens && n_toks > parser->max_tokens) {
+        snprintf(parser->errmsg_buf, ERRMSG_MAXLEN,
+            "<br>Query too complex ~ %d tokens, at most %d are allowed.",
+            n_toks, parser->max_tokens);
+        return SYNTAX_ERROR;
+    }
 
     /* create temporary constructs */
-    tok_iter = list_createiter(tokens);
-    paren_pile = pile_create();
-    tok_pile = pile_create();
     searched_words = map_create((cmpfunc_t)strcmp, hash_string);
+    searched_bits = map_create((cmpfunc_t)strcmp, hash_string);
 
-    if (!searched_words || !paren_pile || !searched_words) {
+    if (!searched_words || !searched_bits || reserve(parser, n_toks) < 0) {
         status = ALLOC_FAILED;
         goto end;
     }
 
     /* loop until an error message is set, or there are no more tokens */
-    while (!errmsg && list_hasnext(tok_iter)) {
-        node = malloc(sizeof(qnode_t));
-        if (!node) {
-            status = ALLOC_FAILED;
-            goto end;
-        }
-        token = list_next(tok_iter);
-
-        /* initialize the node */
-        node->prod = NULL;
-        node->right = NULL;
-        node->sibling = NULL;
-        node->free_prod = 1;
-
-        /* match node type based on the token. */
-        if (token[0] == '(') {
-            node->type = L_PAREN;
-            pile_push(paren_pile, node);
-        } else if (token[0] == ')') {
-            node->type = R_PAREN;
+    while (!errmsg && n_tok < n_toks) {
+        prev_token = token;
+        token = vector_get(tokens, n_tok++);
+
+        /* match token type */
+        if (prev == NEAR) {
+            /* <word> NEAR/k <word> is a single term, replacing that of the first <word> */
+            type = WORD;
+            if (!is_plain_word(token)) {
+                errmsg = "Expected a word on either side of NEAR";
+            } else {
+                if (instr->deferred) {
+                    /* the results of the first <word> tell whether the term may have any */
+                    lookup_term(parser, instr->token, &instr->prod, &instr->bits);
+                    instr->deferred = 0;
+                }
+                errmsg = scan_near(parser, instr, token, window);
+                plain = 0;
+                prev_nonpar = WORD;
 
-            /* set the most recent parenthesis as sibling */
-            node->sibling = pile_pop(paren_pile);
+                if (instr->prod || instr->bits) {
+                    status = PARSE_READY;
+                }
+            }
+        } else if (token[0] == '(') {
+            type = L_PAREN;
+            parser->ops[n_ops++] = L_PAREN;
+            depth++;
+        } else if (token[0] == ')') {
+            type = R_PAREN;
 
             /* validate parentheses */
-            if (!node->sibling || !prev || !prev_nonpar) {
+            if (!depth || prev == NONE || prev_nonpar == NONE) {
                 errmsg = "Unexpected closing parenthesis";
-            } else if (prev == node->sibling || is_operator(prev_nonpar)) {
+            } else if (prev == L_PAREN || is_operator(prev_nonpar)) {
                 errmsg = "Expected a query within parentheses";
-            } else if (node->sibling->right == prev) {
-                /* the parentheses only wrap a single <word>. remove them. */
-                if (node->sibling == leftmost) {
-                    leftmost = prev;
-                } else {
-                    node->sibling->left->right = prev;
-                }
-                prev->left = node->sibling->left;
-                free(node);
-                free(node->sibling);
-                node = NULL;  // defensive measure
             } else {
-                /* link the other parentheses */
-                node->sibling->sibling = node;
+                /* emit the operators of the subquery, and drop its parenthesis */
+                while (parser->ops[--n_ops] != L_PAREN) {
+                    parser->prog[parser->prog_len++].type = parser->ops[n_ops];
+                }
+                depth--;
             }
         } else if (strcmp(token, "OR") == 0) {
-            node->type = OP_OR;
+            type = OP_OR;
         } else if (strcmp(token, "AND") == 0) {
-            node->type = OP_AND;
+            type = OP_AND;
         } else if (strcmp(token, "ANDNOT") == 0) {
-            node->type = OP_ANDNOT;
+            type = OP_ANDNOT;
+        } else if (strcmp(token, "NOT") == 0) {
+            /* unary, so it neither takes a left operand, nor emits pending operators */
+            type = OP_NOT;
+            if (prev_nonpar == WORD) {
+                errmsg = "Expected an operator before NOT";
+            } else if (!parser->universe_func || !parser->bitmap_func) {
+                errmsg = "NOT is not supported";
+            } else {
+                parser->ops[n_ops++] = OP_NOT;
+                /* the complement of nothing is everything */
+                status = PARSE_READY;
+            }
+            prev_nonpar = OP_NOT;
+        } else if (strncmp(token, "NEAR/", 5) == 0) {
+            type = NEAR;
+            window = strtol(token + 5, &end, 10);
+
+            if (prev != WORD || !plain) {
+                errmsg = "Expected a word on either side of NEAR";
+            } else if (!isdigit((unsigned char)token[5]) || *end || window < 1 || window > NEAR_MAXWINDOW) {
+                errmsg = "Invalid NEAR window";
+            } else if (!parser->phrase_func) {
+                errmsg = "Proximity queries are not supported";
+            }
+            prev_nonpar = NEAR;
         } else {
             /* <word> token */
-            node->type = TERM;
-            if (prev_nonpar && (prev_nonpar->type == TERM)) {
+            type = WORD;
+            if (prev_nonpar == WORD) {
                 errmsg = "Adjacent terms";
+            } else if (token[0] == '"') {
+                /* "quoted phrase" */
+                instr = &parser->prog[parser->prog_len++];
+                instr->type = WORD;
+                instr->token = token;
+                instr->deferred = 0;
+                errmsg = scan_phrase(parser, instr);
+                plain = 0;
+                prev_nonpar = WORD;
+
+                if (instr->prod || instr->bits) {
+                    status = PARSE_READY;
+                }
             } else {
-                if (map_haskey(searched_words, token)) {
-                    /* Duplicate <word> within this query.
-                    * Get result from map instead of searching set again. */
-                    node->prod = map_get(searched_words, token);
+                instr = &parser->prog[parser->prog_len++];
+                instr->type = WORD;
+                instr->token = token;
+                instr->deferred = 0;
+
+                if (is_pattern(token)) {
+                    /* `prefix*`, `*suffix` or `term~N`. Duplicates get results from the map */
+                    if (map_haskey(searched_words, token)) {
+                        instr->prod = map_get(searched_words, token);
+                        instr->bits = map_get(searched_bits, token);
+                    } else {
+                        errmsg = scan_pattern(parser, instr);
+                        map_put(searched_words, token, instr->prod);
+                        map_put(searched_bits, token, instr->bits);
+                    }
                 } else {
-                    /* search index for token, add result to node & map of searched words */
-                    node->prod = parser->term_func(parser->parent, token);
-                    map_put(searched_words, token, node->prod);
+                    /* collect the distinct <word>'s, to search the index for them all at once */
+                    instr->prod = NULL;
+                    instr->bits = NULL;
+                    instr->deferred = 1;
+                    if (!map_haskey(searched_words, token)) {
+                        map_put(searched_words, token, NULL);
+                        parser->words[n_words++] = token;
+                    }
                 }
-                /* mark this node to not have its set destroyed, as that would break the index :^) */
-                node->free_prod = 0;
-                prev_nonpar = node;
+                plain = is_plain_word(token);
+                prev_nonpar = WORD;
 
-                if (node->prod) {
+                if (instr->prod || instr->bits) {
                     /* update return status token has a set */
                     status = PARSE_READY;
                 }
             }
         }
 
-        if (node) {
-            if (is_operator(node)) {
-                /* operator specific checks */
-                if (!prev || !prev_nonpar) {
-                    errmsg = "Expected operator to have adjacent term(s)";
-                } else if (is_operator(prev_nonpar) || prev->type == L_PAREN) {
-                    errmsg = "Unexpected operator";
-                }
-                prev_nonpar = node;
-            }
-
-            /* Link node and the previous node, or set as leftmost for first node */
-            if (leftmost) {
-                prev->right = node;
-                node->left = prev;
+        if (is_operator(type) && type != OP_NOT) {
+            /* operator specific checks */
+            if (prev == NONE || prev_nonpar == NONE) {
+                errmsg = "Expected operator to have adjacent term(s)";
+            } else if (is_operator(prev_nonpar) || prev == L_PAREN) {
+                errmsg = "Unexpected operator";
             } else {
-                leftmost = node;
-                node->left = NULL;
+                /* all operators are of equal precedence, and evaluated left --> right.
+                 * emit pending operators of the current (sub)query first.
+                 * these include any NOT of the left operand, which binds tighter. */
+                while (n_ops && is_operator(parser->ops[n_ops - 1])) {
+                    parser->prog[parser->prog_len++].type = parser->ops[--n_ops];
+                }
+                parser->ops[n_ops++] = type;
             }
-            prev = node;
+            prev_nonpar = type;
         }
-        pile_push(tok_pile, token);
+        prev = type;
     }
 
     /* if errmsg is already set, avoid overwriting it. else, perform final checks. */
     if (!errmsg) {
         if (is_operator(prev_nonpar)) {
             errmsg = "Expected a term or query following operator";
-        } else if (pile_size(paren_pile)) {
+        } else if (prev_nonpar == NEAR) {
+            errmsg = "Expected a word on either side of NEAR";
+        } else if (depth) {
             errmsg = "Expected a closing parenthesis";
         }
     }
 
     if (errmsg) {
         /* print a formatted error message to the parsers errmsg buffer */
-        if ((pile_size(tok_pile) > 2) && list_hasnext(tok_iter)) {
+        if ((n_tok > 2) && n_tok < n_toks) {
             /*   (╯°□°）╯︵ ┻━┻   */
             snprintf(parser->errmsg_buf, ERRMSG_MAXLEN,
                 "<br>Error around %s%s %s %s%s ~ %s.",
-                ((pile_size(tok_pile) > 3) ? ("[ ... ") : ("[")),
-                (char *)pile_peek(tok_pile, 1), token,
-                (char *)list_next(tok_iter), 
-                (list_hasnext(tok_iter) ? (" ... ]") : ("]")), errmsg);
+                ((n_tok > 3) ? ("[ ... ") : ("[")),
+                prev_token, token,
+                (char *)vector_get(tokens, n_tok), 
+                ((n_tok + 1 < n_toks) ? (" ... ]") : ("]")), errmsg);
         } else {
             /* print simpler error message without context */
             snprintf(parser->errmsg_buf, ERRMSG_MAXLEN,
                 "<br>Error around token %d: \"%s\" ~ %s.",
-                pile_size(tok_pile), token, errmsg); 
+                n_tok, token, errmsg); 
         }
         status = SYNTAX_ERROR;
     } else {
-        /* valid syntax */
-        parser->leftmost = leftmost;
+        /* valid syntax. emit the remaining operators */
+        while (n_ops) {
+            parser->prog[parser->prog_len++].type = parser->ops[--n_ops];
+        }
+
+        /* search the index for the collected <word>'s, and hand their results to the instructions */
+        resolve_words(parser, n_words, searched_words, searched_bits);
+        for (i = 0; i < parser->prog_len; i++) {
+            instr = &parser->prog[i];
+            if (instr->type == WORD && instr->deferred) {
+                instr->prod = map_get(searched_words, instr->token);
+                instr->bits = map_get(searched_bits, instr->token);
+                if (instr->prod || instr->bits) {
+                    status = PARSE_READY;
+                }
+            }
+        }
     }
 
 end:
     /* cleanup and return */
-    if (tok_iter) list_destroyiter(tok_iter);
-    if (paren_pile) pile_destroy(paren_pile);
-    if (tok_pile) pile_destroy(tok_pile);
+    if (status != PARSE_READY) {
+        /* there will be no evaluation to release phrase results */
+        release_query(parser);
+    }
     if (searched_words) map_destroy(searched_words, NULL, NULL);
-    if (status != PARSE_READY) destroy_querynodes(leftmost);
+    if (searched_bits) map_destroy(searched_bits, NULL, NULL);
 
     return status;
 }
 
 set_t *parser_get_result(parser_t *parser) {
-    /* initialize the process of node parsing */
-    parser->leftmost = parse_node(parser->leftmost);
+    qterm_t *stack = parser->stack;
+    qinstr_t *instr;
+    set_t *result;
+    int i, n = 0;
+
+    /* run the program. <word>'s are pushed, operators replace their two operands */
+    for (i = 0; i < parser->prog_len; i++) {
+        instr = &parser->prog[i];
+        if (instr->type == WORD) {
+            stack[n].prod = instr->prod;
+            stack[n].bits = instr->bits;
+            stack[n].cur = NULL;
+            stack[n].key = instr->token;
+            stack[n].free_key = 0;
+            stack[n].negated = 0;
+            n++;
+        } else if (instr->type == OP_NOT) {
+            eval_not(&stack[n - 1]);
+        } else {
+            n--;
+            eval_operator(parser, instr->type, &stack[n - 1], &stack[n]);
+        }
+    }
+
+    if (stack[0].negated) {
+        /* the result is the complement of a product */
+        eval_complement(parser, &stack[0]);
+    }
 
-    if (!parser->leftmost->prod) {
+    if (stack[0].bits) {
+        /* the result is the bitmap of a single <word>. stream it into a set */
+        stack[0].cur = take_cursor(&stack[0]);
+    }
+
+    if (stack[0].cur) {
+        /* Stream the results through the cursor tree. Only this final set is built. */
+        result = cursor_collect(stack[0].cur);
+        if (result) {
+            result = cache_result(parser, &stack[0], result);
+        }
+    } else if (stack[0].prod) {
+        /* the result is the set of a single <word>, or a cached set. share it */
+        result = set_retain(stack[0].prod);
+    } else {
         /* query completed with no results. return an empty set. */
-        free(parser->leftmost);
-        return set_create((cmpfunc_t)strcmp);
+        result = set_create((cmpfunc_t)strcmp);
     }
 
-    /* query yielded results. copy and return the result set */
-    set_t *result = set_copy(parser->leftmost->prod);
-    destroy_product(parser->leftmost);
-    free(parser->leftmost);
+    destroy_product(&stack[0]);
+    destroy_key(&stack[0]);
+    parser->prog_len = 0;
+
+    /* the query no longer refers to any cached or collected sets */
+    release_query(parser);
 
     return result;
 }
@@ -285,209 +523,655 @@ set_t *parser_get_result(parser_t *parser) {
  *                          Static/local functions                            *
  ******************************************************************************/
 
-/* 
- * Recursively terminate nodes until only a single node remains
- * note that NULL checks are not performed after set operations, as such an event
+/*
+ * Makes room for a query of n_tokens tokens in the program, stacks and
+ * <word> arrays, which live in a single allocation that is reused across
+ * queries. Returns 0 on success, or -1 on failure.
+ */
+static int reserve(parser_t *parser, int n_tokens) {
+    size_t words_size = n_tokens * (sizeof(char *) + sizeof(set_t *) + sizeof(roaring_t *));
+    char *block, *words;
+
+    if (n_tokens <= parser->capacity) {
+        return 0;
+    }
+
+    block = malloc(n_tokens * (sizeof(qinstr_t) + sizeof(qterm_t) + sizeof(qtok_types_t)) + words_size);
+    if (!block) {
+        return -1;
+    }
+    free(parser->prog);
+
+    /* the pointer arrays precede ops, which is the only array of smaller elements */
+    words = block + n_tokens * (sizeof(qinstr_t) + sizeof(qterm_t));
+    parser->prog = (qinstr_t *)block;
+    parser->stack = (qterm_t *)(block + n_tokens * sizeof(qinstr_t));
+    parser->words = (char **)words;
+    parser->word_prods = (set_t **)(words + n_tokens * sizeof(char *));
+    parser->word_bits = (roaring_t **)(words + n_tokens * (sizeof(char *) + sizeof(set_t *)));
+    parser->ops = (qtok_types_t *)(words + words_size);
+    parser->capacity = n_tokens;
+
+    return 0;
+}
+
+/*
+ * Looks up the results of the given word, as a bitmap if the bitmap function
+ * has one, or else as a set. Either is set to NULL if not found.
+ */
+static void lookup_term(parser_t *parser, char *word, set_t **prod, roaring_t **bits) {
+    *bits = parser->bitmap_func ? parser->bitmap_func(parser->parent, word) : NULL;
+    *prod = *bits ? NULL : parser->term_func(parser->parent, word);
+}
+
+/*
+ * Looks up the results of the first n_words of parser->words, through the
+ * batch function in a single call if there is one, and stores them in the
+ * given maps of searched words.
+ */
+static void resolve_words(parser_t *parser, int n_words, map_t *searched_words, map_t *searched_bits) {
+    int i;
+
+    if (parser->batch_func) {
+        for (i = 0; i < n_words; i++) {
+            parser->word_bits[i] = NULL;
+        }
+        parser->batch_func(parser->parent, parser->words, n_words, parser->word_prods,
+                           parser->bitmap_func ? parser->word_bits : NULL);
+    } else {
+        for (i = 0; i < n_words; i++) {
+            lookup_term(parser, parser->words[i], &parser->word_prods[i], &parser->word_bits[i]);
+        }
+    }
+
+    for (i = 0; i < n_words; i++) {
+        map_put(searched_words, parser->words[i], parser->word_prods[i]);
+        map_put(searched_bits, parser->words[i], parser->word_bits[i]);
+    }
+}
+
+/*
+ * Resolves the "quoted phrase" token of the given instruction. Phrases
+ * of a single word are plain <word>'s.
+ * Returns an error message, or NULL on success.
+ */
+static char *scan_phrase(parser_t *parser, qinstr_t *instr) {
+    char *words_buf, **words, *c, *save;
+    int n_words = 0, len = strlen(instr->token);
+
+    instr->prod = NULL;
+    instr->bits = NULL;
+    if (!parser->phrase_func) {
+        return "Phrase queries are not supported";
+    }
+
+    /* split a copy of the phrase (without quotes) into its words */
+    words_buf = strdup(instr->token + 1);
+    words = malloc(((len + 1) / 2 + 1) * sizeof(char *));
+    if (!words_buf || !words) {
+        free(words_buf);
+        free(words);
+        return "Out of memory";
+    }
+    if (len > 1 && words_buf[len - 2] == '"') {
+        words_buf[len - 2] = '\0';
+    }
+
+    for (c = strtok_r(words_buf, " ", &save); c; c = strtok_r(NULL, " ", &save)) {
+        words[n_words++] = c;
+    }
+
+    if (n_words == 1) {
+        lookup_term(parser, words[0], &instr->prod, &instr->bits);
+    } else if (n_words > 1) {
+        instr->prod = positional_product(parser, instr->token, words, n_words, 0);
+    }
+
+    free(words);
+    free(words_buf);
+    return n_words ? NULL : "Empty phrase";
+}
+
+/*
+ * Resolves `a NEAR/k b`, given the instruction of the <word> a and the
+ * token of b. The instruction is replaced by one for the combined term.
+ * Returns an error message, or NULL on success.
+ */
+static char *scan_near(parser_t *parser, qinstr_t *instr, char *token, int window) {
+    char *words[2] = { instr->token, token };
+    char *key;
+
+    /* order the operands, so that `a NEAR/k b` and `b NEAR/k a` share a key */
+    if (strcmp(words[0], words[1]) > 0) {
+        words[0] = token;
+        words[1] = instr->token;
+    }
+
+    key = malloc(strlen(words[0]) + strlen(words[1]) + 24);
+    if (!key) {
+        return "Out of memory";
+    }
+    sprintf(key, "(NEAR/%d %s %s)", window, words[0], words[1]);
+    if (!pile_push(parser->keys, key)) {
+        free(key);
+        return "Out of memory";
+    }
+
+    instr->token = key;
+    instr->prod = (instr->prod || instr->bits) ? positional_product(parser, key, words, 2, window) : NULL;
+    instr->bits = NULL;
+    return NULL;
+}
+
+/*
+ * Returns the results of a phrase (window 0) or NEAR term, or NULL if
+ * there are none. Results are taken from the subquery cache when known.
+ * Otherwise they are produced by the phrase function, and kept in the
+ * cache, or else until the query completes.
+ */
+static set_t *positional_product(parser_t *parser, char *key, char **words, int n_words, int window) {
+    roaring_t *bits;
+    set_t *set;
+    int i;
+
+    /* every word has to occur. this also registers each of them with the parent */
+    for (i = 0; i < n_words; i++) {
+        lookup_term(parser, words[i], &set, &bits);
+        if (!set && !bits) {
+            return NULL;
+        }
+    }
+
+    if ((set = held_product(parser, key))) {
+        return set;
+    }
+    return keep_product(parser, key, parser->phrase_func(parser->parent, words, n_words, window));
+}
+
+/*
+ * Resolves the pattern token of the given instruction, to the union of
+ * the sets of the terms it expands to.
+ * Returns an error message, or NULL on success.
+ */
+static char *scan_pattern(parser_t *parser, qinstr_t *instr) {
+    char *terms[PATTERN_MAXTERMS];
+    set_t *sets[PATTERN_MAXTERMS];
+    roaring_t *bitmaps[PATTERN_MAXTERMS];
+    cursor_t *cur = NULL, *next;
+    set_t *set;
+    int i, n_terms, n_sets = 0;
+
+    instr->prod = NULL;
+    instr->bits = NULL;
+    if (!parser->expand_func) {
+        return "Patterns are not supported";
+    }
+
+    n_terms = parser->expand_func(parser->parent, instr->token, terms, PATTERN_MAXTERMS);
+    if (n_terms < 0) {
+        return "Unsupported pattern";
+    } else if (n_terms > PATTERN_MAXTERMS) {
+        return "Pattern matches too many terms";
+    }
+
+    /* look up every term, which also registers each of them with the parent */
+    for (i = 0; i < n_terms; i++) {
+        lookup_term(parser, terms[i], &sets[n_sets], &bitmaps[n_sets]);
+        if (sets[n_sets] || bitmaps[n_sets]) {
+            n_sets++;
+        }
+    }
+
+    if (n_sets <= 1) {
+        /* no need for a union */
+        instr->prod = n_sets ? sets[0] : NULL;
+        instr->bits = n_sets ? bitmaps[0] : NULL;
+        return NULL;
+    }
+
+    if ((instr->prod = held_product(parser, instr->token))) {
+        return NULL;
+    }
+
+    for (i = 0; i < n_sets; i++) {
+        next = sets[i] ? cursor_create_set(sets[i]) : cursor_create_bitmap(bitmaps[i]);
+        cur = cur ? cursor_create_or(cur, next) : next;
+        if (!cur) {
+            return "Out of memory";
+        }
+    }
+
+    set = cursor_collect(cur);
+    cursor_destroy(cur);
+    if (!set) {
+        return "Out of memory";
+    }
+    instr->prod = keep_product(parser, instr->token, set);
+    return NULL;
+}
+
+/*
+ * Returns the set cached under the given key, holding it until the query
+ * completes, or NULL if there is none.
+ */
+static set_t *held_product(parser_t *parser, char *key) {
+    sc_entry_t *entry;
+
+    if (!parser->cache || !(entry = setcache_get(parser->cache, key))) {
+        return NULL;
+    }
+    if (!pile_push(parser->held, entry)) {
+        setcache_release(parser->cache, entry);
+        return NULL;
+    }
+    return setcache_set(entry);
+}
+
+/*
+ * Keeps a set produced by the parser until the query completes. The set is
+ * offered to the subquery cache under the given key (if any), or else kept
+ * with the temporary sets of the query.
+ * Returns the set, or NULL if it is empty.
+ */
+static set_t *keep_product(parser_t *parser, char *key, set_t *set) {
+    sc_entry_t *entry = NULL;
+
+    if (set && !set_size(set)) {
+        set_destroy(set);
+        set = NULL;
+    }
+
+    if (parser->cache && key) {
+        entry = setcache_put(parser->cache, key, set);
+    }
+    if (entry) {
+        pile_push(parser->held, entry);
+    } else if (set) {
+        pile_push(parser->temps, set);
+    }
+    return set;
+}
+
+/*
+ * Releases everything held on behalf of the last query: references to
+ * cached sets, sets collected during evaluation and keys built while scanning.
+ */
+static void release_query(parser_t *parser) {
+    sc_entry_t *entry;
+
+    while ((entry = pile_pop(parser->held))) {
+        setcache_release(parser->cache, entry);
+    }
+    pile_cleanplates(parser->temps, (void (*)(void *))set_destroy);
+    pile_cleanplates(parser->keys, free);
+}
+
+/*
+ * Applies the given operator to terms a and c, replacing a with the result.
+ * note that NULL checks are not performed after cursor creation, as such an event
  * would not fault the program on its own - rather return no results.
  */
-static qnode_t *parse_node(qnode_t *node) {
-    switch (node->type) {
-        case R_PAREN:
-            /* End of query/subquery. Splice parentheses and shift to lparen->right */
-            return parse_node(splice_nodes(node->sibling, node));
-        case OP_OR:
-            return term_or(node);
-        case OP_AND:
-            return term_and(node);
+static void eval_operator(parser_t *parser, qtok_types_t op, qterm_t *a, qterm_t *c) {
+    qterm_t oper = { NULL, NULL, NULL, NULL, 0, 0 };
+    int negate = 0;
+
+    /* negated terms have no key, so neither has the operator term */
+    combine_keys(parser, &oper, a, c, op);
+    if (a->negated || c->negated) {
+        op = rewrite_negations(op, a, c, &negate);
+    }
+
+    switch (op) {
         case OP_ANDNOT:
-            return term_andnot(node);
-        default: {
-            /* move right > left > base case */
-            if (node->right) {
-                /* skip ahead to the next relevant node */
-                while (node->right && (node->type == L_PAREN || node->type == TERM)) {
-                    node = node->right;
-                }
-                return parse_node(node);
+            if (is_empty(a) || same_product(a, c)) {
+                /* A is empty, or A and C are the same <word>. Ø \ C === A \ A === Ø */
+                destroy_product(a);
+                destroy_product(c);
+            } else if (is_empty(c)) {
+                /* A \ Ø === A */
+                inherit_product(&oper, a);
+            } else if (cached_product(parser, &oper)) {
+                /* The difference is known from a previous query. */
+                destroy_product(a);
+                destroy_product(c);
+            } else {
+                /* Both products are non-empty. Produce the difference on demand. */
+                oper.cur = cursor_create_andnot(take_cursor(a), take_cursor(c));
             }
-            if (node->left) {
-                return parse_node(node->left);
+            break;
+        case OP_AND:
+            if (is_empty(a) || is_empty(c)) {
+                /* One set is empty, and nullifies the need for any operation. */
+                destroy_product(a);
+                destroy_product(c);
+            } else if (same_product(a, c)) {
+                /* Same <word>'s. `x AND x` == x. Inherit set of a. */
+                inherit_product(&oper, a);
+            } else if (cached_product(parser, &oper)) {
+                /* The intersection is known from a previous query. */
+                destroy_product(a);
+                destroy_product(c);
+            } else {
+                /* Both products are non-empty. Produce the intersection on demand. */
+                oper.cur = cursor_create_and(take_cursor(a), take_cursor(c));
             }
-            /* base case: only a single node remaining */
-            return node;
-        }
+            break;
+        default:
+            if (is_empty(c) || same_product(a, c)) {
+                /* Not C --> inherit A (which may be empty as well).
+                 * If duplicate <word>'s, union is pointless --> inherit A */
+                inherit_product(&oper, a);
+            } else if (is_empty(a)) {
+                /* Not A --> inherit C */
+                inherit_product(&oper, c);
+            } else if (cached_product(parser, &oper)) {
+                /* The union is known from a previous query. */
+                destroy_product(a);
+                destroy_product(c);
+            } else {
+                /* Both products are non-empty. Produce the union on demand. */
+                oper.cur = cursor_create_or(take_cursor(a), take_cursor(c));
+            }
+            break;
+    }
+
+    if (oper.cur && cursor_depth(oper.cur) > EVAL_MAXDEPTH) {
+        materialize(parser, &oper);
     }
+
+    destroy_key(a);
+    destroy_key(c);
+    oper.negated = negate;
+    *a = oper;
 }
 
-static qnode_t *term_andnot(qnode_t *oper) {
-    qnode_t *a = oper->left;
-    qnode_t *c = oper->right;
+/*
+ * Rewrites an operator with a negated operand into one on the products of
+ * a and c, of which the result may be the complement, e.g. `a AND NOT c`
+ * into the difference a \ c. Swaps the contents of a and c as needed.
+ * Returns the operator to apply, and sets negate if its result is to be
+ * complemented.
+ */
+static qtok_types_t rewrite_negations(qtok_types_t op, qterm_t *a, qterm_t *c, int *negate) {
+    int both = a->negated && c->negated;
+    qterm_t tmp;
+
+    if (a->negated && !both && op != OP_ANDNOT) {
+        /* AND and OR are commutative. move the negated operand to c */
+        tmp = *a;
+        *a = *c;
+        *c = tmp;
+    }
 
-    if (oper->right->type != TERM) {
-        /* Cannot consume right node yet, parse subquery first. */
-        return parse_node(c);
+    switch (op) {
+        case OP_AND:
+            /* ¬a ∩ ¬c === ¬(a ∪ c), and a ∩ ¬c === a \ c */
+            *negate = both;
+            op = both ? OP_OR : OP_ANDNOT;
+            break;
+        case OP_OR:
+            /* ¬a ∪ ¬c === ¬(a ∩ c), and a ∪ ¬c === ¬(c \ a) */
+            *negate = 1;
+            if (both) {
+                op = OP_AND;
+            } else {
+                tmp = *a;
+                *a = *c;
+                *c = tmp;
+                op = OP_ANDNOT;
+            }
+            break;
+        default:
+            if (both) {
+                /* ¬a \ ¬c === c \ a */
+                tmp = *a;
+                *a = *c;
+                *c = tmp;
+            } else if (a->negated) {
+                /* ¬a \ c === ¬(a ∪ c) */
+                *negate = 1;
+                op = OP_OR;
+            } else {
+                /* a \ ¬c === a ∩ c */
+                op = OP_AND;
+            }
+            break;
     }
 
-    /* Check if a set operation is nescessary. */
-    if (a->prod == c->prod) {
-        /* both sets are either empty, or the same <word>. */
-        oper->prod = NULL;
-    } else if (!a->prod || !c->prod) {
-        /* Combined case. Let Ø = empty set, A = a->prod, C = c->prod.
-         * 1) if (A == Ø), then (A \ C === A);
-         * 2) if (C == Ø), then (A \ C === A), regardless of whether (A == Ø) or (A == !Ø); */
-        oper->prod = a->prod;
-        oper->free_prod = a->free_prod;
-    } else {
-        /* Both products are non-empty sets. Produce the difference. */
-        oper->prod = set_difference(a->prod, c->prod);
-        oper->free_prod = 1;
+    a->negated = 0;
+    c->negated = 0;
+    return op;
+}
 
-        /* if the new set is empty, destroy it :^( */
-        if (!set_size(oper->prod)) {
-            destroy_product(oper);
-        }
-        /* Free sets that are no longer needed */
-        destroy_product(a);
-        destroy_product(c);
-    }
-
-    /* Consume the terms and parse self. */
-    oper->type = TERM;
-    return parse_node(splice_nodes(a, c));
-}
-
-static qnode_t *term_and(qnode_t *oper) {
-    qnode_t *a = oper->left;
-    qnode_t *c = oper->right;
-
-    if (oper->right->type != TERM) {
-        /* Cannot consume right node yet, parse subquery first. */
-        return parse_node(c);
-    } 
-
-    /* Check if a set operation is nescessary. */
-    if (!a->prod || !c->prod) {
-        /* One set is empty, and nullifies the need for any operation. */
-        oper->prod = NULL;
-        destroy_product(a);
-        destroy_product(c);
-    } else if (a->prod == c->prod) {
-        /* Same <word>'s. `x AND x` == x. Inherit set of a. */
-        oper->prod = a->prod;
-        oper->free_prod = a->free_prod;
-        destroy_product(c);
-    } else {
-        /* Both products are non-empty sets. Produce the intersection. */
-        oper->prod = set_intersection(a->prod, c->prod);
-        oper->free_prod = 1;
+/*
+ * Complements the given term. This only flips its negation, leaving the
+ * complement to be resolved by the operators applied to it (see
+ * rewrite_negations), or else by eval_complement.
+ */
+static void eval_not(qterm_t *term) {
+    term->negated = !term->negated;
+    /* the key describes the product, not its complement */
+    destroy_key(term);
+}
 
-        /* if the new set is empty, destroy it :^( */
-        if (!set_size(oper->prod)) {
-            destroy_product(oper);
-        }
-        /* Free sets that are no longer needed */
-        destroy_product(a);
-        destroy_product(c);
-    }
-
-    /* Consume the terms and parse self. */
-    oper->type = TERM;
-    return parse_node(splice_nodes(a, c));
-}
-
-static qnode_t *term_or(qnode_t *oper) {
-    qnode_t *a = oper->left;
-    qnode_t *c = oper->right;
-
-    if (oper->right->type != TERM) {
-        /* Cannot consume right node yet, parse subquery first. */
-        return parse_node(c);
-    }
-
-    /* Check if a set operation is nescessary. */
-    if (!a->prod && !c->prod) {
-        /* A U Ø ==> Ø, and vice versa */
-        oper->prod = NULL;
-    } else if (!c->prod || (a->prod == c->prod)) {
-        /* Not C --> inherit A. 
-         * If duplicate <word>'s, union is pointless --> inherit A */
-        oper->prod = a->prod;
-        oper->free_prod = a->free_prod;
-    } else if (!a->prod) {
-        /* Not A --> inherit C */
-        oper->prod = c->prod;
-        oper->free_prod = c->free_prod;
-    } else {
-        /* Both products are non-empty sets, and an union operation is nescessary. */
-        oper->prod = set_union(a->prod, c->prod);
-        oper->free_prod = 1;
+/*
+ * Replaces a negated term by a cursor over the universe, less its product.
+ * The universe is a bitmap of all documents, of which only the elements
+ * that are not in the product are ever produced.
+ */
+static void eval_complement(parser_t *parser, qterm_t *term) {
+    roaring_t *universe = parser->universe_func(parser->parent);
+    cursor_t *cur;
+
+    term->negated = 0;
+    if (!universe) {
+        /* there are no documents */
+        destroy_product(term);
+        return;
+    }
+
+    cur = cursor_create_bitmap(universe);
+    if (!is_empty(term)) {
+        cur = cursor_create_andnot(cur, take_cursor(term));
+    }
+    destroy_product(term);
+    term->cur = cur;
+}
+
+/*
+ * Collects the results of a terms cursor into a set. This bounds the height
+ * of cursor trees, and thereby the work of pulling each element through them,
+ * for long chains of mixed operators. The set is offered to the subquery cache,
+ * or else kept until the query completes.
+ */
+static void materialize(parser_t *parser, qterm_t *term) {
+    set_t *set = cursor_collect(term->cur);
+
+    destroy_product(term);
+    if (set) {
+        term->prod = keep_product(parser, term->key, set);
+    }
+}
+
+/*
+ * Sets the key of the given operator term to the canonical form of the
+ * subquery it represents, given the keys of its operands a and c.
+ * Operands of commutative operators are ordered, so that `a OR b` and
+ * `b OR a` share a key. The key is left NULL if caching is disabled, or
+ * either operand lacks a key.
+ */
+static void combine_keys(parser_t *parser, qterm_t *oper, qterm_t *a, qterm_t *c, qtok_types_t op) {
+    char *ka = a->key;
+    char *kc = c->key;
+    const char *opname = (op == OP_OR) ? "OR" : ((op == OP_AND) ? "AND" : "ANDNOT");
+    size_t len;
+
+    if (!parser->cache || !ka || !kc) {
+        return;
+    }
+
+    if (op != OP_ANDNOT && strcmp(ka, kc) > 0) {
+        char *tmp = ka;
+        ka = kc;
+        kc = tmp;
+    }
+
+    /* "(" opname " " ka " " kc ")" */
+    len = strlen(opname) + strlen(ka) + strlen(kc) + 4;
+    if (len > KEY_MAXLEN) {
+        return;
+    }
+
+    oper->key = malloc(len + 1);
+    if (oper->key) {
+        sprintf(oper->key, "(%s %s %s)", opname, ka, kc);
+        oper->free_key = 1;
+    }
+}
+
+/*
+ * Looks up the product of the given operator term in the subquery cache.
+ * Returns 1 and sets the product on a hit, otherwise 0. The cache entry
+ * is held until the query completes.
+ */
+static int cached_product(parser_t *parser, qterm_t *oper) {
+    sc_entry_t *entry;
 
-        /* Free sets that are no longer needed */
-        destroy_product(a);
-        destroy_product(c);
+    if (!parser->cache || !oper->key) {
+        return 0;
     }
 
-    /* Consume the terms and parse self. */
-    oper->type = TERM;
-    return parse_node(splice_nodes(a, c));
+    entry = setcache_get(parser->cache, oper->key);
+    if (!entry) {
+        return 0;
+    }
+
+    if (!pile_push(parser->held, entry)) {
+        setcache_release(parser->cache, entry);
+        return 0;
+    }
+    oper->prod = setcache_set(entry);
+    return 1;
 }
 
 /*
- * Destroys two nodes, denoted a and z, without dismembering any adjacent nodes.
- * There must exist at least one node node inbetween a and z. Returns a->right.
+ * Offers the result of the query (or subquery) of the given term to the
+ * subquery cache, and returns the result, which the cache shares with the
+ * caller if it adopted it.
  */
-static qnode_t *splice_nodes(qnode_t *a, qnode_t *z) {
-    qnode_t *b = a->right;
+static set_t *cache_result(parser_t *parser, qterm_t *term, set_t *result) {
+    sc_entry_t *entry;
+
+    if (!parser->cache || !term->key) {
+        return result;
+    }
 
-    /* splice a, reattach a->left if any. */
-    b->left = a->left;
-    if (a->left) {
-        a->left->right = b;
+    /* the cache holds no set for empty results */
+    if (!set_size(result)) {
+        entry = setcache_put(parser->cache, term->key, NULL);
+    } else if (!(entry = setcache_put(parser->cache, term->key, set_retain(result)))) {
+        set_destroy(result);
+    }
+    if (entry) {
+        setcache_release(parser->cache, entry);
     }
+    return result;
+}
 
-    /* splice z, reattach z->right if any. */
-    z->left->right = z->right;
-    if (z->right) {
-        z->right->left = z->left;
+/*
+ * Frees the key of a term, if it was built by the parser.
+ */
+static void destroy_key(qterm_t *term) {
+    if (term->free_key) {
+        free(term->key);
     }
+    term->key = NULL;
+    term->free_key = 0;
+}
 
-    free(a);
-    free(z);
+/*
+ * Returns 1 if the given term has no results, otherwise 0.
+ */
+static int is_empty(qterm_t *term) {
+    return !term->prod && !term->bits && !term->cur;
+}
 
-    return b;
+/*
+ * Returns 1 if terms a and c are known to have the same results, i.e. are
+ * the same <word> or cached set, otherwise 0.
+ */
+static int same_product(qterm_t *a, qterm_t *c) {
+    return (a->prod && a->prod == c->prod) || (a->bits && a->bits == c->bits);
 }
 
-/* 
- * Destroys the given node and any/all nodes to the right of it.
- * Used to clean up in the event of syntax errors, etc.
- * If the parsing completes without error, this does not have to be called,
- * as the parsing process cleans up nodes as it reduces terms.
+/*
+ * Returns a cursor over the product of the given (non-empty) term,
+ * moving it out of the term if the product is already a cursor.
  */
-static void destroy_querynodes(qnode_t *leftmost) {
-    while (leftmost) {
-        qnode_t *tmp = leftmost;
-        leftmost = leftmost->right;
-        free(tmp);
+static cursor_t *take_cursor(qterm_t *term) {
+    cursor_t *cur = term->cur;
+
+    if (cur) {
+        term->cur = NULL;
+        return cur;
     }
+    if (term->bits) {
+        return cursor_create_bitmap(term->bits);
+    }
+    return cursor_create_set(term->prod);
+}
+
+/*
+ * Moves the product of a term to the given operator term.
+ */
+static void inherit_product(qterm_t *oper, qterm_t *term) {
+    oper->prod = term->prod;
+    oper->bits = term->bits;
+    oper->cur = term->cur;
+    term->prod = NULL;
+    term->bits = NULL;
+    term->cur = NULL;
 }
 
 /*
- * Destroys the product of a node unless it is inherited from an indexed word.
- * NULL-safe for both term and its prod. Does not destroy the node itself.
+ * Destroys the cursor of a term, if any. Sets and bitmaps are never destroyed,
+ * as they belong to either an indexed word or the subquery cache.
+ * NULL-safe. Does not destroy the key of the term.
  */
-static void destroy_product(qnode_t *term) {
-    if (term && (term->prod && term->free_prod)) {
-        set_destroy(term->prod);
+static void destroy_product(qterm_t *term) {
+    if (term && term->cur) {
+        cursor_destroy(term->cur);
+        term->cur = NULL;
+    }
+    if (term) {
         term->prod = NULL;
+        term->bits = NULL;
     }
 }
 
 /*
- * returns 0 on non-operator or NULL, otherwise returns operator type
+ * returns 0 on non-operator, otherwise returns operator type
  */
-static int is_operator(qnode_t *node) {
-    if (node && (node->type > 0))
-        return node->type;
+static int is_operator(qtok_types_t type) {
+    if (type > 0)
+        return type;
     return 0;
 }
+
+/*
+ * Returns 1 if the given token is a plain <word>, i.e. not a phrase,
+ * pattern, parenthesis or operator, otherwise 0.
+ */
+static int is_plain_word(char *token) {
+    return token[0] != '"' && token[0] != '(' && token[0] != ')' && !is_pattern(token)
+        && strcmp(token, "OR") && strcmp(token, "AND") && strcmp(token, "ANDNOT")
+        && strcmp(token, "NOT") && strncmp(token, "NEAR/", 5);
+}
+
+/*
+ * Returns 1 if the given token is a pattern to expand into terms, i.e.
+ * `prefix*`, `*suffix` or `term~N`, otherwise 0.
+ */
+static int is_pattern(char *token) {
+    return token[0] == '*' || token[strlen(token) - 1] == '*' || strchr(token, '~');
+}
@@ -337,7 +337,18 @@ int tree_hasnext(tree_iter_t *iter) {
     return 1;
 }
 
-void tree_destroyiter(tree_iter_t *iter) {
+/* Fails to compile unless tree_iterbuf_t can hold the iterator */
+typedef char iterbuf_fits[(sizeof(tree_iter_t) <= sizeof(tree_iterbuf_t)) ? 1 : -1];
+
+tree_iter_t *tree_inititer(tree_iterbuf_t *buf, tree_t *tree) {
+    tree_iter_t *iter = (tree_iter_t *)buf;
+
+    iter->tree = tree;
+    iter->node = tree->root;
+    return iter;
+}
+
+void tree_finishiter(tree_iter_t *iter) {
     if (tree_hasnext(iter)) {
         /* Finish the morris iterator process to avoid leaving any mutated leaves
          * this loop does nothing other than correctly finish the iteration process 
@@ -347,6 +358,10 @@ void tree_destroyiter(tree_iter_t *iter) {
          */
         for (void *elem = tree_next(iter); elem; elem = tree_next(iter));
     }
+}
+
+void tree_destroyiter(tree_iter_t *iter) {
+    tree_finishiter(iter);
     free(iter);
 }
 
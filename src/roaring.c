@@ -0,0 +1,880 @@
+/*
+ * Roaring bitmaps.
+ *
+ * Values are split by their high 16 bits into containers, kept in order of
+ * those bits (their key). A container holds the low 16 bits of its values
+ * as one of:
+ *  - an array: sorted values, for at most ARRAY_MAXCARD values,
+ *  - a bitmap: 2^16 bits, for more values than that,
+ *  - runs: sorted [start, last] ranges, when that is smaller still.
+ * Operations produce arrays and bitmaps, normalized to the smaller of the
+ * two. Runs are only made by roaring_optimize, and are expanded to one of
+ * the others before taking part in an operation.
+ */
+
+#include "roaring.h"
+#include "printing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARRAY_MAXCARD  4096   // an array of more values is larger than a bitmap
+#define BITMAP_WORDS   1024   // 2^16 bits
+#define RUNS_MAX       2048   // more runs are larger than a bitmap
+
+#define popcount(x)    __builtin_popcountll(x)
+#define ctz(x)         __builtin_ctzll(x)
+#define HAS_BIT(words, v)  (((words)[(v) >> 6] >> ((v) & 63)) & 1)
+
+typedef enum container_types {
+    C_ARRAY,
+    C_BITMAP,
+    C_RUN
+} container_types_t;
+
+/* Range of consecutive values, both inclusive */
+typedef struct run {
+    uint16_t start;
+    uint16_t last;
+} run_t;
+
+typedef struct container {
+    container_types_t type;
+    uint16_t  key;      // high 16 bits of the values
+    int       card;     // number of values
+    int       n;        // values of an array, or runs of a run container
+    int       size;     // values or runs allocated
+    uint16_t *values;   // C_ARRAY
+    uint64_t *words;    // C_BITMAP
+    run_t    *runs;     // C_RUN
+} container_t;
+
+struct roaring {
+    container_t *cs;    // ordered by key
+    int          n_cs;
+    int          max_cs;
+    int          card;
+};
+
+struct roaring_iter {
+    roaring_t *bits;
+    int        c;       // current container
+    int        pos;     // next value (C_ARRAY) or run (C_RUN), or next bit (C_BITMAP)
+    int        off;     // next value within the current run
+};
+
+/* Type of container operation, producing a third container */
+typedef int (*container_op_t)(container_t *, container_t *, container_t *);
+
+
+/******************************************************************************
+ *                                Containers                                  *
+ ******************************************************************************/
+
+static void container_free(container_t *c) {
+    free(c->values);
+    free(c->words);
+    free(c->runs);
+    c->values = NULL;
+    c->words = NULL;
+    c->runs = NULL;
+    c->n = c->size = 0;
+}
+
+/*
+ * Makes room for n values (or runs) in an array (or run) container.
+ * Returns 0 on success, or -1 on failure.
+ */
+static int container_reserve(container_t *c, int n) {
+    size_t unit = (c->type == C_ARRAY) ? sizeof(uint16_t) : sizeof(run_t);
+    int size = c->size ? c->size : 4;
+    void *p;
+
+    if (n <= c->size) {
+        return 0;
+    }
+    while (size < n) {
+        size *= 2;
+    }
+
+    p = realloc((c->type == C_ARRAY) ? (void *)c->values : (void *)c->runs, size * unit);
+    if (!p) {
+        return -1;
+    }
+    if (c->type == C_ARRAY) {
+        c->values = p;
+    } else {
+        c->runs = p;
+    }
+    c->size = size;
+    return 0;
+}
+
+/*
+ * Initializes an empty container of the given type.
+ * Returns 0 on success, or -1 on failure.
+ */
+static int container_init(container_t *c, container_types_t type, uint16_t key, int size) {
+    memset(c, 0, sizeof(container_t));
+    c->type = type;
+    c->key = key;
+
+    if (type == C_BITMAP) {
+        c->words = calloc(BITMAP_WORDS, sizeof(uint64_t));
+        return c->words ? 0 : -1;
+    }
+    return container_reserve(c, size ? size : 1);
+}
+
+/*
+ * Copies container src into dst.
+ * Returns 0 on success, or -1 on failure.
+ */
+static int container_copy(container_t *src, container_t *dst) {
+    int n = (src->type == C_BITMAP) ? 0 : src->n;
+
+    if (container_init(dst, src->type, src->key, n) < 0) {
+        container_free(dst);
+        return -1;
+    }
+    dst->card = src->card;
+    dst->n = src->n;
+
+    switch (src->type) {
+        case C_ARRAY:
+            memcpy(dst->values, src->values, n * sizeof(uint16_t));
+            break;
+        case C_BITMAP:
+            memcpy(dst->words, src->words, BITMAP_WORDS * sizeof(uint64_t));
+            break;
+        case C_RUN:
+            memcpy(dst->runs, src->runs, n * sizeof(run_t));
+            break;
+    }
+    return 0;
+}
+
+/*
+ * Converts an array or run container to a bitmap container.
+ * Returns 0 on success, or -1 on failure.
+ */
+static int to_bitmap(container_t *c) {
+    uint64_t *words = calloc(BITMAP_WORDS, sizeof(uint64_t));
+    int i, v;
+
+    if (!words) {
+        return -1;
+    }
+
+    if (c->type == C_ARRAY) {
+        for (i = 0; i < c->n; i++) {
+            words[c->values[i] >> 6] |= 1ULL << (c->values[i] & 63);
+        }
+    } else if (c->type == C_RUN) {
+        for (i = 0; i < c->n; i++) {
+            for (v = c->runs[i].start; v <= c->runs[i].last; v++) {
+                words[v >> 6] |= 1ULL << (v & 63);
+            }
+        }
+    }
+
+    container_free(c);
+    c->words = words;
+    c->type = C_BITMAP;
+    return 0;
+}
+
+/*
+ * Converts a bitmap or run container of at most ARRAY_MAXCARD values to
+ * an array container.
+ * Returns 0 on success, or -1 on failure.
+ */
+static int to_array(container_t *c) {
+    uint16_t *values = malloc((c->card ? c->card : 1) * sizeof(uint16_t));
+    uint64_t bits;
+    int i, n = 0, v;
+
+    if (!values) {
+        return -1;
+    }
+
+    if (c->type == C_BITMAP) {
+        for (i = 0; i < BITMAP_WORDS; i++) {
+            for (bits = c->words[i]; bits; bits &= bits - 1) {
+                values[n++] = i * 64 + ctz(bits);
+            }
+        }
+    } else if (c->type == C_RUN) {
+        for (i = 0; i < c->n; i++) {
+            for (v = c->runs[i].start; v <= c->runs[i].last; v++) {
+                values[n++] = v;
+            }
+        }
+    }
+
+    container_free(c);
+    c->values = values;
+    c->n = n;
+    c->size = c->card ? c->card : 1;
+    c->type = C_ARRAY;
+    return 0;
+}
+
+/* Returns the number of runs of consecutive values in the given container */
+static int count_runs(container_t *c) {
+    uint64_t carry = 0, x;
+    int i, n = 0;
+
+    switch (c->type) {
+        case C_ARRAY:
+            for (i = 0; i < c->n; i++) {
+                if (i == 0 || c->values[i] != c->values[i - 1] + 1) {
+                    n++;
+                }
+            }
+            return n;
+        case C_BITMAP:
+            /* a run starts at every set bit following a clear bit */
+            for (i = 0; i < BITMAP_WORDS; i++) {
+                x = c->words[i];
+                n += popcount(x & ~((x << 1) | carry));
+                carry = x >> 63;
+            }
+            return n;
+        default:
+            return c->n;
+    }
+}
+
+/*
+ * Converts an array or bitmap container to a run container of n_runs runs.
+ * Returns 0 on success, or -1 on failure.
+ */
+static int to_runs(container_t *c, int n_runs) {
+    run_t *runs = malloc((n_runs ? n_runs : 1) * sizeof(run_t));
+    int i, n = 0, v;
+
+    if (!runs) {
+        return -1;
+    }
+
+    if (c->type == C_ARRAY) {
+        for (i = 0; i < c->n; i++) {
+            if (n && c->values[i] == runs[n - 1].last + 1) {
+                runs[n - 1].last = c->values[i];
+            } else {
+                runs[n].start = runs[n].last = c->values[i];
+                n++;
+            }
+        }
+    } else {
+        for (v = 0; v < 65536; v++) {
+            if (!HAS_BIT(c->words, v)) {
+                continue;
+            }
+            if (n && v == runs[n - 1].last + 1) {
+                runs[n - 1].last = v;
+            } else {
+                runs[n].start = runs[n].last = v;
+                n++;
+            }
+        }
+    }
+
+    container_free(c);
+    c->runs = runs;
+    c->n = n;
+    c->size = n_runs ? n_runs : 1;
+    c->type = C_RUN;
+    return 0;
+}
+
+/*
+ * Converts a container to whichever of an array or a bitmap is smaller.
+ * Returns 0 on success, or -1 on failure.
+ */
+static int normalize(container_t *c) {
+    if (c->type != C_ARRAY && c->card <= ARRAY_MAXCARD) {
+        return to_array(c);
+    }
+    if (c->type != C_BITMAP && c->card > ARRAY_MAXCARD) {
+        return to_bitmap(c);
+    }
+    return 0;
+}
+
+/* Returns the index of the first value of an array container not less than v */
+static int array_lowerbound(container_t *c, int from, int v) {
+    int lo = from, hi = c->n, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (c->values[mid] < v) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Returns the index of the first run of a run container ending at or after v */
+static int run_lowerbound(container_t *c, int from, int v) {
+    int lo = from, hi = c->n, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (c->runs[mid].last < v) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int container_contains(container_t *c, uint16_t v) {
+    int i;
+
+    switch (c->type) {
+        case C_ARRAY:
+            i = array_lowerbound(c, 0, v);
+            return i < c->n && c->values[i] == v;
+        case C_BITMAP:
+            return HAS_BIT(c->words, v);
+        default:
+            i = run_lowerbound(c, 0, v);
+            return i < c->n && c->runs[i].start <= v;
+    }
+}
+
+/*
+ * Adds v to the given container.
+ * Returns 1 if it was added, 0 if it was already present, or -1 on failure.
+ */
+static int container_add(container_t *c, uint16_t v) {
+    int i;
+
+    if (container_contains(c, v)) {
+        return 0;
+    }
+
+    if (c->type == C_ARRAY && c->card == ARRAY_MAXCARD && to_bitmap(c) < 0) {
+        return -1;
+    }
+    if (c->type == C_RUN && c->n == RUNS_MAX && to_bitmap(c) < 0) {
+        return -1;
+    }
+
+    switch (c->type) {
+        case C_ARRAY:
+            if (container_reserve(c, c->n + 1) < 0) {
+                return -1;
+            }
+            i = array_lowerbound(c, 0, v);
+            memmove(c->values + i + 1, c->values + i, (c->n - i) * sizeof(uint16_t));
+            c->values[i] = v;
+            c->n++;
+            break;
+        case C_BITMAP:
+            c->words[v >> 6] |= 1ULL << (v & 63);
+            break;
+        case C_RUN:
+            /* runs[i] is the first run ending after v, so runs[i - 1] ends before v */
+            i = run_lowerbound(c, 0, v);
+            if (i > 0 && c->runs[i - 1].last + 1 == v) {
+                c->runs[i - 1].last = v;
+                if (i < c->n && c->runs[i].start == v + 1) {
+                    /* v joins two runs */
+                    c->runs[i - 1].last = c->runs[i].last;
+                    memmove(c->runs + i, c->runs + i + 1, (c->n - i - 1) * sizeof(run_t));
+                    c->n--;
+                }
+            } else if (i < c->n && c->runs[i].start == v + 1) {
+                c->runs[i].start = v;
+            } else {
+                if (container_reserve(c, c->n + 1) < 0) {
+                    return -1;
+                }
+                memmove(c->runs + i + 1, c->runs + i, (c->n - i) * sizeof(run_t));
+                c->runs[i].start = c->runs[i].last = v;
+                c->n++;
+            }
+            break;
+    }
+    c->card++;
+    return 1;
+}
+
+/*
+ * Returns a container holding the values of c, which is not a run
+ * container: c itself, or tmp holding a copy. Returns NULL on failure.
+ */
+static container_t *unrun(container_t *c, container_t *tmp) {
+    if (c->type != C_RUN) {
+        return c;
+    }
+    if (container_copy(c, tmp) < 0) {
+        return NULL;
+    }
+    if (normalize(tmp) < 0) {
+        container_free(tmp);
+        return NULL;
+    }
+    return tmp;
+}
+
+/* Sums the set bits of a bitmap container into its cardinality */
+static void count_bits(container_t *c) {
+    int i;
+
+    c->card = 0;
+    for (i = 0; i < BITMAP_WORDS; i++) {
+        c->card += popcount(c->words[i]);
+    }
+}
+
+static int container_and(container_t *a, container_t *b, container_t *out) {
+    container_t *tmp;
+    int i, j;
+
+    if (a->type == C_BITMAP && b->type == C_BITMAP) {
+        if (container_init(out, C_BITMAP, a->key, 0) < 0) {
+            return -1;
+        }
+        for (i = 0; i < BITMAP_WORDS; i++) {
+            out->words[i] = a->words[i] & b->words[i];
+        }
+        count_bits(out);
+        return normalize(out);
+    }
+
+    if (a->type == C_BITMAP) {
+        /* probe the bitmap with the values of the array */
+        tmp = a;
+        a = b;
+        b = tmp;
+    }
+    if (container_init(out, C_ARRAY, a->key, a->n) < 0) {
+        return -1;
+    }
+
+    if (b->type == C_BITMAP) {
+        for (i = 0; i < a->n; i++) {
+            if (HAS_BIT(b->words, a->values[i])) {
+                out->values[out->n++] = a->values[i];
+            }
+        }
+    } else {
+        for (i = j = 0; i < a->n && j < b->n; ) {
+            if (a->values[i] < b->values[j]) {
+                i++;
+            } else if (a->values[i] > b->values[j]) {
+                j++;
+            } else {
+                out->values[out->n++] = a->values[i];
+                i++;
+                j++;
+            }
+        }
+    }
+    out->card = out->n;
+    return 0;
+}
+
+static int container_or(container_t *a, container_t *b, container_t *out) {
+    container_t *tmp;
+    int i, j;
+
+    if (a->type == C_ARRAY && b->type == C_ARRAY) {
+        if (container_init(out, C_ARRAY, a->key, a->n + b->n) < 0) {
+            return -1;
+        }
+        for (i = j = 0; i < a->n || j < b->n; ) {
+            if (j == b->n || (i < a->n && a->values[i] < b->values[j])) {
+                out->values[out->n++] = a->values[i++];
+            } else if (i == a->n || a->values[i] > b->values[j]) {
+                out->values[out->n++] = b->values[j++];
+            } else {
+                out->values[out->n++] = a->values[i];
+                i++;
+                j++;
+            }
+        }
+        out->card = out->n;
+        return normalize(out);
+    }
+
+    if (a->type != C_BITMAP) {
+        /* set the values of the array in a copy of the bitmap */
+        tmp = a;
+        a = b;
+        b = tmp;
+    }
+    if (container_copy(a, out) < 0) {
+        return -1;
+    }
+
+    if (b->type == C_BITMAP) {
+        for (i = 0; i < BITMAP_WORDS; i++) {
+            out->words[i] |= b->words[i];
+        }
+    } else {
+        for (i = 0; i < b->n; i++) {
+            out->words[b->values[i] >> 6] |= 1ULL << (b->values[i] & 63);
+        }
+    }
+    count_bits(out);
+    return 0;
+}
+
+static int container_andnot(container_t *a, container_t *b, container_t *out) {
+    int i, j;
+
+    if (a->type == C_BITMAP) {
+        if (container_copy(a, out) < 0) {
+            return -1;
+        }
+        if (b->type == C_BITMAP) {
+            for (i = 0; i < BITMAP_WORDS; i++) {
+                out->words[i] &= ~b->words[i];
+            }
+        } else {
+            for (i = 0; i < b->n; i++) {
+                out->words[b->values[i] >> 6] &= ~(1ULL << (b->values[i] & 63));
+            }
+        }
+        count_bits(out);
+        return normalize(out);
+    }
+
+    if (container_init(out, C_ARRAY, a->key, a->n) < 0) {
+        return -1;
+    }
+
+    if (b->type == C_BITMAP) {
+        for (i = 0; i < a->n; i++) {
+            if (!HAS_BIT(b->words, a->values[i])) {
+                out->values[out->n++] = a->values[i];
+            }
+        }
+    } else {
+        for (i = j = 0; i < a->n; i++) {
+            while (j < b->n && b->values[j] < a->values[i]) {
+                j++;
+            }
+            if (j == b->n || b->values[j] != a->values[i]) {
+                out->values[out->n++] = a->values[i];
+            }
+        }
+    }
+    out->card = out->n;
+    return 0;
+}
+
+
+/******************************************************************************
+ *                                  Bitmaps                                   *
+ ******************************************************************************/
+
+roaring_t *roaring_create() {
+    roaring_t *bits = calloc(1, sizeof(roaring_t));
+    if (!bits) {
+        ERROR_PRINT("out of memory");
+    }
+    return bits;
+}
+
+void roaring_destroy(roaring_t *bits) {
+    int i;
+
+    for (i = 0; i < bits->n_cs; i++) {
+        container_free(&bits->cs[i]);
+    }
+    free(bits->cs);
+    free(bits);
+}
+
+/*
+ * Makes room for one more container.
+ * Returns 0 on success, or -1 on failure.
+ */
+static int reserve_container(roaring_t *bits) {
+    if (bits->n_cs == bits->max_cs) {
+        int max_cs = bits->max_cs ? 2 * bits->max_cs : 4;
+        container_t *cs = realloc(bits->cs, max_cs * sizeof(container_t));
+        if (!cs) {
+            return -1;
+        }
+        bits->cs = cs;
+        bits->max_cs = max_cs;
+    }
+    return 0;
+}
+
+/* Returns the index of the first container with a key not less than key */
+static int find_container(roaring_t *bits, int from, uint16_t key) {
+    int lo = from, hi = bits->n_cs, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (bits->cs[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int roaring_add(roaring_t *bits, uint32_t value) {
+    uint16_t key = value >> 16;
+    int i = bits->n_cs, added;
+
+    /* values are usually added in ascending order, to the last container */
+    if (i > 0 && bits->cs[i - 1].key >= key) {
+        i = (bits->cs[i - 1].key == key) ? i - 1 : find_container(bits, 0, key);
+    }
+
+    if (i == bits->n_cs || bits->cs[i].key != key) {
+        if (reserve_container(bits) < 0) {
+            ERROR_PRINT("out of memory");
+            return -1;
+        }
+        memmove(bits->cs + i + 1, bits->cs + i, (bits->n_cs - i) * sizeof(container_t));
+        if (container_init(&bits->cs[i], C_ARRAY, key, 0) < 0) {
+            memmove(bits->cs + i, bits->cs + i + 1, (bits->n_cs - i) * sizeof(container_t));
+            ERROR_PRINT("out of memory");
+            return -1;
+        }
+        bits->n_cs++;
+    }
+
+    added = container_add(&bits->cs[i], value & 0xffff);
+    if (added < 0) {
+        ERROR_PRINT("out of memory");
+        return -1;
+    }
+    bits->card += added;
+    return 0;
+}
+
+int roaring_contains(roaring_t *bits, uint32_t value) {
+    int i = find_container(bits, 0, value >> 16);
+
+    return i < bits->n_cs && bits->cs[i].key == (value >> 16)
+        && container_contains(&bits->cs[i], value & 0xffff);
+}
+
+int roaring_size(roaring_t *bits) {
+    return bits->card;
+}
+
+/*
+ * Appends a copy of container c to the given bitmap, or c itself if it is
+ * not to be kept by the caller.
+ * Returns 0 on success, or -1 on failure.
+ */
+static int append_container(roaring_t *bits, container_t *c, int copy) {
+    if (reserve_container(bits) < 0) {
+        if (!copy) container_free(c);
+        return -1;
+    }
+    if (copy) {
+        if (container_copy(c, &bits->cs[bits->n_cs]) < 0) {
+            return -1;
+        }
+    } else {
+        bits->cs[bits->n_cs] = *c;
+    }
+    bits->card += c->card;
+    bits->n_cs++;
+    return 0;
+}
+
+/*
+ * Combines the containers of a and b with the given operation where their
+ * keys match. Containers only found in a (or b) are copied if keep_a (or
+ * keep_b) is set, and skipped otherwise.
+ */
+static roaring_t *combine(roaring_t *a, roaring_t *b, container_op_t op, int keep_a, int keep_b) {
+    roaring_t *bits = roaring_create();
+    container_t tmp_a, tmp_b, out, *ca, *cb;
+    int i = 0, j = 0, status = 0;
+
+    if (!bits) {
+        return NULL;
+    }
+
+    while (status == 0 && (i < a->n_cs || j < b->n_cs)) {
+        if (j == b->n_cs || (i < a->n_cs && a->cs[i].key < b->cs[j].key)) {
+            if (!keep_a) {
+                /* skip to the next key of b */
+                i = (j < b->n_cs) ? find_container(a, i, b->cs[j].key) : a->n_cs;
+                continue;
+            }
+            status = append_container(bits, &a->cs[i++], 1);
+        } else if (i == a->n_cs || a->cs[i].key > b->cs[j].key) {
+            if (!keep_b) {
+                j = (i < a->n_cs) ? find_container(b, j, a->cs[i].key) : b->n_cs;
+                continue;
+            }
+            status = append_container(bits, &b->cs[j++], 1);
+        } else {
+            ca = unrun(&a->cs[i], &tmp_a);
+            cb = unrun(&b->cs[j], &tmp_b);
+
+            status = (ca && cb) ? op(ca, cb, &out) : -1;
+            if (status == 0 && out.card) {
+                status = append_container(bits, &out, 0);
+            } else if (status == 0) {
+                container_free(&out);
+            }
+
+            if (ca == &tmp_a) container_free(&tmp_a);
+            if (cb == &tmp_b) container_free(&tmp_b);
+            i++;
+            j++;
+        }
+    }
+
+    if (status < 0) {
+        ERROR_PRINT("out of memory");
+        roaring_destroy(bits);
+        return NULL;
+    }
+    return bits;
+}
+
+roaring_t *roaring_and(roaring_t *a, roaring_t *b) {
+    return combine(a, b, container_and, 0, 0);
+}
+
+roaring_t *roaring_or(roaring_t *a, roaring_t *b) {
+    return combine(a, b, container_or, 1, 1);
+}
+
+roaring_t *roaring_andnot(roaring_t *a, roaring_t *b) {
+    return combine(a, b, container_andnot, 1, 0);
+}
+
+void roaring_optimize(roaring_t *bits) {
+    container_t *c;
+    int i, n_runs, plain_bytes;
+
+    for (i = 0; i < bits->n_cs; i++) {
+        c = &bits->cs[i];
+        n_runs = count_runs(c);
+        plain_bytes = (c->card <= ARRAY_MAXCARD) ? c->card * 2 : BITMAP_WORDS * 8;
+
+        /* conversions are best effort; a failed one leaves the container as it was */
+        if (c->type != C_RUN && n_runs * (int)sizeof(run_t) < plain_bytes) {
+            to_runs(c, n_runs);
+        } else if (c->type == C_RUN && n_runs * (int)sizeof(run_t) >= plain_bytes) {
+            normalize(c);
+        }
+    }
+}
+
+
+/******************************************************************************
+ *                                 Iterators                                  *
+ ******************************************************************************/
+
+roaring_iter_t *roaring_createiter(roaring_t *bits) {
+    roaring_iter_t *iter = malloc(sizeof(roaring_iter_t));
+    if (!iter) {
+        ERROR_PRINT("out of memory");
+        return NULL;
+    }
+    iter->bits = bits;
+    iter->c = 0;
+    iter->pos = 0;
+    iter->off = 0;
+    return iter;
+}
+
+void roaring_destroyiter(roaring_iter_t *iter) {
+    free(iter);
+}
+
+int roaring_next(roaring_iter_t *iter, uint32_t *value) {
+    container_t *c;
+    uint64_t bits;
+    int w;
+
+    for (; iter->c < iter->bits->n_cs; iter->c++, iter->pos = iter->off = 0) {
+        c = &iter->bits->cs[iter->c];
+
+        switch (c->type) {
+            case C_ARRAY:
+                if (iter->pos < c->n) {
+                    *value = ((uint32_t)c->key << 16) | c->values[iter->pos++];
+                    return 1;
+                }
+                break;
+            case C_BITMAP:
+                if (iter->pos >= 65536) {
+                    break;
+                }
+                /* the first set bit at or after pos */
+                w = iter->pos >> 6;
+                bits = c->words[w] & (~0ULL << (iter->pos & 63));
+                while (!bits && ++w < BITMAP_WORDS) {
+                    bits = c->words[w];
+                }
+                if (bits) {
+                    iter->pos = w * 64 + ctz(bits) + 1;
+                    *value = ((uint32_t)c->key << 16) | (iter->pos - 1);
+                    return 1;
+                }
+                break;
+            case C_RUN:
+                for (; iter->pos < c->n; iter->pos++) {
+                    if (iter->off < c->runs[iter->pos].start) {
+                        iter->off = c->runs[iter->pos].start;
+                    }
+                    if (iter->off <= c->runs[iter->pos].last) {
+                        *value = ((uint32_t)c->key << 16) | iter->off++;
+                        return 1;
+                    }
+                }
+                break;
+        }
+    }
+    return 0;
+}
+
+int roaring_advance(roaring_iter_t *iter, uint32_t target, uint32_t *value) {
+    uint16_t key = target >> 16;
+    int low = target & 0xffff;
+    container_t *c;
+
+    if (iter->c < iter->bits->n_cs && iter->bits->cs[iter->c].key < key) {
+        iter->c = find_container(iter->bits, iter->c, key);
+        iter->pos = iter->off = 0;
+    }
+
+    if (iter->c < iter->bits->n_cs && iter->bits->cs[iter->c].key == key) {
+        /* move forward within the container */
+        c = &iter->bits->cs[iter->c];
+        switch (c->type) {
+            case C_ARRAY:
+                iter->pos = array_lowerbound(c, iter->pos, low);
+                break;
+            case C_BITMAP:
+                if (iter->pos < low) {
+                    iter->pos = low;
+                }
+                break;
+            case C_RUN:
+                iter->pos = run_lowerbound(c, iter->pos, low);
+                if (iter->off < low) {
+                    iter->off = low;
+                }
+                break;
+        }
+    }
+    return roaring_next(iter, value);
+}
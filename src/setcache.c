@@ -0,0 +1,175 @@
+/*
+ * LRU cache of reference counted sets.
+ * Entries are found through a map keyed on strings, and ordered in a
+ * doubly linked list from most to least recently used.
+ */
+
+#include "setcache.h"
+#include "map.h"
+#include "printing.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct sc_entry {
+    char       *key;
+    set_t      *set;
+    size_t      cost;     // number of elements accounted for by this entry
+    int         refs;     // the cache holds one reference while the entry is cached
+    sc_entry_t *prev;     // more recently used
+    sc_entry_t *next;     // less recently used
+};
+
+struct setcache {
+    map_t        *entries;   // key => sc_entry_t
+    sc_entry_t   *mru;
+    sc_entry_t   *lru;
+    size_t        elems;
+    size_t        max_elems;
+    unsigned long hits;
+    unsigned long misses;
+};
+
+
+setcache_t *setcache_create(size_t max_elems) {
+    setcache_t *cache = malloc(sizeof(setcache_t));
+    if (cache == NULL) {
+        ERROR_PRINT("out of memory");
+        return NULL;
+    }
+
+    cache->entries = map_create(compare_strings, hash_string);
+    if (cache->entries == NULL) {
+        free(cache);
+        return NULL;
+    }
+
+    cache->mru = NULL;
+    cache->lru = NULL;
+    cache->elems = 0;
+    cache->max_elems = max_elems;
+    cache->hits = 0;
+    cache->misses = 0;
+
+    return cache;
+}
+
+static void entry_release(sc_entry_t *e) {
+    if (--e->refs == 0) {
+        if (e->set) {
+            set_destroy(e->set);
+        }
+        free(e->key);
+        free(e);
+    }
+}
+
+static void lru_unlink(setcache_t *cache, sc_entry_t *e) {
+    if (e->prev) {
+        e->prev->next = e->next;
+    } else {
+        cache->mru = e->next;
+    }
+
+    if (e->next) {
+        e->next->prev = e->prev;
+    } else {
+        cache->lru = e->prev;
+    }
+    e->prev = e->next = NULL;
+}
+
+static void lru_pushfront(setcache_t *cache, sc_entry_t *e) {
+    e->prev = NULL;
+    e->next = cache->mru;
+    if (cache->mru) {
+        cache->mru->prev = e;
+    } else {
+        cache->lru = e;
+    }
+    cache->mru = e;
+}
+
+static void cache_evict(setcache_t *cache, sc_entry_t *e) {
+    map_remove(cache->entries, e->key);
+    lru_unlink(cache, e);
+    cache->elems -= e->cost;
+    entry_release(e);
+}
+
+void setcache_clear(setcache_t *cache) {
+    while (cache->lru) {
+        cache_evict(cache, cache->lru);
+    }
+}
+
+void setcache_destroy(setcache_t *cache) {
+    setcache_clear(cache);
+    map_destroy(cache->entries, NULL, NULL);
+    free(cache);
+}
+
+sc_entry_t *setcache_get(setcache_t *cache, const char *key) {
+    sc_entry_t *e = map_get(cache->entries, (void *)key);
+
+    if (!e) {
+        cache->misses++;
+        return NULL;
+    }
+
+    cache->hits++;
+    lru_unlink(cache, e);
+    lru_pushfront(cache, e);
+    e->refs++;
+
+    return e;
+}
+
+sc_entry_t *setcache_put(setcache_t *cache, const char *key, set_t *set) {
+    sc_entry_t *e, *old;
+    size_t cost = 1 + (set ? set_size(set) : 0);
+
+    if (cost > cache->max_elems) {
+        return NULL;
+    }
+
+    e = malloc(sizeof(sc_entry_t));
+    if (!e) {
+        return NULL;
+    }
+    e->key = strdup(key);
+    if (!e->key) {
+        free(e);
+        return NULL;
+    }
+
+    if ((old = map_get(cache->entries, e->key))) {
+        cache_evict(cache, old);
+    }
+
+    while (cache->lru && cache->elems + cost > cache->max_elems) {
+        cache_evict(cache, cache->lru);
+    }
+
+    e->set = set;
+    e->cost = cost;
+    e->refs = 2;  // the cache, and the caller
+    map_put(cache->entries, e->key, e);
+    lru_pushfront(cache, e);
+    cache->elems += cost;
+
+    return e;
+}
+
+set_t *setcache_set(sc_entry_t *entry) {
+    return entry->set;
+}
+
+void setcache_release(setcache_t *cache, sc_entry_t *entry) {
+    entry_release(entry);
+}
+
+void setcache_stats(setcache_t *cache, unsigned long *hits, unsigned long *misses) {
+    *hits = cache->hits;
+    *misses = cache->misses;
+}
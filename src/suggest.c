@@ -0,0 +1,262 @@
+/*
+ * Trie of all prefixes of the terms, where each node holds the ordinals of
+ * the top ranked terms below it. Nodes are stored in arrays, the children
+ * of each node being contiguous and ordered by their character.
+ *
+ * The trie is built depth-first over the sorted terms, so the terms below
+ * a node form a contiguous range. The completions of a node are ranked from
+ * its own term and the completions of its children, and a node with a
+ * single child and no term of its own shares the completions of its child.
+ */
+
+#include "suggest.h"
+#include "printing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct suggester {
+    char         **terms;       // by ordinal, a copy of the array given
+    int            k;
+    int            n_nodes;
+    unsigned char *labels;      // character leading to each node
+    int           *children;    // first child of each node
+    int           *n_children;
+    int           *tops;        // offset of the completions of each node in ranked
+    int           *n_tops;
+    int           *ranked;      // ordinals of completions, most frequent first
+    int            n_ranked;
+};
+
+/* Type of candidate completion */
+typedef struct candidate {
+    int freq;
+    int ordinal;
+} candidate_t;
+
+/* State of a suggester while it is built */
+typedef struct builder {
+    suggester_t *s;
+    int         *freqs;
+    int          max_nodes;
+    int          max_ranked;
+    candidate_t *candidates;    // room for the completions of a term and all children of a node
+} builder_t;
+
+
+/* Ranks candidates by descending frequency, then by term order */
+static int compare_candidates(const void *a, const void *b) {
+    const candidate_t *x = a, *y = b;
+
+    if (x->freq != y->freq) {
+        return (x->freq > y->freq) ? -1 : 1;
+    }
+    return x->ordinal - y->ordinal;
+}
+
+/*
+ * Appends n nodes to the trie.
+ * Returns the index of the first of them, or -1 on failure.
+ */
+static int newnodes(builder_t *b, int n) {
+    suggester_t *s = b->s;
+
+    if (s->n_nodes + n > b->max_nodes) {
+        int max = b->max_nodes ? 2 * b->max_nodes : 1024;
+        while (max < s->n_nodes + n) {
+            max *= 2;
+        }
+
+        void *labels = realloc(s->labels, max);
+        if (labels) s->labels = labels;
+        void *children = realloc(s->children, max * sizeof(int));
+        if (children) s->children = children;
+        void *n_children = realloc(s->n_children, max * sizeof(int));
+        if (n_children) s->n_children = n_children;
+        void *tops = realloc(s->tops, max * sizeof(int));
+        if (tops) s->tops = tops;
+        void *n_tops = realloc(s->n_tops, max * sizeof(int));
+        if (n_tops) s->n_tops = n_tops;
+
+        if (!labels || !children || !n_children || !tops || !n_tops) {
+            return -1;
+        }
+        b->max_nodes = max;
+    }
+
+    s->n_nodes += n;
+    return s->n_nodes - n;
+}
+
+/*
+ * Ranks the completions of the given node from its own term (or -1) and
+ * the completions of its children.
+ * Returns 0 on success, or -1 on failure.
+ */
+static int rank_node(builder_t *b, int node, int own) {
+    suggester_t *s = b->s;
+    int i, j, child, n = 0;
+
+    if (own < 0 && s->n_children[node] == 1) {
+        /* the completions are those of the only child */
+        s->tops[node] = s->tops[s->children[node]];
+        s->n_tops[node] = s->n_tops[s->children[node]];
+        return 0;
+    }
+
+    if (own >= 0) {
+        b->candidates[n++] = (candidate_t){ b->freqs[own], own };
+    }
+    for (i = 0; i < s->n_children[node]; i++) {
+        child = s->children[node] + i;
+        for (j = 0; j < s->n_tops[child]; j++) {
+            int ordinal = s->ranked[s->tops[child] + j];
+            b->candidates[n++] = (candidate_t){ b->freqs[ordinal], ordinal };
+        }
+    }
+    qsort(b->candidates, n, sizeof(candidate_t), compare_candidates);
+    if (n > s->k) {
+        n = s->k;
+    }
+
+    if (s->n_ranked + n > b->max_ranked) {
+        int max = b->max_ranked ? 2 * b->max_ranked : 4096;
+        while (max < s->n_ranked + n) {
+            max *= 2;
+        }
+        int *ranked = realloc(s->ranked, max * sizeof(int));
+        if (!ranked) {
+            return -1;
+        }
+        s->ranked = ranked;
+        b->max_ranked = max;
+    }
+
+    s->tops[node] = s->n_ranked;
+    s->n_tops[node] = n;
+    for (i = 0; i < n; i++) {
+        s->ranked[s->n_ranked++] = b->candidates[i].ordinal;
+    }
+    return 0;
+}
+
+/*
+ * Builds the subtrie of the given node, whose terms are those in [lo, hi),
+ * sharing their first 'depth' characters.
+ * Recursion is bounded by the length of the longest term.
+ * Returns 0 on success, or -1 on failure.
+ */
+static int build_node(builder_t *b, int node, int lo, int hi, int depth) {
+    char **terms = b->s->terms;
+    int own = -1, first, n_groups = 0, i, start;
+
+    if (lo < hi && terms[lo][depth] == '\0') {
+        /* a term ends at this node, and is ordered before all others below it */
+        own = lo++;
+    }
+
+    for (i = lo; i < hi; i++) {
+        if (i == lo || terms[i][depth] != terms[i - 1][depth]) {
+            n_groups++;
+        }
+    }
+    if ((first = newnodes(b, n_groups)) < 0) {
+        return -1;
+    }
+    b->s->children[node] = first;
+    b->s->n_children[node] = n_groups;
+
+    /* each group of terms sharing the next character is the subtrie of a child */
+    for (start = lo, i = lo; i < hi; start = i) {
+        for (i = start + 1; i < hi && terms[i][depth] == terms[start][depth]; i++);
+        b->s->labels[first] = terms[start][depth];
+        if (build_node(b, first++, start, i, depth + 1) < 0) {
+            return -1;
+        }
+    }
+
+    return rank_node(b, node, own);
+}
+
+suggester_t *suggester_build(char **terms, int *freqs, int n_terms, int k) {
+    builder_t b = { NULL, freqs, 0, 0, NULL };
+    suggester_t *s;
+    int i;
+
+    for (i = 1; i < n_terms; i++) {
+        if (strcmp(terms[i - 1], terms[i]) >= 0) {
+            ERROR_PRINT("suggester terms must be unique and sorted");
+            return NULL;
+        }
+    }
+
+    s = calloc(1, sizeof(suggester_t));
+    b.candidates = malloc((1 + 256 * (size_t)k) * sizeof(candidate_t));
+    if (!s || !b.candidates) {
+        goto error;
+    }
+    b.s = s;
+    s->terms = malloc((n_terms + 1) * sizeof(char *));
+    s->k = k;
+    if (!s->terms) {
+        goto error;
+    }
+    memcpy(s->terms, terms, n_terms * sizeof(char *));
+
+    /* the root */
+    if (newnodes(&b, 1) < 0 || build_node(&b, 0, 0, n_terms, 0) < 0) {
+        goto error;
+    }
+
+    free(b.candidates);
+    return s;
+
+error:
+    ERROR_PRINT("out of memory");
+    if (s) suggester_destroy(s);
+    free(b.candidates);
+    return NULL;
+}
+
+void suggester_destroy(suggester_t *suggester) {
+    free(suggester->terms);
+    free(suggester->labels);
+    free(suggester->children);
+    free(suggester->n_children);
+    free(suggester->tops);
+    free(suggester->n_tops);
+    free(suggester->ranked);
+    free(suggester);
+}
+
+int suggester_lookup(suggester_t *suggester, const char *prefix, char **terms, int max_terms) {
+    const unsigned char *c = (const unsigned char *)prefix;
+    int node = 0, lo, hi, mid, i;
+
+    for (; *c; c++) {
+        /* binary search for the child labeled *c */
+        lo = suggester->children[node];
+        hi = lo + suggester->n_children[node];
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (suggester->labels[mid] < *c) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo == suggester->children[node] + suggester->n_children[node] || suggester->labels[lo] != *c) {
+            return 0;
+        }
+        node = lo;
+    }
+
+    if (max_terms > suggester->n_tops[node]) {
+        max_terms = suggester->n_tops[node];
+    }
+    for (i = 0; i < max_terms; i++) {
+        terms[i] = suggester->terms[suggester->ranked[suggester->tops[node] + i]];
+    }
+    return max_terms;
+}
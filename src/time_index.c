@@ -31,6 +31,7 @@
 */
 
 #include "index.h"
+#include "list.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -55,10 +56,14 @@ static int is_reserved_word(char *word) {
         return 1;
     else if (strcmp(word, "OR") == 0)
         return 1;
+    else if (strcmp(word, "NOT") == 0)
+        return 1;
     else if (strcmp(word, "(") == 0)
         return 1;
     else if (strcmp(word, ")") == 0)
         return 1;
+    else if (strncmp(word, "NEAR/", 5) == 0)
+        return 1;
     else
         return 0;
 }
@@ -100,14 +105,53 @@ end:
     return s;
 }
 
+/*
+ *  `REFERENCE: <phrase_token> @ <indexer.c>`
+ *  copied in its entirety
+ */
+static char *phrase_token(char *start, char **end) {
+    char *s, *c, *t, *term;
+    int n;
+
+    for (s = start + 1; (*s != '"') && (*s != '\0'); s++);
+    *end = (*s == '"') ? (s + 1) : s;
+
+    /* each word may be followed by a separator, in addition to the quotes */
+    term = malloc(2 * (s - start) + 3);
+    if (term == NULL) {
+        printf("out of memory\n");
+        return NULL;
+    }
+
+    t = term;
+    *t++ = '"';
+    for (c = start + 1; c < s; ) {
+        if (!isalnum((unsigned char)*c)) {
+            c++;
+            continue;
+        }
+        if (t > term + 1) {
+            *t++ = ' ';
+        }
+        /* words are at most 100 characters long */
+        for (n = 0; (c < s) && isalnum((unsigned char)*c) && (n < 100); c++, n++) {
+            *t++ = tolower(*c);
+        }
+    }
+    *t++ = '"';
+    *t = '\0';
+
+    return term;
+}
+
 /*
  *  `REFERENCE: <tokenize_query> @ <indexer.c>`
  *  copied in its entirety
  */
-static list_t *tokenize_query(char *query) {
+static vector_t *tokenize_query(char *query) {
     char *term;
-    list_t *processed;
-    processed = list_create(compare_strings);
+    vector_t *processed;
+    processed = vector_create(compare_strings);
 
     while (*query != '\0') {
         if (isspace(*query)) {
@@ -115,11 +159,14 @@ static list_t *tokenize_query(char *query) {
             query++;
             continue;
         } else if (*query == '(') {
-            list_addlast(processed, strdup("("));
+            vector_push(processed, strdup("("));
             query++;
         } else if (*query == ')') {
-            list_addlast(processed, strdup(")"));
+            vector_push(processed, strdup(")"));
             query++;
+        } else if (*query == '"') {
+            /* "quoted phrase" */
+            vector_push(processed, phrase_token(query, &query));
         } else {
             /* Get length of term */
             char *s;
@@ -129,8 +176,8 @@ static list_t *tokenize_query(char *query) {
             term = substring(query, s);
             query = s;
 
-            /* add to list */
-            list_addlast(processed, term);
+            /* add to vector */
+            vector_push(processed, term);
         }
     }
 
@@ -141,20 +188,19 @@ static list_t *tokenize_query(char *query) {
  *  `REFERENCE: <preprocess_query> @ <indexer.c>`
  *  copied in its entirety
  */
-static list_t *preprocess_query(char *query) {
+static vector_t *preprocess_query(char *query) {
     char *word, *c, *prev;
-    list_t *tokens;
-    list_t *processed;
-    list_iter_t *iter;
+    vector_t *tokens;
+    vector_t *processed;
+    int i;
 
     /* Create tokens */
     tokens = tokenize_query(query);
-    processed = list_create(compare_strings);
+    processed = vector_create(compare_strings);
     prev = NULL;
 
-    iter = list_createiter(tokens);
-    while (list_hasnext(iter)) {
-        word = list_next(iter);
+    for (i = 0; i < vector_size(tokens); i++) {
+        word = vector_get(tokens, i);
 
         /* Is a word */
         if (!is_reserved_word(word)) {
@@ -167,16 +213,15 @@ static list_t *preprocess_query(char *query) {
 
             /* Adjacent words */
             if (prev != NULL && !is_reserved_word(prev)) {
-                list_addlast(processed, strdup("OR"));
+                vector_push(processed, strdup("OR"));
             }
         }
         /* Add to processed tokens */
-        list_addlast(processed, word);
+        vector_push(processed, word);
         prev = word;
     }
 
-    list_destroyiter(iter);
-    list_destroy(tokens);
+    vector_destroy(tokens);
 
     return processed;
 }
@@ -214,8 +259,8 @@ int sort_timeresult_by_nresults(query_time_t *a, query_time_t *b) {
     return (a->ntokens - b->ntokens);
 }
 
-int compare_lists_by_size(list_t *a, list_t *b) {
-    return (list_size(a) - list_size(b));
+int compare_vectors_by_size(vector_t *a, vector_t *b) {
+    return (vector_size(a) - vector_size(b));
 }
 
 static void print_to_csv(FILE *out, int n, long long unsigned t_time) {
@@ -227,7 +272,7 @@ static list_t *load_queries(FILE *csv_in, int n_queries) {
     int count = 0;
     char *errmsg;
 
-    list_t *queries = list_create((cmpfunc_t)compare_lists_by_size);
+    list_t *queries = list_create((cmpfunc_t)compare_vectors_by_size);
 
     /* read queries from file and feed them to the index */
     while (!feof(csv_in) && (count++ < n_queries)) {
@@ -240,7 +285,7 @@ static list_t *load_queries(FILE *csv_in, int n_queries) {
         }
         char *q_dup = strdup(query);
 
-        list_t *tokens = preprocess_query(q_dup);
+        vector_t *tokens = preprocess_query(q_dup);
         list_addlast(queries, tokens);
 
         /* eat the newline */
@@ -262,10 +307,11 @@ static list_t *run_queries(index_t *idx, list_t *queries) {
 
     /* read queries from file and feed them to the index */
     while (list_hasnext(query_iter)) {
-        list_t *tokens = list_next(query_iter);
+        vector_t *tokens = list_next(query_iter);
+        int i;
 
         unsigned long long seg_start = gettime();
-        list_t *results = index_query(idx, tokens, &errmsg);
+        vector_t *results = index_query(idx, tokens, &errmsg);
         unsigned long long seg_end = (gettime() - seg_start);
 
         /* in case there is an error query in the generated file */
@@ -273,33 +319,30 @@ static list_t *run_queries(index_t *idx, list_t *queries) {
             /* create the time result and add to list */
             query_time_t *time_result = malloc(sizeof(query_time_t));
             time_result->time = seg_end;
-            time_result->ntokens = list_size(tokens);
-            time_result->nresults = list_size(results);
+            time_result->ntokens = vector_size(tokens);
+            time_result->nresults = vector_size(results);
             list_addlast(time_results, time_result);
 
-            list_iter_t *result_iter = list_createiter(results);
-            while (list_hasnext(result_iter)) {
-                free(list_next(result_iter));
+            for (i = 0; i < vector_size(results); i++) {
+                free(vector_get(results, i));
             }
+            vector_destroy(results);
         } else {
             n_errors++;
         }
 
-        list_iter_t *tok_iter = list_createiter(tokens);
-
         /* prints below can be uncommented to check query was correctly read 
          * would not recommend doing this with a huge amount of queries. */
 
         // printf("query = `");
-        while (list_hasnext(tok_iter)) {
-            char *tok = list_next(tok_iter);
+        for (i = 0; i < vector_size(tokens); i++) {
+            char *tok = vector_get(tokens, i);
             // printf("%s ", tok);
             free(tok);
         }
         // printf("`\n");
 
-        list_destroyiter(tok_iter);
-        list_destroy(tokens);
+        vector_destroy(tokens);
     }
 
     /* typical query generation has ≈ 4 errors in 20000. may be the gcide lib, idk. */
@@ -387,7 +430,8 @@ int main(int argc, char **argv) {
 
     char *relpath, *fullpath, *root_dir, *query_src, *k_files;
     unsigned long long cum_time, seg_start, seg_time;
-    list_t *files, *words;
+    list_t *files;
+    vector_t *words;
     list_iter_t *iter;
     index_t *idx;
 
@@ -425,7 +469,8 @@ int main(int argc, char **argv) {
     // files = tmp;
 
     idx = index_create();
-    if (!idx) { 
+    words = vector_create((cmpfunc_t)strcmp);
+    if (!idx || !words) { 
         printf("ERROR: Failed to create index\n");
         return 1;
     }
@@ -466,13 +511,13 @@ int main(int argc, char **argv) {
         relpath = list_next(iter);
         fullpath = concatenate_strings(2, root_dir, relpath);
 
-        words = list_create((cmpfunc_t)strcmp);
+        /* the words are owned by the index, so the vector is reused */
+        vector_clear(words);
         tokenize_file(fullpath, words);
 
         index_addpath(idx, relpath, words);
 
         free(fullpath);
-        list_destroy(words);
     }
 
     printf("\nDone indexing %d docs\n", progress);
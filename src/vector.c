@@ -0,0 +1,296 @@
+/*
+ * Growable array implementation of vector.h.
+ *
+ * vector_sort is an introsort: a quicksort on the median of three, which
+ * turns to heapsort when the recursion exceeds twice the log of the size,
+ * and leaves short ranges to a final insertion sort.
+ * vector_radixsort sorts the 64-bit keys least significant byte first,
+ * skipping bytes that are equal across all keys, as most high bytes are.
+ */
+
+#include "vector.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+#define INSERTION_MAX  16   // ranges this short are left to insertion sort
+#define RADIX_BITS     8
+#define RADIX_BUCKETS  (1 << RADIX_BITS)
+#define RADIX_PASSES   (64 / RADIX_BITS)
+
+struct vector {
+    void **elems;
+    int size;
+    int cap;
+    cmpfunc_t cmpfunc;
+};
+
+
+vector_t *vector_create(cmpfunc_t cmpfunc) {
+    vector_t *vec = malloc(sizeof(vector_t));
+    if (vec == NULL) {
+        return NULL;
+    }
+
+    vec->elems = NULL;
+    vec->size = 0;
+    vec->cap = 0;
+    vec->cmpfunc = cmpfunc;
+    return vec;
+}
+
+void vector_destroy(vector_t *vec) {
+    free(vec->elems);
+    free(vec);
+}
+
+int vector_size(vector_t *vec) {
+    return vec->size;
+}
+
+int vector_reserve(vector_t *vec, int n) {
+    int cap = vec->cap ? vec->cap : 8;
+    void **elems;
+
+    if (n <= vec->cap) {
+        return 1;
+    }
+    while (cap < n) {
+        cap *= 2;
+    }
+    elems = realloc(vec->elems, cap * sizeof(void *));
+    if (elems == NULL) {
+        return 0;
+    }
+
+    vec->elems = elems;
+    vec->cap = cap;
+    return 1;
+}
+
+int vector_push(vector_t *vec, void *elem) {
+    if (vec->size == vec->cap && !vector_reserve(vec, vec->size + 1)) {
+        return 0;
+    }
+    vec->elems[vec->size++] = elem;
+    return 1;
+}
+
+void *vector_pop(vector_t *vec) {
+    if (vec->size == 0) {
+        return NULL;
+    }
+    return vec->elems[--vec->size];
+}
+
+void *vector_get(vector_t *vec, int i) {
+    return vec->elems[i];
+}
+
+void vector_set(vector_t *vec, int i, void *elem) {
+    vec->elems[i] = elem;
+}
+
+void **vector_elems(vector_t *vec) {
+    return vec->elems;
+}
+
+void vector_clear(vector_t *vec) {
+    vec->size = 0;
+}
+
+
+/*
+ * Introsort
+ */
+
+static inline void swap(void **a, void **b) {
+    void *tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+static void siftdown(void **elems, int root, int n, cmpfunc_t cmp) {
+    int child;
+
+    while ((child = 2 * root + 1) < n) {
+        if (child + 1 < n && cmp(elems[child], elems[child + 1]) < 0) {
+            child++;
+        }
+        if (cmp(elems[root], elems[child]) >= 0) {
+            return;
+        }
+        swap(&elems[root], &elems[child]);
+        root = child;
+    }
+}
+
+static void heapsort(void **elems, int n, cmpfunc_t cmp) {
+    int i;
+
+    for (i = n / 2 - 1; i >= 0; i--) {
+        siftdown(elems, i, n, cmp);
+    }
+    for (i = n - 1; i > 0; i--) {
+        swap(&elems[0], &elems[i]);
+        siftdown(elems, 0, i, cmp);
+    }
+}
+
+/*
+ * Partially sorts elems[lo .. hi - 1], leaving ranges of at most
+ * INSERTION_MAX elements unsorted, though in place relative to each other.
+ */
+static void introsort(void **elems, int lo, int hi, int depth, cmpfunc_t cmp) {
+    int mid, i, j;
+    void *pivot;
+
+    while (hi - lo > INSERTION_MAX) {
+        if (depth-- == 0) {
+            heapsort(elems + lo, hi - lo, cmp);
+            return;
+        }
+
+        /* order lo, mid and hi - 1, leaving the median of the three at mid */
+        mid = lo + (hi - lo) / 2;
+        if (cmp(elems[mid], elems[lo]) < 0) {
+            swap(&elems[mid], &elems[lo]);
+        }
+        if (cmp(elems[hi - 1], elems[mid]) < 0) {
+            swap(&elems[hi - 1], &elems[mid]);
+            if (cmp(elems[mid], elems[lo]) < 0) {
+                swap(&elems[mid], &elems[lo]);
+            }
+        }
+        pivot = elems[mid];
+
+        /* lo and hi - 1 bound the scans, as they are on the right sides */
+        i = lo;
+        j = hi - 1;
+        for (;;) {
+            while (cmp(elems[++i], pivot) < 0);
+            while (cmp(pivot, elems[--j]) < 0);
+            if (i >= j) {
+                break;
+            }
+            swap(&elems[i], &elems[j]);
+        }
+
+        /* recurse into the smaller half, and loop on the larger */
+        if (j + 1 - lo < hi - j - 1) {
+            introsort(elems, lo, j + 1, depth, cmp);
+            lo = j + 1;
+        } else {
+            introsort(elems, j + 1, hi, depth, cmp);
+            hi = j + 1;
+        }
+    }
+}
+
+void vector_sort(vector_t *vec) {
+    void **elems = vec->elems, *elem;
+    cmpfunc_t cmp = vec->cmpfunc;
+    int depth = 0, i, j;
+
+    for (i = vec->size; i > 1; i /= 2) {
+        depth += 2;
+    }
+    introsort(elems, 0, vec->size, depth, cmp);
+
+    /* every element is now within INSERTION_MAX of its place */
+    for (i = 1; i < vec->size; i++) {
+        elem = elems[i];
+        for (j = i; j > 0 && cmp(elem, elems[j - 1]) < 0; j--) {
+            elems[j] = elems[j - 1];
+        }
+        elems[j] = elem;
+    }
+}
+
+
+/*
+ * Radix sort
+ */
+
+void vector_radixsort(vector_t *vec, keyfunc_t keyfunc) {
+    int n = vec->size, pass, shift, i;
+    unsigned long long *keys_buf, *keys, *keys_tmp, *ktmp;
+    void **elems = vec->elems, **elems_buf, **elems_tmp, **etmp;
+    int (*counts)[RADIX_BUCKETS];
+    int pos, count;
+
+    if (n < 2) {
+        return;
+    }
+
+    keys_buf = malloc(2 * n * sizeof(unsigned long long));
+    elems_buf = malloc(n * sizeof(void *));
+    counts = calloc(RADIX_PASSES, sizeof(*counts));
+    if (keys_buf == NULL || elems_buf == NULL || counts == NULL) {
+        vector_sort(vec);
+        goto cleanup;
+    }
+    keys = keys_buf;
+    keys_tmp = keys_buf + n;
+    elems_tmp = elems_buf;
+
+    /* count the bytes of every pass in a single read of the keys */
+    for (i = 0; i < n; i++) {
+        keys[i] = keyfunc(elems[i]);
+        for (pass = 0; pass < RADIX_PASSES; pass++) {
+            counts[pass][(keys[i] >> (pass * RADIX_BITS)) & (RADIX_BUCKETS - 1)]++;
+        }
+    }
+
+    for (pass = 0; pass < RADIX_PASSES; pass++) {
+        shift = pass * RADIX_BITS;
+
+        /* all keys share this byte, so the pass would not move them */
+        if (counts[pass][(keys[0] >> shift) & (RADIX_BUCKETS - 1)] == n) {
+            continue;
+        }
+
+        /* turn the counts into the starting position of each bucket */
+        for (i = 0, pos = 0; i < RADIX_BUCKETS; i++) {
+            count = counts[pass][i];
+            counts[pass][i] = pos;
+            pos += count;
+        }
+
+        for (i = 0; i < n; i++) {
+            pos = counts[pass][(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+            keys_tmp[pos] = keys[i];
+            elems_tmp[pos] = elems[i];
+        }
+
+        ktmp = keys;
+        keys = keys_tmp;
+        keys_tmp = ktmp;
+        etmp = elems;
+        elems = elems_tmp;
+        elems_tmp = etmp;
+    }
+
+    /* after an odd number of passes, the sorted elements are in the buffer */
+    if (elems != vec->elems) {
+        memcpy(vec->elems, elems, n * sizeof(void *));
+    }
+
+cleanup:
+    free(keys_buf);
+    free(elems_buf);
+    free(counts);
+}
+
+unsigned long long vector_doublekey(double d) {
+    unsigned long long bits;
+
+    memcpy(&bits, &d, sizeof(bits));
+
+    /* flip negatives entirely, and the sign of positives, so they order as unsigned */
+    if (bits >> 63) {
+        return ~bits;
+    }
+    return bits | (1ULL << 63);
+}